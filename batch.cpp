@@ -0,0 +1,674 @@
+#include "batch.hpp"
+#include "spectrogram.hpp"
+#include "resultcache.hpp"
+#include "instrument.hpp"
+#include "stream.hpp"
+#include "shard.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QImage>
+#include <QList>
+#include <QStringList>
+#include <QTemporaryFile>
+
+const char* const job_cancelled = "cancelled";
+const char* const job_expired = "deadline exceeded";
+
+namespace
+{
+    QMutex palette_mutex;
+    /// Palettes loaded by apply_parameter(), by file name.
+    QMap<QString, Palette> palettes;
+
+    /// Loads a palette image, or returns the remembered palette.
+    bool load_palette(const QString& filename, Palette& palette)
+    {
+        QMutexLocker lock(&palette_mutex);
+        QMap<QString, Palette>::const_iterator it = palettes.find(filename);
+        if (it == palettes.end())
+        {
+            QImage img(filename);
+            if (img.isNull())
+                return false;
+            it = palettes.insert(filename, palette_from_image(img));
+        }
+        palette = it.value();
+        return true;
+    }
+
+    /// Sets the serialized and individual parameters of the job.
+    void apply_parameters(SpectrogramEngine& engine, const Job& job)
+    {
+        if (!job.serialized.isNull())
+            engine.deserialize(job.serialized.toStdString());
+        for (Parameters::const_iterator it = job.parameters.begin();
+                it != job.parameters.end(); ++it)
+            apply_parameter(engine, it.key(), it.value());
+    }
+
+    /// Metadata of an appended spectrogram: its columns and reference.
+    const char* const append_key = "SpectrogramStream";
+
+    /// Adds the columns of the new samples to the output spectrogram.
+    /** Only the samples the stream still needs are decoded, if the format
+     * can seek.  Neither the audio cache nor the PCM cache is used, they
+     * would keep a copy of every length of a growing file. */
+    QString append(const Job& job, const CancelToken* cancel)
+    {
+        Soundfile file(job.input);
+        if (!file.valid())
+            return "not readable or not supported: " + file.error();
+        if (job.channel >= file.data().channels())
+            return "the file doesn't have the requested channel";
+        const int samplerate = file.data().samplerate();
+
+        SpectrogramEngine engine;
+        apply_parameters(engine, job);
+        if (engine.maxfreq > samplerate/2)
+            engine.maxfreq = samplerate/2;
+        // streams only have the STFT, and the image records the method
+        engine.method = ANALYSIS_STFT;
+
+        const QString parameters = QString::fromStdString(engine.serialize());
+        QImage old(job.output);
+        const QStringList state = old.text(append_key).split(' ');
+        const bool resume = !old.isNull() && state.size() == 2 &&
+            old.text("Spectrogram") == parameters &&
+            state[0].toInt() == old.width();
+        AnalysisStream stream(engine, samplerate,
+                resume ? old.width() : 0, resume ? state[1].toFloat() : 0);
+        if (resume && stream.rows() != old.height())
+            return "the spectrogram doesn't match its parameters";
+        if (stream.position() > file.data().frames())
+            return "the sound file is shorter than its spectrogram";
+
+        const real_vec samples = file.read_channel(job.channel,
+                stream.position());
+        if (cancelled(cancel))
+            return job_cancelled;
+        const intensity_matrix data = stream.append(samples.data(),
+                samples.size(), cancel);
+        if (data.empty())
+            return job_cancelled;
+        if (!stream.columns())
+            return "too short for a column yet";
+        const int start = resume ? old.width() : 0;
+        if (stream.columns() == (size_t)start)
+            return QString();
+
+        QImage out = make_canvas(engine.palette, (int)stream.columns(),
+                stream.rows());
+        if (resume)
+        {
+            if (old.format() != out.format())
+                old = old.convertToFormat(out.format(), out.colorTable());
+            const int bytes = old.width()*old.depth()/8;
+            for (int y = 0; y < old.height(); ++y)
+                std::copy(old.scanLine(y), old.scanLine(y) + bytes,
+                        out.scanLine(y));
+        }
+        const PixelBuffer pixels = engine.render(data);
+        for (int y = 0; y < pixels.height; ++y)
+        {
+            const unsigned int* row = &pixels.pixels[(size_t)y*pixels.width];
+            if (pixels.indexed)
+                std::copy(row, row+pixels.width, out.scanLine(y) + start);
+            else
+                std::copy(row, row+pixels.width,
+                        (QRgb*)out.scanLine(y) + start);
+        }
+        out.setText("Spectrogram", parameters);
+        out.setText(append_key, QString("%1 %2").arg(stream.columns())
+                .arg(stream.reference(), 0, 'g', 9));
+        if (!out.save(job.output))
+            return "couldn't save " + job.output;
+        return QString();
+    }
+
+    /// Writes the columns of a live analysis and flushes them.
+    bool write_columns(const SpectrogramEngine& engine,
+            const intensity_matrix& data, LiveOutput output, FILE* out)
+    {
+        const size_t rows = data.size();
+        const size_t count = rows ? data[0].size() : 0;
+        if (output == LIVE_FLOAT)
+        {
+            std::vector<float> column(rows);
+            for (size_t j = 0; j < count; ++j)
+            {
+                for (size_t i = 0; i < rows; ++i)
+                    column[i] = data[rows-1-i][j];
+                if (std::fwrite(&column[0], sizeof(float), rows, out) != rows)
+                    return false;
+            }
+        }
+        else if (count)
+        {
+            const PixelBuffer pixels = engine.render(data);
+            std::vector<unsigned char> column(rows*3);
+            for (size_t x = 0; x < count; ++x)
+            {
+                for (size_t y = 0; y < rows; ++y)
+                {
+                    rgb_t color = pixels.pixels[y*count + x];
+                    if (pixels.indexed)
+                        color = engine.palette.colors()[color];
+                    column[y*3] = qRed(color);
+                    column[y*3+1] = qGreen(color);
+                    column[y*3+2] = qBlue(color);
+                }
+                if (std::fwrite(&column[0], 1, column.size(), out) !=
+                        column.size())
+                    return false;
+            }
+        }
+        return std::fflush(out) == 0;
+    }
+
+    /// Header of a shard file, followed by the parameters and the rows.
+    struct ShardHeader
+    {
+        char magic[4];
+        quint32 version; // also detects a different byte order
+        quint32 shard;
+        quint32 shards;
+        quint64 columns; // of the whole spectrogram
+        quint64 first;
+        quint64 count;
+        quint32 rows;
+        float peak;
+        quint32 parameters; // bytes of the serialized parameters
+        quint32 reserved; // keeps the rows aligned
+    };
+    const char SHARD_MAGIC[4] = {'S', 'P', 'S', 'H'};
+    const quint32 SHARD_VERSION = 1;
+
+    /// Analyzes the job's shard of the signal and writes it to its file.
+    QString write_shard(const Job& job, const SpectrogramEngine& engine,
+            const pcm_buffer& signal, int samplerate,
+            ProgressListener* listener, const CancelToken* cancel)
+    {
+        const ShardPlan plan(engine, signal->size(), samplerate, job.shards);
+        const intensity_matrix data = plan.analyze(signal->data(), job.shard,
+                listener, cancel);
+        if (data.empty())
+            return job_cancelled;
+
+        const QByteArray parameters = engine.serialize().c_str();
+        ShardHeader header;
+        std::memcpy(header.magic, SHARD_MAGIC, 4);
+        header.version = SHARD_VERSION;
+        header.shard = job.shard;
+        header.shards = job.shards;
+        header.columns = plan.columns();
+        header.first = plan.first_column(job.shard);
+        header.count = plan.first_column(job.shard+1) - header.first;
+        header.rows = data.size();
+        header.peak = shard_peak(data);
+        header.parameters = parameters.size();
+        header.reserved = 0;
+
+        // written to a temporary file first, so the stitching never reads
+        // a partial shard from a shared file system
+        const QString name = shard_name(job.output, job.shard, job.shards);
+        QTemporaryFile tmp(name + "-XXXXXX.tmp");
+        if (!tmp.open() ||
+                tmp.write((const char*)&header, sizeof(header)) !=
+                sizeof(header) ||
+                tmp.write(parameters) != parameters.size())
+            return "couldn't write " + name;
+        const qint64 bytes = header.count*sizeof(float);
+        for (size_t i = 0; i < data.size(); ++i)
+            if (bytes && tmp.write((const char*)&data[i][0], bytes) != bytes)
+                return "couldn't write " + name;
+        if (!tmp.flush())
+            return "couldn't write " + name;
+        tmp.setAutoRemove(false);
+        QFile::remove(name);
+        if (!tmp.rename(name))
+        {
+            tmp.remove();
+            return "couldn't write " + name;
+        }
+        return QString();
+    }
+
+    /// Reads the header and the parameters of a shard file.
+    bool read_shard_header(QFile& file, ShardHeader& header,
+            QByteArray& parameters)
+    {
+        if (file.read((char*)&header, sizeof(header)) != sizeof(header) ||
+                std::memcmp(header.magic, SHARD_MAGIC, 4) ||
+                header.version != SHARD_VERSION)
+            return false;
+        parameters = file.read(header.parameters);
+        return parameters.size() == (int)header.parameters &&
+            file.size() == (qint64)(sizeof(header) + header.parameters +
+                    header.rows*header.count*sizeof(float));
+    }
+
+    /// Joins the shards of the output into the spectrogram image.
+    QString stitch(const Job& job, const CancelToken* cancel)
+    {
+        // all the headers first, the loudest shard normalizes all of them
+        std::vector<ShardHeader> headers(job.shards);
+        QByteArray parameters;
+        float peak = 0;
+        for (int k = 0; k < job.shards; ++k)
+        {
+            const QString name = shard_name(job.output, k, job.shards);
+            QFile file(name);
+            QByteArray own;
+            ShardHeader& header = headers[k];
+            if (!file.open(QIODevice::ReadOnly) ||
+                    !read_shard_header(file, header, own))
+                return "missing or invalid shard " + name;
+            if (k == 0)
+                parameters = own;
+            const quint64 first = k ?
+                headers[k-1].first + headers[k-1].count : 0;
+            if ((int)header.shard != k ||
+                    (int)header.shards != job.shards ||
+                    header.columns != headers[0].columns ||
+                    header.rows != headers[0].rows ||
+                    header.first != first || own != parameters)
+                return "shard " + name + " doesn't match the others";
+            peak = std::max(header.peak, peak);
+        }
+        const ShardHeader& last = headers.back();
+        if (last.first + last.count != last.columns)
+            return "the shards don't cover the spectrogram";
+
+        SpectrogramEngine engine;
+        apply_parameters(engine, job);
+        engine.deserialize(parameters.constData());
+        QImage out = make_canvas(engine.palette, (int)last.columns,
+                (int)last.rows);
+        for (int k = 0; k < job.shards; ++k)
+        {
+            if (cancelled(cancel))
+                return job_cancelled;
+            const ShardHeader& header = headers[k];
+            if (!header.count)
+                continue;
+            QFile file(shard_name(job.output, k, job.shards));
+            if (!file.open(QIODevice::ReadOnly) ||
+                    !file.seek(sizeof(header) + header.parameters))
+                return "couldn't read " + file.fileName();
+            intensity_matrix data(header.rows);
+            const qint64 bytes = header.count*sizeof(float);
+            for (size_t i = 0; i < data.size(); ++i)
+            {
+                data[i].resize(header.count);
+                if (file.read((char*)&data[i][0], bytes) != bytes)
+                    return "couldn't read " + file.fileName();
+            }
+            normalize_shard(data, peak);
+
+            const PixelBuffer pixels = engine.render(data);
+            for (int y = 0; y < pixels.height; ++y)
+            {
+                const unsigned int* row =
+                    &pixels.pixels[(size_t)y*pixels.width];
+                if (pixels.indexed)
+                    std::copy(row, row+pixels.width,
+                            out.scanLine(y) + header.first);
+                else
+                    std::copy(row, row+pixels.width,
+                            (QRgb*)out.scanLine(y) + header.first);
+            }
+        }
+        out.setText("Spectrogram", QString::fromLatin1(parameters));
+        if (!out.save(job.output))
+            return "couldn't save " + job.output;
+        return QString();
+    }
+
+    /// Makes a spectrogram image from a sound file.
+    QString analyze(const Job& job, ProgressListener* listener,
+            AudioCache* cache, const CancelToken* cancel)
+    {
+        if (job.append)
+            return append(job, cancel);
+
+        int samplerate = 0;
+        pcm_buffer signal;
+        if (cache)
+            signal = cache->lookup(job.input, job.channel, samplerate);
+        if (!signal)
+        {
+            Soundfile file;
+            if (!job.pcm_cache.isNull())
+                file.set_cache(PcmCache(job.pcm_cache));
+            file.load(job.input);
+            if (!file.valid())
+                return "not readable or not supported: " + file.error();
+            if (job.channel >= file.data().channels())
+                return "the file doesn't have the requested channel";
+            samplerate = file.data().samplerate();
+            signal = file.map_channel(job.channel);
+            if (!signal || signal->empty())
+                return "error reading sound file";
+            if (cache)
+                cache->store(job.input, job.channel, samplerate, signal);
+        }
+        if (cancelled(cancel))
+            return job_cancelled;
+
+        SpectrogramEngine engine;
+        apply_parameters(engine, job);
+        if (engine.maxfreq > samplerate/2)
+            engine.maxfreq = samplerate/2;
+        if (job.shards)
+            return write_shard(job, engine, signal, samplerate, listener,
+                    cancel);
+        if (job.memory_budget > 0)
+        {
+            const double pixpersec = engine.pixpersec;
+            if (!engine.fit_memory(signal->size(), samplerate,
+                        job.memory_budget))
+                return QString("needs %1 MB, more than the memory budget")
+                    .arg(engine.analysis_memory(signal->size(), samplerate)
+                            >> 20);
+            if (engine.pixpersec != pixpersec)
+                std::cerr << job.input.toLocal8Bit().constData()
+                    << ": pixels per second lowered to " << engine.pixpersec
+                    << " to fit the memory budget\n";
+        }
+
+        const ResultCache results = job.result_cache.isNull() ?
+            ResultCache() :
+            ResultCache(job.result_cache, job.result_cache_size);
+        QByteArray key;
+        if (results.enabled())
+        {
+            key = ResultCache::key(engine, signal->data(), signal->size(),
+                    samplerate, job.channel);
+            const QString cached = results.lookup(key);
+            if (!cached.isNull())
+            {
+                QFile::remove(job.output);
+                if (!QFile::copy(cached, job.output))
+                    return "couldn't save " + job.output;
+                return QString();
+            }
+        }
+
+        const intensity_matrix data = engine.analyze(signal->data(),
+                signal->size(), samplerate, listener, cancel);
+        if (data.empty())
+            return job_cancelled;
+        const QImage image = render_image(engine, data);
+        if (image.isNull() || !image.save(job.output))
+            return "couldn't save " + job.output;
+        if (results.enabled())
+            results.store(key, image);
+        return QString();
+    }
+
+    /// Makes a sound file from a spectrogram image.
+    QString synthetize(const Job& job, ProgressListener* listener,
+            const CancelToken* cancel)
+    {
+        const QImage image(job.input);
+        if (image.isNull())
+            return "not readable or not supported";
+
+        SpectrogramEngine engine;
+        const QString saved = image.text("Spectrogram");
+        if (!saved.isNull())
+            engine.deserialize(saved.toStdString());
+        apply_parameters(engine, job);
+
+        const real_vec sound = engine.synthetize(
+                image_intensities(engine, image), job.samplerate, job.type,
+                listener, cancel);
+        if (sound.empty())
+            return cancelled(cancel) ? job_cancelled : "synthesis failed";
+        return Soundfile::writeSound(job.output, sound, job.samplerate);
+    }
+}
+
+Job::Job() // defaults
+    : synthesis(false)
+    , channel(0)
+    , samplerate(44100)
+    , type(SYNTHESIS_SINE)
+    , result_cache_size(1024 << 20)
+    , memory_budget(0)
+    , deadline(0)
+    , append(false)
+    , shards(0)
+    , shard(0)
+{
+}
+
+AudioCache::AudioCache(qint64 max_bytes)
+    : max_bytes_(max_bytes)
+    , bytes_(0)
+    , uses_(0)
+{
+}
+
+QString AudioCache::key(const QString& filename, int channel)
+{
+    const QFileInfo info(filename);
+    if (filename == "-" || !info.exists())
+        return QString();
+    return info.canonicalFilePath() + "|" +
+        QString::number(info.lastModified().toTime_t()) + "|" +
+        QString::number(info.size()) + "|" + QString::number(channel);
+}
+
+pcm_buffer AudioCache::lookup(const QString& filename, int channel,
+        int& samplerate)
+{
+    const QString name = key(filename, channel);
+    if (name.isNull())
+        return pcm_buffer();
+    QMutexLocker lock(&mutex_);
+    QMap<QString, Entry>::iterator it = entries_.find(name);
+    if (it == entries_.end())
+        return pcm_buffer();
+    it->last_use = ++uses_;
+    samplerate = it->samplerate;
+    return it->signal;
+}
+
+void AudioCache::store(const QString& filename, int channel, int samplerate,
+        const pcm_buffer& signal)
+{
+    const QString name = key(filename, channel);
+    const qint64 bytes = signal->size()*sizeof(float);
+    if (name.isNull() || bytes > max_bytes_)
+        return;
+    QList<pcm_buffer> evicted; // released after unlocking
+    QMutexLocker lock(&mutex_);
+    if (entries_.contains(name))
+        return;
+    while (!entries_.isEmpty() && bytes_ + bytes > max_bytes_)
+    {
+        QMap<QString, Entry>::iterator oldest = entries_.begin();
+        for (QMap<QString, Entry>::iterator it = entries_.begin();
+                it != entries_.end(); ++it)
+            if (it->last_use < oldest->last_use)
+                oldest = it;
+        bytes_ -= oldest->signal->size()*sizeof(float);
+        evicted.append(oldest->signal);
+        entries_.erase(oldest);
+    }
+    Entry entry = {signal, samplerate, ++uses_};
+    entries_.insert(name, entry);
+    bytes_ += bytes;
+}
+
+bool apply_parameter(SpectrogramEngine& engine, const QString& name,
+        const QString& value)
+{
+    bool ok = true;
+    if (name == "bandwidth")
+        engine.bandwidth = value.toDouble(&ok);
+    else if (name == "basefreq")
+        engine.basefreq = value.toDouble(&ok);
+    else if (name == "maxfreq")
+        engine.maxfreq = value.toDouble(&ok);
+    else if (name == "overlap")
+        engine.overlap = value.toDouble(&ok)/100;
+    else if (name == "pixpersec")
+        engine.pixpersec = value.toDouble(&ok);
+    else if (name == "window")
+    {
+        if (value == "hann")
+            engine.window = WINDOW_HANN;
+        else if (value == "blackman")
+            engine.window = WINDOW_BLACKMAN;
+        else if (value == "triangular")
+            engine.window = WINDOW_TRIANGULAR;
+        else if (value == "rectangular")
+            engine.window = WINDOW_RECTANGULAR;
+        else
+            ok = false;
+    }
+    else if (name == "intensity-scale" || name == "frequency-scale")
+    {
+        AxisScale& scale = name == "intensity-scale" ?
+            engine.intensity_axis : engine.frequency_axis;
+        if (value == "logarithmic")
+            scale = SCALE_LOGARITHMIC;
+        else if (value == "linear")
+            scale = SCALE_LINEAR;
+        else
+            ok = false;
+    }
+    else if (name == "brightness")
+    {
+        if (value == "none")
+            engine.correction = BRIGHT_NONE;
+        else if (value == "sqrt")
+            engine.correction = BRIGHT_SQRT;
+        else
+            ok = false;
+    }
+    else if (name == "method")
+    {
+        if (value == "filterbank")
+            engine.method = ANALYSIS_FILTERBANK;
+        else if (value == "stft")
+            engine.method = ANALYSIS_STFT;
+        else if (value == "cqt")
+            engine.method = ANALYSIS_CQT;
+        else
+            ok = false;
+    }
+    else if (name == "palette")
+        ok = load_palette(value, engine.palette);
+    else
+        ok = false;
+    return ok;
+}
+
+bool parse_shard(const QString& value, Job& job)
+{
+    const QStringList parts = value.split('/');
+    bool ok = parts.size() == 2;
+    const int shard = ok ? parts[0].toInt(&ok) : 0;
+    const int shards = ok ? parts[1].toInt(&ok) : 0;
+    if (!ok || shard < 1 || shard > shards)
+        return false;
+    job.shard = shard-1;
+    job.shards = shards;
+    return true;
+}
+
+QString shard_name(const QString& output, int shard, int shards)
+{
+    return output + QString(".%1-of-%2.shard").arg(shard+1).arg(shards);
+}
+
+QString run_job(const Job& job, ProgressListener* listener,
+        AudioCache* cache, const CancelToken* cancel)
+{
+    const CancelToken token = cancel ? *cancel : CancelToken();
+    if (job.deadline > 0)
+        token.set_deadline(job.deadline);
+    QString error;
+    if (job.synthesis)
+        error = synthetize(job, listener, &token);
+    else if (job.shards && job.shard < 0)
+        error = stitch(job, &token);
+    else
+        error = analyze(job, listener, cache, &token);
+    return error == job_cancelled && token.expired() ? job_expired : error;
+}
+
+QString run_live(const Job& job, int channels, PcmStream::Format format,
+        LiveOutput output)
+{
+    FILE* in = job.input == "-" ? stdin :
+        std::fopen(job.input.toLocal8Bit().constData(), "rb");
+    if (!in)
+        return "couldn't open " + job.input;
+    PcmStream pcm(in, job.samplerate, channels, format);
+    QString error;
+    if (!pcm.open())
+        error = "not supported: " + pcm.error();
+    else if (job.channel >= pcm.channels())
+        error = "the stream doesn't have the requested channel";
+    else
+    {
+        SpectrogramEngine engine;
+        apply_parameters(engine, job);
+        if (engine.maxfreq > pcm.samplerate()/2)
+            engine.maxfreq = pcm.samplerate()/2;
+        AnalysisStream stream(engine, pcm.samplerate());
+
+        // a column of samples at a time, so reading adds a column at most
+        // to the latency of the analysis
+        const size_t chunk = std::max(1.0,
+                std::ceil(pcm.samplerate()/engine.pixpersec));
+        std::cerr << stream.rows() << " rows, " << engine.pixpersec
+            << " columns per second, latency " << (int)std::ceil(1000*
+                    (stream.latency() + (double)chunk/pcm.samplerate()))
+            << " ms\n";
+
+        real_vec samples;
+        for (;;)
+        {
+            const size_t count = pcm.read(job.channel, chunk, samples);
+            if (count && !write_columns(engine,
+                        stream.append(&samples[0], count), output, stdout))
+            {
+                error = "couldn't write the columns";
+                break;
+            }
+            if (count < chunk)
+            {
+                if (!write_columns(engine, stream.finish(), output, stdout))
+                    error = "couldn't write the columns";
+                break;
+            }
+        }
+    }
+    if (in != stdin)
+        std::fclose(in);
+    return error;
+}
+
+bool write_profile(const QString& summary, const QString& trace)
+{
+    bool ok = true;
+    if (!summary.isEmpty())
+        ok = Profiler::write(summary.toLocal8Bit().constData(),
+                Profiler::summary()) && ok;
+    if (!trace.isEmpty())
+        ok = Profiler::write(trace.toLocal8Bit().constData(),
+                Profiler::trace()) && ok;
+    return ok;
+}
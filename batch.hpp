@@ -0,0 +1,137 @@
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+/** \file batch.hpp
+ *  \brief Jobs of the command line program and the render daemon.
+ */
+
+#include <QString>
+#include <QMap>
+#include <QMutex>
+#include "engine.hpp"
+#include "soundfile.hpp"
+
+typedef QMap<QString, QString> Parameters;
+
+/// A single file to be processed.
+struct Job
+{
+    Job(); // defaults
+
+    bool synthesis;
+    QString input;
+    QString output;
+    /// Parameters in the Spectrogram::serialized() format, may be null.
+    QString serialized;
+    /// Individual parameters, applied after the serialized ones.
+    Parameters parameters;
+    int channel;
+    int samplerate;
+    SynthesisType type;
+    QString pcm_cache;
+    /// Directory of the ResultCache, or null to use the default.
+    QString result_cache;
+    /// Size limit of the result cache in bytes.
+    qint64 result_cache_size;
+    /// Memory the analysis may use in bytes, 0 for no limit.
+    /** The time resolution is lowered if needed, see
+     * SpectrogramEngine::fit_memory(). */
+    qint64 memory_budget;
+    /// Seconds the job may run, 0 for no limit.
+    double deadline;
+    /// Extends the output spectrogram by the new part of a growing input.
+    /** The output is resumed where an earlier appending job left it, see
+     * AnalysisStream, or made from the start if it wasn't appended to with
+     * the same parameters.  The memory budget and the result cache don't
+     * apply. */
+    bool append;
+    /// Number of shards the analysis is divided into, 0 for none.
+    /** A job with a shard analyzes its columns and writes them to
+     * shard_name(), one without stitches the shards together into the
+     * output.  See ShardPlan, the memory budget and the result cache don't
+     * apply. */
+    int shards;
+    /// The shard analyzed by the job, from 0, or -1 to stitch all of them.
+    int shard;
+};
+
+/// Keeps recently decoded channels of sound files in memory.
+/** Files are identified by their path, size and modification time, so a
+ * changed file is decoded again.  The functions are thread safe. */
+class AudioCache
+{
+    public:
+        /// \param max_bytes Memory limit of the cached samples.
+        AudioCache(qint64 max_bytes);
+        /// Returns the cached channel and its samplerate, or a null buffer.
+        pcm_buffer lookup(const QString& filename, int channel,
+                int& samplerate);
+        /// Remembers a decoded channel, evicting the least recently used ones.
+        void store(const QString& filename, int channel, int samplerate,
+                const pcm_buffer& signal);
+    private:
+        struct Entry
+        {
+            pcm_buffer signal;
+            int samplerate;
+            quint64 last_use;
+        };
+        static QString key(const QString& filename, int channel);
+
+        QMutex mutex_;
+        QMap<QString, Entry> entries_;
+        qint64 max_bytes_;
+        qint64 bytes_;
+        quint64 uses_;
+};
+
+/// Parses a spectrogram parameter and sets it in the engine.
+/** Palette images are loaded once and remembered.
+ * \return false if the value isn't valid. */
+bool apply_parameter(SpectrogramEngine& engine, const QString& name,
+        const QString& value);
+
+/// Parses a shard K/N, counted from 1, and sets it in the job.
+/** \return false if the value isn't valid. */
+bool parse_shard(const QString& value, Job& job);
+/// Returns the file a shard of the output spectrogram is written to.
+QString shard_name(const QString& output, int shard, int shards);
+
+/// Runs a job in the calling thread.
+/** \param listener Receives progress, may be null.
+ * \param cache Decoded sound files are taken from and put into it, may be
+ * null.
+ * \param cancel Interrupts the job, may be null.  The job's deadline counts
+ * from the start of the call and is set on this token.
+ * \return An error message, or a null string on success. */
+QString run_job(const Job& job, ProgressListener* listener = 0,
+        AudioCache* cache = 0, const CancelToken* cancel = 0);
+
+/// Formats of the columns written by run_live().
+enum LiveOutput
+{
+    /// 32-bit floats from 0 to 1 in the machine byte order, unrendered.
+    LIVE_FLOAT,
+    /// Red, green and blue bytes of the image pixels.
+    LIVE_RGB
+};
+
+/// Analyzes a PCM stream while it arrives and writes out its columns.
+/** The job's input is - for the standard input or a FIFO, its samplerate and
+ * channels those of raw PCM, see PcmStream.  The analysis is the STFT of
+ * AnalysisStream.  Each column is written to the standard output as soon as
+ * its frame is complete, as the column of the image from the top row.
+ * \return An error message, or a null string at the end of the stream. */
+QString run_live(const Job& job, int channels, PcmStream::Format format,
+        LiveOutput output);
+
+/// Writes the Profiler summary and trace, if the file names aren't empty.
+/** \return false if a file couldn't be written. */
+bool write_profile(const QString& summary, const QString& trace);
+
+/// The error returned by run_job() when the job was cancelled.
+extern const char* const job_cancelled;
+/// The error returned by run_job() when the job ran out of time.
+extern const char* const job_expired;
+
+#endif
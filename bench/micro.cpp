@@ -0,0 +1,609 @@
+/** \file micro.cpp
+ * \brief Micro-benchmarks of the DSP kernels (\c spectrogram-bench).
+ *
+ * Each kernel runs on deterministic synthetic data until a minimum time has
+ * passed.  The results are printed as JSON, one object per benchmark with
+ * the time per operation and the throughput, so that they can be compared
+ * between builds.
+ *
+ * The kernels of simd.hpp are timed at every level the CPU supports, the
+ * transforms with every FFT backend of the build, on the same lengths.
+ * \c --check compares their results with the scalar reference and the
+ * default backend instead.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <memory>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "engine.hpp"
+#include "dsp.hpp"
+#include "fft.hpp"
+#include "fftbackend.hpp"
+#include "scratch.hpp"
+#include "simd.hpp"
+
+namespace
+{
+    const char* usage =
+        "Usage: spectrogram-bench [options]\n"
+        "\n"
+        "Times the DSP kernels and prints the results as JSON.\n"
+        "\n"
+        "Options:\n"
+        "  -f, --filter TEXT        only run benchmarks containing TEXT\n"
+        "  -t, --min-time SECONDS   minimum time per benchmark (default: 0.2)\n"
+        "  -o, --output FILE        write the JSON to FILE instead of stdout\n"
+        "      --check              check that the SIMD kernels of all levels\n"
+        "                           give the results of the scalar ones, and\n"
+        "                           that the FFT backends agree\n"
+        "  -h, --help               show this help\n";
+
+    typedef std::chrono::steady_clock bench_clock;
+
+    /// Result of a single benchmark.
+    struct Result
+    {
+        std::string name;
+        /// Number of items (samples, bins, pixels...) processed per operation.
+        size_t items;
+        long iterations;
+        double ns_per_op;
+        double items_per_second;
+    };
+
+    std::string filter;
+    double min_time = 0.2;
+    std::vector<Result> results;
+    /// Keeps the compiler from optimizing the benchmarked code away.
+    volatile float sink;
+
+    /// Deterministic test signal: a few sines and some pseudorandom noise.
+    real_vec test_signal(size_t size, int samplerate = 44100)
+    {
+        real_vec signal(size);
+        unsigned int seed = 12345;
+        for (size_t i = 0; i < size; ++i)
+        {
+            seed = seed*1103515245 + 12345; // the same on every platform
+            const double t = (double)i/samplerate;
+            signal[i] = 0.4*std::sin(2*PI*440*t) + 0.2*std::sin(2*PI*3520*t)
+                + 0.1*(((seed >> 16) & 0x7fff)/16384.0 - 1);
+        }
+        return signal;
+    }
+
+    /// Times f, which processes the given number of items per call.
+    template <class Function>
+    void run(const std::string& name, size_t items, Function f)
+    {
+        if (!filter.empty() && name.find(filter) == std::string::npos)
+            return;
+        f(); // warm up (FFT plans, caches)
+        long iterations = 0;
+        const bench_clock::time_point start = bench_clock::now();
+        double elapsed = 0;
+        do
+        {
+            f();
+            ++iterations;
+            elapsed = std::chrono::duration<double>(
+                    bench_clock::now() - start).count();
+        } while (elapsed < min_time);
+
+        Result result = {name, items, iterations, elapsed*1e9/iterations,
+            items*iterations/elapsed};
+        results.push_back(result);
+        std::cerr << name << ": " << (long)result.ns_per_op << " ns/op\n";
+    }
+
+    std::string size_name(const std::string& name, size_t size)
+    {
+        std::ostringstream out;
+        out << name << "/" << size;
+        return out.str();
+    }
+
+    void bench_fft()
+    {
+        const size_t sizes[] = {1000, 4096, 44100, 65536, 100003, 1 << 20,
+            44100*60};
+        for (size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); ++i)
+        {
+            const real_vec signal = test_signal(sizes[i]);
+            run(size_name("padded_FFT", sizes[i]), sizes[i], [&]() {
+                sink = padded_FFT(signal)[1].real();
+            });
+            const complex_vec spectrum = padded_FFT(signal);
+            run(size_name("padded_IFFT", sizes[i]), sizes[i], [&]() {
+                complex_vec in(spectrum);
+                sink = padded_IFFT(in)[0];
+            });
+        }
+    }
+
+    /// Aligned arrays for one plan, filled with the test signal.
+    struct FFTData
+    {
+        FFTData(const FFTPlan& plan)
+        {
+            const size_t n = plan.size()*plan.howmany();
+            const size_t half = (plan.size()/2+1)*plan.howmany();
+            real = static_cast<float*>(fft_malloc(n*sizeof(float)));
+            complex = static_cast<Complex*>(fft_malloc(n*sizeof(Complex)));
+            spectrum = static_cast<Complex*>(fft_malloc(n*sizeof(Complex)));
+            const real_vec signal = test_signal(2*n);
+            std::copy(signal.begin(), signal.begin()+n, real);
+            for (size_t i = 0; i < n; ++i)
+                complex[i] = Complex(signal[i], signal[n+i]);
+            // the c2r input of a real signal
+            for (size_t i = 0; i < half; ++i)
+                spectrum[i] = complex[i];
+            for (size_t b = 0; b < plan.howmany(); ++b)
+            {
+                Complex* s = spectrum + b*(plan.size()/2+1);
+                s[0] = s[0].real();
+                if (plan.size()%2 == 0)
+                    s[plan.size()/2] = s[plan.size()/2].real();
+            }
+        }
+        ~FFTData()
+        {
+            fft_free(spectrum);
+            fft_free(complex);
+            fft_free(real);
+        }
+        /// Runs the plan, c2r transforms on a copy of the spectrum.
+        float execute(const FFTPlan& plan, Complex* out, float* real_out)
+        {
+            switch (plan.kind())
+            {
+                case FFT_R2C:
+                    plan.r2c(real, out);
+                    return out[1].real();
+                case FFT_C2R:
+                    std::copy(spectrum, spectrum +
+                            (plan.size()/2+1)*plan.howmany(), out);
+                    plan.c2r(out, real_out);
+                    return real_out[0];
+                default:
+                    plan.c2c(complex, out);
+                    return out[1].real();
+            }
+        }
+        float* real;
+        Complex* complex;
+        Complex* spectrum;
+    };
+
+    const char* const fft_kinds[] = {"r2c", "c2r", "forward", "inverse"};
+
+    /// Times every backend on the same transforms.
+    /** Single transforms of the lengths padded_FFT() uses, and the batches
+     * of short frames a short-time transform needs. */
+    void bench_fft_backends()
+    {
+        const size_t sizes[] = {1024, 2048, 44100, 65536, 1 << 20};
+        const size_t batch = 64;
+        const std::vector<std::string> names = fft_backends();
+        for (size_t b = 0; b < names.size(); ++b)
+        {
+            FFTBackend& backend = *find_fft_backend(names[b]);
+            for (size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); ++i)
+                for (int kind = 0; kind < 4; ++kind)
+                    for (size_t howmany = 1; howmany <= batch;
+                            howmany *= batch)
+                    {
+                        if (howmany > 1 && sizes[i] > 2048)
+                            continue;
+                        const size_t n = padded_length(sizes[i]);
+                        const std::string name = "fft/" + names[b] + "/" +
+                            fft_kinds[kind] + (howmany > 1 ? "_batch" : "");
+                        if (!filter.empty() &&
+                                size_name(name, n).find(filter) ==
+                                std::string::npos)
+                            continue;
+                        const std::unique_ptr<FFTPlan> plan(backend.plan(
+                                    (FFTKind)kind, n, howmany,
+                                    FFTBackend::ALIGNED));
+                        FFTData data(*plan);
+                        Complex* out = static_cast<Complex*>(
+                                fft_malloc(n*howmany*sizeof(Complex)));
+                        float* real_out = static_cast<float*>(
+                                fft_malloc(n*howmany*sizeof(float)));
+                        run(size_name(name, n), n*howmany, [&]() {
+                            sink = data.execute(*plan, out, real_out);
+                        });
+                        fft_free(real_out);
+                        fft_free(out);
+                    }
+        }
+    }
+
+    void bench_envelope()
+    {
+        const size_t sizes[] = {64, 512, 4096, 32768};
+        const complex_vec spectrum = padded_FFT(test_signal(1 << 16));
+        for (size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); ++i)
+        {
+            const complex_vec band(spectrum.begin()+1000,
+                    spectrum.begin()+1000+sizes[i]);
+            run(size_name("get_envelope", sizes[i]), sizes[i], [&]() {
+                complex_vec in(band);
+                sink = get_envelope(in)[0];
+            });
+            // the way the engine calls it, without allocations
+            const size_t padded = padded_length((sizes[i]-1)*2);
+            ScratchArena::Frame frame;
+            Complex* in = frame.take<Complex>(padded/2+1);
+            float* out = frame.take<float>(padded);
+            run(size_name("get_envelope/scratch", sizes[i]), sizes[i], [&]() {
+                std::copy(band.begin(), band.end(), in);
+                get_envelope(in, sizes[i], out);
+                sink = out[0];
+            });
+        }
+    }
+
+    void bench_resample()
+    {
+        const size_t sizes[][2] = {{1000, 30000}, {30000, 30000},
+            {100000, 30000}, {4096, 441000}};
+        for (size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); ++i)
+        {
+            const real_vec signal = test_signal(sizes[i][0]);
+            std::ostringstream name;
+            name << "resample/" << sizes[i][0] << "->" << sizes[i][1];
+            run(name.str(), sizes[i][1], [&]() {
+                sink = resample(signal, sizes[i][1])[0];
+            });
+        }
+    }
+
+    void bench_window()
+    {
+        const char* names[] = {"hann", "blackman", "rectangular",
+            "triangular"};
+        const Window windows[] = {WINDOW_HANN, WINDOW_BLACKMAN,
+            WINDOW_RECTANGULAR, WINDOW_TRIANGULAR};
+        const complex_vec spectrum = padded_FFT(test_signal(1 << 16));
+        // a logarithmic band of the default spectrogram of a 3 minute track
+        const double filterscale = 360.0;
+        const int lowidx = 200000, highidx = 204096;
+        const complex_vec band(spectrum.begin(), spectrum.begin()+4096);
+        for (size_t i = 0; i < sizeof(windows)/sizeof(windows[0]); ++i)
+        {
+            run(std::string("window_coefs/") + names[i], highidx-lowidx,
+                    [&]() {
+                sink = window_coefs(lowidx, highidx, filterscale,
+                        windows[i], SCALE_LOGARITHMIC)[1];
+            });
+            const real_vec coefs = window_coefs(lowidx, highidx, filterscale,
+                    windows[i], SCALE_LOGARITHMIC);
+            complex_vec in(band);
+            run(std::string("apply_window/") + names[i], highidx-lowidx,
+                    [&]() {
+                in.assign(band.begin(), band.end()); // no denormals
+                apply_window(in, coefs);
+                sink = in[1].real();
+            });
+        }
+    }
+
+    /// A palette with more colors than an indexed image can hold.
+    Palette rgb_palette()
+    {
+        std::vector<rgb_t> colors;
+        for (unsigned int i = 0; i < 1000; ++i)
+            colors.push_back(0xff000000u | (i*4099 & 0xffffff));
+        return Palette(colors);
+    }
+
+    void bench_image()
+    {
+        const int width = 2000, height = 500;
+        intensity_matrix data(height);
+        const real_vec signal = test_signal((size_t)width*height);
+        for (int y = 0; y < height; ++y)
+        {
+            data[y].resize(width);
+            for (int x = 0; x < width; ++x)
+                data[y][x] = std::abs(signal[(size_t)y*width+x]);
+        }
+
+        SpectrogramEngine engine;
+        run("render/indexed", (size_t)width*height, [&]() {
+            sink = engine.render(data).pixels[0];
+        });
+        engine.correction = BRIGHT_SQRT;
+        engine.palette = rgb_palette();
+        run("render/rgb", (size_t)width*height, [&]() {
+            sink = engine.render(data).pixels[0];
+        });
+
+        const Palette palettes[] = {Palette(), rgb_palette()};
+        const char* names[] = {"get_intensity/256", "get_intensity/1000"};
+        for (int i = 0; i < 2; ++i)
+        {
+            const Palette& palette = palettes[i];
+            std::vector<rgb_t> pixels(10000);
+            for (size_t j = 0; j < pixels.size(); ++j)
+                pixels[j] = palette.colors()[j*7 % palette.numColors()];
+            run(names[i], pixels.size(), [&]() {
+                float sum = 0;
+                for (size_t j = 0; j < pixels.size(); ++j)
+                    sum += palette.get_intensity(pixels[j]);
+                sink = sum;
+            });
+        }
+    }
+
+    void bench_synthesis()
+    {
+        const real_vec envelope = test_signal(30000);
+        run("sine_carrier/30000", 60000, [&]() {
+            sink = sine_carrier(envelope, 0.5)[1];
+        });
+
+        const real_vec noise = test_signal(441000);
+        const real_vec long_envelope = test_signal(44100*30);
+        real_vec out(long_envelope.size());
+        run("modulate_noise/1323000", out.size(), [&]() {
+            modulate_noise(long_envelope, noise, out);
+            sink = out[0];
+        });
+    }
+
+    /// Arguments and buffers for running any of the SIMD kernels.
+    struct SimdData
+    {
+        explicit SimdData(size_t size)
+            : a(test_signal(2*size))
+            , b(test_signal(2*size, 8000))
+            , out(2*size)
+            , n(size)
+        {
+            sines[0] = 0.6f;
+            sines[1] = -0.8f;
+            sines[2] = -0.6f;
+            sines[3] = 0.8f;
+        }
+        real_vec a;
+        real_vec b;
+        real_vec out;
+        float sines[4];
+        size_t n;
+    };
+
+    const char* simd_kernels[] = {"magnitude", "scale_complex", "max",
+        "max_abs", "abs_divide", "divide", "multiply_add", "carrier", "dot"};
+    const int simd_kernel_count = 9;
+
+    /// Runs a kernel on the data, out is overwritten.
+    /** \return The scalar result, or the first output value. */
+    float run_kernel(const simd::Kernels& k, int kernel, SimdData& d)
+    {
+        const size_t n = d.n;
+        switch (kernel)
+        {
+            case 0:
+                k.magnitude(&d.a[0], &d.b[0], &d.out[0], n);
+                break;
+            case 1:
+                std::copy(d.a.begin(), d.a.end(), d.out.begin());
+                k.scale_complex(&d.out[0], &d.b[0], n);
+                break;
+            case 2:
+                return k.max(&d.a[0], n);
+            case 3:
+                return k.max_abs(&d.a[0], n);
+            case 4:
+                std::copy(d.a.begin(), d.a.begin()+n, d.out.begin());
+                k.abs_divide(&d.out[0], n, 0.37f);
+                break;
+            case 5:
+                std::copy(d.a.begin(), d.a.begin()+n, d.out.begin());
+                k.divide(&d.out[0], n, 0.37f);
+                break;
+            case 6:
+                std::copy(d.b.begin(), d.b.begin()+n, d.out.begin());
+                k.multiply_add(&d.out[0], &d.a[0], &d.b[0], n);
+                break;
+            case 7:
+                k.carrier(&d.a[0], n, d.sines, &d.out[0]);
+                break;
+            case 8:
+                return k.dot(&d.a[0], &d.b[0], n);
+        }
+        return d.out[0];
+    }
+
+    void bench_simd()
+    {
+        const size_t size = 4096;
+        SimdData data(size);
+        for (int level = 0; level < simd::level_count; ++level)
+        {
+            if (!simd::supported((simd::Level)level))
+                continue;
+            const simd::Kernels& k = simd::kernels((simd::Level)level);
+            for (int i = 0; i < simd_kernel_count; ++i)
+                run(std::string("simd/") + simd_kernels[i] + "/" +
+                        simd::level_name((simd::Level)level), size, [&]() {
+                    sink = run_kernel(k, i, data);
+                });
+        }
+    }
+
+    /// Compares the kernels of all supported levels with the scalar ones.
+    /** Lengths around the vector widths exercise the remainder loops.
+     * \return The number of mismatches. */
+    int check_simd()
+    {
+        const size_t sizes[] = {1, 3, 4, 7, 8, 15, 16, 17, 31, 32, 33, 100,
+            1000, 4099};
+        const simd::Kernels& reference = simd::kernels(simd::LEVEL_SCALAR);
+        int failures = 0;
+        for (int level = 1; level < simd::level_count; ++level)
+        {
+            const simd::Level l = (simd::Level)level;
+            if (!simd::supported(l))
+            {
+                std::cerr << simd::level_name(l) << ": not supported\n";
+                continue;
+            }
+            int mismatches = 0;
+            for (size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); ++s)
+                for (int i = 0; i < simd_kernel_count; ++i)
+                {
+                    SimdData expected(sizes[s]), got(sizes[s]);
+                    const float x = run_kernel(reference, i, expected);
+                    const float y = run_kernel(simd::kernels(l), i, got);
+                    // dot() adds in a different order
+                    const bool same = i == 8 ?
+                        std::abs(x-y) <= 1e-5f*sizes[s] :
+                        x == y && expected.out == got.out;
+                    if (!same)
+                    {
+                        std::cerr << simd::level_name(l) << ": "
+                            << simd_kernels[i] << "/" << sizes[s]
+                            << " differs\n";
+                        ++mismatches;
+                    }
+                }
+            std::cerr << simd::level_name(l) << ": " << mismatches
+                << " mismatches\n";
+            failures += mismatches;
+        }
+        return failures;
+    }
+
+    /// Compares the transforms of all backends with the default one.
+    /** \return The number of mismatches. */
+    int check_fft()
+    {
+        const size_t sizes[] = {1, 2, 3, 5, 8, 12, 49, 121, 1000, 1331,
+            4096, 44100};
+        const std::vector<std::string> names = fft_backends();
+        FFTBackend& reference = *find_fft_backend(names[0]);
+        int failures = 0;
+        for (size_t b = 1; b < names.size(); ++b)
+        {
+            FFTBackend& backend = *find_fft_backend(names[b]);
+            int mismatches = 0;
+            for (size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); ++s)
+                for (int kind = 0; kind < 4; ++kind)
+                {
+                    const size_t n = sizes[s];
+                    const size_t howmany = 3;
+                    const std::unique_ptr<FFTPlan> expected(reference.plan(
+                                (FFTKind)kind, n, howmany, 0));
+                    const std::unique_ptr<FFTPlan> got(backend.plan(
+                                (FFTKind)kind, n, howmany, 0));
+                    FFTData data(*expected);
+                    complex_vec x(n*howmany), y(n*howmany);
+                    real_vec xr(n*howmany), yr(n*howmany);
+                    data.execute(*expected, &x[0], &xr[0]);
+                    data.execute(*got, &y[0], &yr[0]);
+                    // rounding grows with log n, relative to the largest value
+                    double error = 0, largest = 0;
+                    for (size_t i = 0; i < x.size(); ++i)
+                    {
+                        error = std::max(error, (double)(kind == FFT_C2R ?
+                                std::abs(xr[i]-yr[i]) : std::abs(x[i]-y[i])));
+                        largest = std::max(largest, (double)(kind == FFT_C2R ?
+                                std::abs(xr[i]) : std::abs(x[i])));
+                    }
+                    if (error > 1e-5*std::max(largest, 1.0))
+                    {
+                        std::cerr << names[b] << ": " << fft_kinds[kind]
+                            << "/" << n << " differs by " << error << "\n";
+                        ++mismatches;
+                    }
+                }
+            std::cerr << names[b] << ": " << mismatches
+                << " mismatches with " << names[0] << "\n";
+            failures += mismatches;
+        }
+        return failures;
+    }
+
+    void write_json(std::ostream& out)
+    {
+        out << "{\n  \"benchmarks\": [\n";
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const Result& r = results[i];
+            out << "    {\"name\": \"" << r.name << "\", "
+                << "\"items\": " << r.items << ", "
+                << "\"iterations\": " << r.iterations << ", "
+                << "\"ns_per_op\": " << r.ns_per_op << ", "
+                << "\"items_per_second\": " << r.items_per_second << "}"
+                << (i+1 < results.size() ? ",\n" : "\n");
+        }
+        out << "  ]\n}\n";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::string output;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help")
+        {
+            std::cout << usage;
+            return 0;
+        }
+        else if (arg == "--check")
+            return check_simd() + check_fft() ? 1 : 0;
+        else if (i+1 == argc)
+        {
+            std::cerr << usage;
+            return 2;
+        }
+        else if (arg == "-f" || arg == "--filter")
+            filter = argv[++i];
+        else if (arg == "-t" || arg == "--min-time")
+            min_time = std::atof(argv[++i]);
+        else if (arg == "-o" || arg == "--output")
+            output = argv[++i];
+        else
+        {
+            std::cerr << usage;
+            return 2;
+        }
+    }
+
+    bench_fft();
+    bench_fft_backends();
+    bench_envelope();
+    bench_resample();
+    bench_window();
+    bench_image();
+    bench_synthesis();
+    bench_simd();
+
+    if (output.empty())
+        write_json(std::cout);
+    else
+    {
+        std::ofstream file(output.c_str());
+        write_json(file);
+        if (!file)
+        {
+            std::cerr << "Can't write " << output << "\n";
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,402 @@
+/** \file scaling.cpp
+ * \brief End-to-end scaling benchmark (\c spectrogram-scaling).
+ *
+ * Analyzes and synthesizes synthetic tracks of various lengths with several
+ * parameter sets and numbers of concurrent jobs.  Every case runs in its own
+ * process, so that its peak memory can be measured.  The results are printed
+ * as CSV; with --compare they are checked against the CSV of an earlier
+ * run and slowdowns over a threshold make the program fail.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "engine.hpp"
+#include "instrument.hpp"
+
+namespace
+{
+    const char* usage =
+        "Usage: spectrogram-scaling [options]\n"
+        "\n"
+        "Runs end-to-end analysis and synthesis of synthetic tracks and\n"
+        "prints the wall time, peak memory and time per stage as CSV.\n"
+        "\n"
+        "Options:\n"
+        "  -l, --lengths LIST       track lengths in seconds\n"
+        "                           (default: 10,60,600; the full set is\n"
+        "                           10,60,600,7200)\n"
+        "  -s, --signals LIST       chirp, noise, tones (default: all)\n"
+        "  -p, --params LIST        parameter sets, see below (default: all)\n"
+        "  -m, --modes LIST         analyze, analyze-stft, analyze-cqt, sine,\n"
+        "                           noise (default: analyze,sine,noise)\n"
+        "  -t, --threads LIST       concurrent jobs (default: 1,4)\n"
+        "  -c, --compare FILE       compare with the CSV of an earlier run\n"
+        "      --threshold PERCENT  slowdown reported by --compare\n"
+        "                           (default: 10)\n"
+        "  -h, --help               show this help\n"
+        "\n"
+        "Parameter sets (axis, bandwidth, overlap, pixels per second):\n"
+        "  log          logarithmic, 100 cents, 80 %, 100\n"
+        "  log-fine     logarithmic, 50 cents, 90 %, 200\n"
+        "  linear       linear, 100 Hz, 80 %, 100\n"
+        "  linear-wide  linear, 400 Hz, 50 %, 50\n";
+
+    const int samplerate = 44100;
+
+    /// A named set of spectrogram parameters.
+    struct ParamSet
+    {
+        const char* name;
+        AxisScale axis;
+        double bandwidth;
+        double overlap;
+        double pixpersec;
+    };
+
+    const ParamSet param_sets[] = {
+        {"log", SCALE_LOGARITHMIC, 100, 0.8, 100},
+        {"log-fine", SCALE_LOGARITHMIC, 50, 0.9, 200},
+        {"linear", SCALE_LINEAR, 100, 0.8, 100},
+        {"linear-wide", SCALE_LINEAR, 400, 0.5, 50},
+    };
+
+    /// A single measurement.
+    struct Case
+    {
+        std::string signal;
+        int seconds;
+        ParamSet params;
+        std::string mode;
+        int threads;
+    };
+
+    typedef std::chrono::steady_clock bench_clock;
+
+    double since(const bench_clock::time_point& start)
+    {
+        return std::chrono::duration<double>(bench_clock::now()-start).count();
+    }
+
+    /// The Profiler timers written to the CSV, in seconds.
+    /** They are totals over the concurrent jobs.  Timers nest, so
+     * band.envelope and synthesis.* include the ifft they make. */
+    const char* stages[] = {"decimate", "fft", "band.extract", "band.window",
+        "band.envelope", "band.resample", "stft.frames", "stft.fft",
+        "stft.rows", "cqt.decimate", "cqt.frames", "cqt.fft", "cqt.kernels",
+        "cqt.interpolate", "normalize", "ifft", "synthesis.sine",
+        "synthesis.noise"};
+
+    /// Returns the total time of a timer in a Profiler::summary(), in seconds.
+    double timer_total(const std::string& summary, const std::string& name)
+    {
+        const std::string entry = "\"" + name + "\": {\"calls\": ";
+        const size_t found = summary.find(entry);
+        if (found == std::string::npos)
+            return 0;
+        const std::string total = "\"total_ms\": ";
+        const size_t at = summary.find(total, found);
+        if (at == std::string::npos)
+            return 0;
+        return std::atof(summary.c_str() + at + total.size())/1000;
+    }
+
+    /// Generates a deterministic test track.
+    real_vec make_signal(const std::string& type, int seconds)
+    {
+        real_vec signal((size_t)seconds*samplerate);
+        if (type == "chirp")
+        {
+            // exponential sweeps from 20 Hz to 20 kHz, 10 seconds each
+            const double period = 10, ratio = std::log(1000.0);
+            for (size_t i = 0; i < signal.size(); ++i)
+            {
+                const double t = std::fmod((double)i/samplerate, period);
+                const double phase = 2*PI*20*period/ratio*
+                    (std::exp(t/period*ratio)-1);
+                signal[i] = 0.5*std::sin(phase);
+            }
+        }
+        else if (type == "noise")
+        {
+            unsigned int seed = 12345;
+            for (size_t i = 0; i < signal.size(); ++i)
+            {
+                seed = seed*1103515245 + 12345;
+                signal[i] = ((seed >> 16) & 0x7fff)/16384.0 - 1;
+            }
+        }
+        else // tones
+        {
+            const double freqs[] = {110, 440, 1760, 7040};
+            for (size_t i = 0; i < signal.size(); ++i)
+            {
+                const double t = (double)i/samplerate;
+                double sum = 0;
+                for (int j = 0; j < 4; ++j)
+                    sum += std::sin(2*PI*freqs[j]*t) *
+                        (0.5+0.5*std::sin(2*PI*(j+1)*0.25*t));
+                signal[i] = 0.2*sum;
+            }
+        }
+        return signal;
+    }
+
+    /// Runs the case in the current process.
+    /** \return The CSV fields with the time measurements. */
+    std::string run_case(const Case& c)
+    {
+        const real_vec signal = make_signal(c.signal, c.seconds);
+        SpectrogramEngine engine;
+        engine.frequency_axis = c.params.axis;
+        engine.bandwidth = c.params.bandwidth;
+        engine.overlap = c.params.overlap;
+        engine.pixpersec = c.params.pixpersec;
+        const bool analysis = c.mode.compare(0, 7, "analyze") == 0;
+        if (c.mode == "analyze-stft")
+            engine.method = ANALYSIS_STFT;
+        else if (c.mode == "analyze-cqt")
+            engine.method = ANALYSIS_CQT;
+
+        intensity_matrix data;
+        if (!analysis) // input of the synthesis, not measured
+            data = engine.analyze(&signal[0], signal.size(), samplerate);
+        const SynthesisType type = c.mode == "noise" ? SYNTHESIS_NOISE :
+            SYNTHESIS_SINE;
+
+        Profiler::enable();
+        const bench_clock::time_point start = bench_clock::now();
+        std::vector<std::thread> threads;
+        for (int i = 0; i < c.threads; ++i)
+            threads.push_back(std::thread([&]() {
+                if (analysis)
+                    engine.analyze(&signal[0], signal.size(), samplerate);
+                else
+                    engine.synthetize(data, samplerate, type);
+            }));
+        for (size_t i = 0; i < threads.size(); ++i)
+            threads[i].join();
+        const double wall = since(start);
+
+        const std::string summary = Profiler::summary();
+        std::ostringstream out;
+        out << wall;
+        for (size_t i = 0; i < sizeof(stages)/sizeof(stages[0]); ++i)
+            out << "," << timer_total(summary, stages[i]);
+        return out.str();
+    }
+
+    /// Runs the case in a child process and measures its peak memory.
+    /** \return The CSV fields with the measurements, empty on failure. */
+    std::string measure(const Case& c)
+    {
+        int fds[2];
+        if (pipe(fds) != 0)
+            return std::string();
+        const pid_t pid = fork();
+        if (pid < 0)
+            return std::string();
+        if (pid == 0)
+        {
+            close(fds[0]);
+            const std::string result = run_case(c) + "\n";
+            const ssize_t written = write(fds[1], result.data(), result.size());
+            _exit(written == (ssize_t)result.size() ? 0 : 1);
+        }
+        close(fds[1]);
+        std::string result;
+        char buffer[256];
+        ssize_t n;
+        while ((n = read(fds[0], buffer, sizeof(buffer))) > 0)
+            result.append(buffer, n);
+        close(fds[0]);
+
+        int status;
+        struct rusage usage;
+        if (wait4(pid, &status, 0, &usage) != pid || !WIFEXITED(status) ||
+                WEXITSTATUS(status) != 0 || result.empty())
+            return std::string();
+#ifdef __APPLE__
+        const double peak_mb = usage.ru_maxrss/1048576.0; // bytes
+#else
+        const double peak_mb = usage.ru_maxrss/1024.0; // kilobytes
+#endif
+        std::ostringstream out;
+        out << result.substr(0, result.size()-1) << "," << peak_mb;
+        return out.str();
+    }
+
+    /// The fields identifying a case, the beginning of its CSV line.
+    std::string case_key(const Case& c)
+    {
+        std::ostringstream out;
+        out << c.signal << "," << c.seconds << "," << c.params.name << ","
+            << c.mode << "," << c.threads;
+        return out.str();
+    }
+
+    /// The names of the columns, the timers with '_' for '.'.
+    std::string csv_header()
+    {
+        std::string header = "signal,seconds,params,mode,threads,wall_s";
+        for (size_t i = 0; i < sizeof(stages)/sizeof(stages[0]); ++i)
+        {
+            std::string name = stages[i];
+            std::replace(name.begin(), name.end(), '.', '_');
+            header += "," + name + "_s";
+        }
+        return header + ",peak_rss_mb";
+    }
+
+    std::vector<std::string> split(const std::string& text)
+    {
+        std::vector<std::string> items;
+        std::istringstream in(text);
+        std::string item;
+        while (std::getline(in, item, ','))
+            items.push_back(item);
+        return items;
+    }
+
+    /// Reads the wall times of a previous run, by case key.
+    bool read_baseline(const std::string& filename,
+            std::map<std::string, double>& times)
+    {
+        std::ifstream in(filename.c_str());
+        if (!in)
+            return false;
+        std::string line;
+        while (std::getline(in, line))
+        {
+            const std::vector<std::string> fields = split(line);
+            if (line.empty() || line[0] == '#' || fields.size() < 6 ||
+                    fields[0] == "signal")
+                continue;
+            const std::string key = fields[0] + "," + fields[1] + "," +
+                fields[2] + "," + fields[3] + "," + fields[4];
+            times[key] = std::atof(fields[5].c_str());
+        }
+        return true;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> lengths = split("10,60,600");
+    std::vector<std::string> signals = split("chirp,noise,tones");
+    std::vector<std::string> params;
+    for (size_t i = 0; i < sizeof(param_sets)/sizeof(param_sets[0]); ++i)
+        params.push_back(param_sets[i].name);
+    std::vector<std::string> modes = split("analyze,sine,noise");
+    std::vector<std::string> threads = split("1,4");
+    std::string compare;
+    double threshold = 10;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help")
+        {
+            std::cout << usage;
+            return 0;
+        }
+        if (i+1 == argc)
+        {
+            std::cerr << usage;
+            return 2;
+        }
+        const std::string value = argv[++i];
+        if (arg == "-l" || arg == "--lengths")
+            lengths = split(value);
+        else if (arg == "-s" || arg == "--signals")
+            signals = split(value);
+        else if (arg == "-p" || arg == "--params")
+            params = split(value);
+        else if (arg == "-m" || arg == "--modes")
+            modes = split(value);
+        else if (arg == "-t" || arg == "--threads")
+            threads = split(value);
+        else if (arg == "-c" || arg == "--compare")
+            compare = value;
+        else if (arg == "--threshold")
+            threshold = std::atof(value.c_str());
+        else
+        {
+            std::cerr << usage;
+            return 2;
+        }
+    }
+
+    std::map<std::string, double> baseline;
+    if (!compare.empty() && !read_baseline(compare, baseline))
+    {
+        std::cerr << "Can't read " << compare << "\n";
+        return 2;
+    }
+
+    std::cout << csv_header() << "\n";
+    int slower = 0, failed = 0;
+    for (size_t p = 0; p < params.size(); ++p)
+    {
+        const ParamSet* set = 0;
+        for (size_t i = 0; i < sizeof(param_sets)/sizeof(param_sets[0]); ++i)
+            if (params[p] == param_sets[i].name)
+                set = &param_sets[i];
+        if (!set)
+        {
+            std::cerr << "Unknown parameter set " << params[p] << "\n";
+            return 2;
+        }
+        for (size_t s = 0; s < signals.size(); ++s)
+            for (size_t l = 0; l < lengths.size(); ++l)
+                for (size_t m = 0; m < modes.size(); ++m)
+                    for (size_t t = 0; t < threads.size(); ++t)
+                    {
+                        Case c = {signals[s], std::atoi(lengths[l].c_str()),
+                            *set, modes[m], std::atoi(threads[t].c_str())};
+                        if (c.seconds <= 0 || c.threads <= 0)
+                            continue;
+                        const std::string key = case_key(c);
+                        const std::string result = measure(c);
+                        if (result.empty())
+                        {
+                            std::cerr << key << ": failed\n";
+                            ++failed;
+                            continue;
+                        }
+                        std::cout << key << "," << result << std::endl;
+
+                        std::map<std::string, double>::const_iterator old =
+                            baseline.find(key);
+                        if (compare.empty())
+                            continue;
+                        if (old == baseline.end())
+                        {
+                            std::cerr << key << ": not in the baseline\n";
+                            continue;
+                        }
+                        const double wall = std::atof(result.c_str());
+                        const double change = (wall/old->second-1)*100;
+                        if (change > threshold)
+                        {
+                            std::cerr << key << ": " << change
+                                << " % slower than the baseline\n";
+                            ++slower;
+                        }
+                    }
+    }
+    return failed || slower ? 1 : 0;
+}
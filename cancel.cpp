@@ -0,0 +1,49 @@
+#include "cancel.hpp"
+
+#include <chrono>
+
+namespace
+{
+    long long now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+CancelToken::CancelToken()
+    : state_(std::make_shared<State>())
+{
+    state_->cancelled = false;
+    state_->expired = false;
+    state_->deadline = 0;
+}
+
+void CancelToken::cancel() const
+{
+    state_->cancelled.store(true, std::memory_order_relaxed);
+}
+
+void CancelToken::set_deadline(double seconds) const
+{
+    state_->deadline.store(seconds > 0 ? now() + (long long)(seconds*1e9) : 0,
+            std::memory_order_relaxed);
+}
+
+bool CancelToken::cancelled() const
+{
+    if (state_->cancelled.load(std::memory_order_relaxed))
+        return true;
+    const long long deadline =
+        state_->deadline.load(std::memory_order_relaxed);
+    if (!deadline || now() < deadline)
+        return false;
+    state_->expired.store(true, std::memory_order_relaxed);
+    state_->cancelled.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+bool CancelToken::expired() const
+{
+    return state_->expired.load(std::memory_order_relaxed);
+}
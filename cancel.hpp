@@ -0,0 +1,57 @@
+#ifndef CANCEL_HPP
+#define CANCEL_HPP
+
+/** \file cancel.hpp
+ *  \brief Interruption of running computations.
+ *
+ *  A CancelToken is created for every job and handed to all of its stages,
+ *  which poll it between their steps and every few thousand iterations of
+ *  their long loops.  Any thread can cancel the token, and it also cancels
+ *  itself when its wall-clock deadline has passed.  Polling costs an atomic
+ *  load, plus a clock read once a deadline is set.
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+/// Shared flag that tells a job to stop.
+/** Copies refer to the same flag, so one copy can be handed to the worker
+ * and another one kept for cancelling it. */
+class CancelToken
+{
+    public:
+        CancelToken();
+        /// Asks the computation to stop as soon as possible.
+        void cancel() const;
+        /// Cancels the token after the given number of seconds from now.
+        /** \param seconds A time limit, 0 or less removes the deadline. */
+        void set_deadline(double seconds) const;
+        /// Returns true once cancel() was called or the deadline passed.
+        bool cancelled() const;
+        /// Returns true if the deadline passed.
+        bool expired() const;
+    private:
+        struct State
+        {
+            std::atomic<bool> cancelled;
+            std::atomic<bool> expired;
+            /// steady_clock time in nanoseconds, 0 without a deadline.
+            std::atomic<long long> deadline;
+        };
+        std::shared_ptr<State> state_;
+};
+
+/// Returns true if the token exists and was cancelled.
+inline bool cancelled(const CancelToken* token)
+{
+    return token && token->cancelled();
+}
+
+/// Polls the token every 2^14 iterations of a loop.
+inline bool cancelled(const CancelToken* token, size_t iteration)
+{
+    return (iteration & 0x3fff) == 0 && cancelled(token);
+}
+
+#endif
@@ -0,0 +1,344 @@
+/** \file cli.cpp
+ * \brief Command line interface for batch analysis and synthesis.
+ *
+ * The \c spectrogram-cli program processes many files per invocation with a
+ * pool of worker threads.  It doesn't create a QApplication, so it runs
+ * without a display.
+ */
+
+#include <iostream>
+#include <cassert>
+#include <QCoreApplication>
+#include <QStringList>
+#include <QFileInfo>
+#include <QDir>
+#include <QMap>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrentMap>
+
+#include "batch.hpp"
+#include "daemon.hpp"
+#include "fft.hpp"
+#include "instrument.hpp"
+
+namespace
+{
+    const char* usage =
+        "Usage: spectrogram-cli [options] files...\n"
+        "\n"
+        "Makes spectrograms from sound files, or sounds from spectrograms.\n"
+        "\n"
+        "Options:\n"
+        "  -a, --analyze            make spectrograms (default)\n"
+        "  -s, --synthesize         make sounds from spectrogram images\n"
+        "      --append             extend spectrograms made with --append\n"
+        "                           before by the new part of the sound\n"
+        "                           files, which keep growing (STFT); only\n"
+        "                           the new part is decoded (not for MP3),\n"
+        "                           but the image is read and rewritten\n"
+        "                           whole\n"
+        "      --shard K/N          only analyze the K-th of N parts of each\n"
+        "                           file, written next to the output as\n"
+        "                           OUTPUT.K-of-N.shard (see below)\n"
+        "      --stitch N           join the N shards of each file into its\n"
+        "                           spectrogram\n"
+        "      --live               analyze the one input, - or a FIFO, while\n"
+        "                           it is written (see below)\n"
+        "      --live-output FORMAT float or rgb (default: float)\n"
+        "      --pcm FORMAT         raw PCM samples of --live inputs that\n"
+        "                           aren't WAV streams, s16 or f32, little-\n"
+        "                           endian (default: s16)\n"
+        "      --pcm-channels N     channels of raw PCM (default: 1)\n"
+        "  -o, --output-dir DIR     directory for the results (default: next\n"
+        "                           to each input file)\n"
+        "  -j, --jobs N             number of files processed in parallel\n"
+        "                           (default: number of CPUs)\n"
+        "  -c, --channel N          channel to analyze, from 1 (default: 1)\n"
+        "  -r, --samplerate HZ      samplerate of synthesized sound and of\n"
+        "                           raw PCM (default: 44100)\n"
+        "      --synthesis TYPE     sine or noise (default: sine)\n"
+        "      --pcm-cache DIR      cache decoded sound files in DIR\n"
+        "      --result-cache DIR   reuse spectrograms rendered before, kept\n"
+        "                           in DIR (default: $SPECTROGRAM_RESULT_CACHE)\n"
+        "      --result-cache-size MB\n"
+        "                           size limit of the result cache\n"
+        "                           (default: 1024)\n"
+        "      --daemon SOCKET      serve jobs on a local socket instead of\n"
+        "                           processing files (see below)\n"
+        "      --audio-cache MB     memory for decoded sound files kept by\n"
+        "                           the daemon (default: 256)\n"
+        "      --memory-budget MB   lower the time resolution of analyses\n"
+        "                           that would need more memory, refuse\n"
+        "                           those that don't fit at all\n"
+        "      --deadline SECONDS   stop jobs that run longer\n"
+        "      --profile FILE       write time spent in each stage, counters\n"
+        "                           and FFT sizes to FILE as JSON\n"
+        "      --trace FILE         write a Chrome trace (chrome://tracing)\n"
+        "      --fft NAME           FFT backend, fftw, fftw-threads (if\n"
+        "                           built) or pocket\n"
+        "                           (default: $SPECTROGRAM_FFT)\n"
+        "      --fft-wisdom FILE    transform costs saved by --calibrate-fft\n"
+        "                           (default: $SPECTROGRAM_FFT_WISDOM)\n"
+        "      --calibrate-fft FILE measure the transform costs of this\n"
+        "                           machine and FFT backend, save them to\n"
+        "                           FILE and exit\n"
+        "  -h, --help               show this help\n"
+        "\n"
+        "Spectrogram parameters (for synthesis they override the parameters\n"
+        "saved in the image):\n"
+        "      --bandwidth X        Hz (linear) or cents (logarithmic)\n"
+        "      --basefreq HZ\n"
+        "      --maxfreq HZ\n"
+        "      --overlap PERCENT\n"
+        "      --pixpersec N\n"
+        "      --window NAME        hann, blackman, triangular or rectangular\n"
+        "      --intensity-scale S  logarithmic or linear\n"
+        "      --frequency-scale S  logarithmic or linear\n"
+        "      --brightness NAME    none or sqrt\n"
+        "      --method NAME        filterbank (exact), stft (faster) or cqt\n"
+        "                           (fast on the logarithmic scale)\n"
+        "      --palette IMAGE      palette from the first row of the image\n"
+        "\n"
+        "The input file - stands for the standard input.\n"
+        "\n"
+        "Long files can be analyzed by several processes, on several machines\n"
+        "sharing the output directory: run --shard 1/N to --shard N/N, then\n"
+        "--stitch N with the same parameters.  The processes map the sound\n"
+        "file, so it should be a mono float WAV or decoded into a --pcm-cache\n"
+        "once, and they need the same --fft-wisdom.\n"
+        "\n"
+        "With --live, every column of the spectrogram is written to the\n"
+        "standard output as soon as its STFT frame is complete, --pixpersec\n"
+        "columns per second.  A column is the image column from the top, as\n"
+        "32-bit floats from 0 to 1 in the machine byte order or as red, green\n"
+        "and blue bytes.  The rows and the latency are written to the standard\n"
+        "error first.\n"
+        "\n"
+        "The daemon keeps FFT plans, band plans and decoded sound files\n"
+        "between jobs.  Clients send one request per line, fields separated\n"
+        "by tabs:\n"
+        "  analyze ID INPUT OUTPUT PARAMETERS [NAME=VALUE...]\n"
+        "  synthesize ID INPUT OUTPUT PARAMETERS [NAME=VALUE...]\n"
+        "  cancel ID\n"
+        "PARAMETERS are in the format saved in spectrogram images, or -.\n"
+        "NAME is a spectrogram parameter, channel, samplerate, synthesis,\n"
+        "memory-budget, deadline, append (1 or 0), shard (K/N) or stitch\n"
+        "(N).\n"
+        "Each job is answered by ok ID, cancelled ID or error ID MESSAGE.\n";
+
+    /// Runs a job in one of the worker threads.
+    /** \return An error message, or a null string on success. */
+    QString process(const Job& job)
+    {
+        const QString error = run_job(job);
+        const QString output = job.shards && job.shard >= 0 ?
+            shard_name(job.output, job.shard, job.shards) : job.output;
+        if (error.isNull())
+            std::cout << job.input.toLocal8Bit().constData() << " -> "
+                << output.toLocal8Bit().constData() << "\n";
+        return error;
+    }
+
+    /// Derives the output file name from the input and the target directory.
+    QString output_name(const QString& input, const QString& directory,
+            bool synthesis)
+    {
+        const QFileInfo info(input);
+        const QString base = input == "-" ? "stdin" : info.completeBaseName();
+        const QDir dir = directory.isNull() ? info.dir() : QDir(directory);
+        return dir.filePath(base + (synthesis ? ".wav" : ".png"));
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    const QStringList args = app.arguments();
+
+    Job job;
+    QString output_dir;
+    QString socket;
+    QString profile;
+    QString trace;
+    int audio_cache = 256;
+    bool live = false;
+    LiveOutput live_output = LIVE_FLOAT;
+    PcmStream::Format pcm = PcmStream::PCM_S16;
+    int pcm_channels = 1;
+    int jobs = QThread::idealThreadCount();
+    QStringList inputs;
+
+    SpectrogramEngine check; // validates the parameters
+    for (int i = 1; i < args.size(); ++i)
+    {
+        const QString arg = args[i];
+        if (arg == "-h" || arg == "--help")
+        {
+            std::cout << usage;
+            return 0;
+        }
+        else if (arg == "-a" || arg == "--analyze")
+            job.synthesis = false;
+        else if (arg == "-s" || arg == "--synthesize")
+            job.synthesis = true;
+        else if (arg == "--append")
+            job.append = true;
+        else if (arg == "--live")
+            live = true;
+        else if (!arg.startsWith("-") || arg == "-")
+            inputs.append(arg);
+        else if (i+1 == args.size())
+        {
+            std::cerr << "Missing value for " << arg.toLocal8Bit().constData()
+                << "\n";
+            return 2;
+        }
+        else
+        {
+            const QString value = args[++i];
+            bool ok = true;
+            if (arg == "-o" || arg == "--output-dir")
+                output_dir = value;
+            else if (arg == "-j" || arg == "--jobs")
+                ok = (jobs = value.toInt()) > 0;
+            else if (arg == "-c" || arg == "--channel")
+                ok = (job.channel = value.toInt()-1) >= 0;
+            else if (arg == "-r" || arg == "--samplerate")
+                ok = (job.samplerate = value.toInt()) > 0;
+            else if (arg == "--synthesis")
+            {
+                if (value == "sine")
+                    job.type = SYNTHESIS_SINE;
+                else if (value == "noise")
+                    job.type = SYNTHESIS_NOISE;
+                else
+                    ok = false;
+            }
+            else if (arg == "--shard")
+                ok = parse_shard(value, job);
+            else if (arg == "--stitch")
+            {
+                job.shard = -1;
+                ok = (job.shards = value.toInt()) > 0;
+            }
+            else if (arg == "--live-output")
+            {
+                if (value == "float")
+                    live_output = LIVE_FLOAT;
+                else if (value == "rgb")
+                    live_output = LIVE_RGB;
+                else
+                    ok = false;
+            }
+            else if (arg == "--pcm")
+            {
+                if (value == "s16")
+                    pcm = PcmStream::PCM_S16;
+                else if (value == "f32")
+                    pcm = PcmStream::PCM_F32;
+                else
+                    ok = false;
+            }
+            else if (arg == "--pcm-channels")
+                ok = (pcm_channels = value.toInt()) > 0;
+            else if (arg == "--pcm-cache")
+                job.pcm_cache = value;
+            else if (arg == "--result-cache")
+                job.result_cache = value;
+            else if (arg == "--result-cache-size")
+                ok = (job.result_cache_size = (qint64)value.toInt() << 20) > 0;
+            else if (arg == "--memory-budget")
+                ok = (job.memory_budget = (qint64)value.toInt() << 20) > 0;
+            else if (arg == "--deadline")
+                ok = (job.deadline = value.toDouble()) > 0;
+            else if (arg == "--profile")
+                profile = value;
+            else if (arg == "--trace")
+                trace = value;
+            else if (arg == "--fft")
+                ok = set_fft_backend(value.toLocal8Bit().constData());
+            else if (arg == "--fft-wisdom")
+                ok = load_fft_wisdom(value.toLocal8Bit().constData());
+            else if (arg == "--calibrate-fft")
+            {
+                std::cout << "Measuring transform costs...\n";
+                if (calibrate_fft(value.toLocal8Bit().constData()))
+                    return 0;
+                std::cerr << "Can't write " << value.toLocal8Bit().constData()
+                    << "\n";
+                return 1;
+            }
+            else if (arg == "--daemon")
+                socket = value;
+            else if (arg == "--audio-cache")
+                ok = (audio_cache = value.toInt()) >= 0;
+            else if (arg.startsWith("--") &&
+                    apply_parameter(check, arg.mid(2), value))
+                job.parameters[arg.mid(2)] = value;
+            else
+                ok = false;
+            if (!ok)
+            {
+                std::cerr << "Invalid option or value: "
+                    << arg.toLocal8Bit().constData() << " "
+                    << value.toLocal8Bit().constData() << "\n";
+                return 2;
+            }
+        }
+    }
+    if (!profile.isNull() || !trace.isNull())
+        Profiler::enable(!trace.isNull());
+    QThreadPool::globalInstance()->setMaxThreadCount(jobs);
+    if (!socket.isNull())
+    {
+        Daemon daemon(job, (qint64)audio_cache << 20);
+        daemon.set_profile(profile, trace);
+        if (!daemon.listen(socket))
+        {
+            std::cerr << "Can't listen on " << socket.toLocal8Bit().constData()
+                << ": " << daemon.error().toLocal8Bit().constData() << "\n";
+            return 1;
+        }
+        return app.exec();
+    }
+    if (inputs.isEmpty() || (live && inputs.size() > 1))
+    {
+        std::cerr << usage;
+        return 2;
+    }
+    if (live)
+    {
+        job.input = inputs[0];
+        const QString error = run_live(job, pcm_channels, pcm, live_output);
+        if (!write_profile(profile, trace))
+            std::cerr << "Couldn't write the profile\n";
+        if (error.isNull())
+            return 0;
+        std::cerr << job.input.toLocal8Bit().constData() << ": "
+            << error.toLocal8Bit().constData() << "\n";
+        return 1;
+    }
+
+    QList<Job> queue;
+    for (int i = 0; i < inputs.size(); ++i)
+    {
+        job.input = inputs[i];
+        job.output = output_name(inputs[i], output_dir, job.synthesis);
+        queue.append(job);
+    }
+
+    const QList<QString> errors = QtConcurrent::blockingMapped(queue, process);
+    if (!write_profile(profile, trace))
+        std::cerr << "Couldn't write the profile\n";
+
+    int failed = 0;
+    for (int i = 0; i < errors.size(); ++i)
+        if (!errors[i].isNull())
+        {
+            std::cerr << queue[i].input.toLocal8Bit().constData() << ": "
+                << errors[i].toLocal8Bit().constData() << "\n";
+            ++failed;
+        }
+    return failed ? 1 : 0;
+}
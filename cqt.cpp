@@ -0,0 +1,277 @@
+#include "cqt.hpp"
+#include "dsp.hpp"
+#include "fft.hpp"
+#include "filterbank.hpp"
+#include "instrument.hpp"
+#include "scratch.hpp"
+#include "simd.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+namespace
+{
+    /// Part of the Nyquist frequency of an octave its bands may reach.
+    /** Like in decimation_factor(), the rest is the transition band of
+     * the anti-alias filter of next_octave(). */
+    const double passband = 0.8;
+    /// The shortest frame and octave.
+    const size_t min_frame = 16;
+
+    /// Multiplies samples of the signal by the window into a frame.
+    /** Sample i of the window goes to (i-half) modulo n, the middle of the
+     * window to sample 0. */
+    void add_frame(const float* signal, long samples, long start,
+            const real_vec& window, size_t n, float* out)
+    {
+        const long length = window.size();
+        const long half = length/2;
+        const long low = std::max(0L, -start);
+        const long high = std::min(length, samples - start);
+        // the first half wraps around to the end
+        const long wrap = std::min(high, half);
+        if (low < wrap)
+            simd::multiply_add(out + n - half + low, signal + start + low,
+                    &window[low], wrap-low);
+        const long rest = std::max(low, half);
+        if (rest < high)
+            simd::multiply_add(out + rest - half, signal + start + rest,
+                    &window[rest], high-rest);
+    }
+}
+
+const size_t ConstantQAnalysis::batch;
+
+ConstantQAnalysis::ConstantQAnalysis(const SpectrogramEngine& engine,
+        size_t samples, double rate)
+    : rows_(0)
+    , rate_(rate)
+{
+    // the columns and rows of the filterbank analysis of the padded signal
+    const size_t padded = padded_length(samples);
+    const size_t spectrum_size = padded/2+1;
+    columns_ = (spectrum_size-1)*2*engine.pixpersec/rate;
+    const double hop = columns_ ? (double)(spectrum_size-1)*2/columns_ : 0;
+
+    const double filterscale = ((double)spectrum_size*2)/rate;
+    std::unique_ptr<Filterbank> filterbank = Filterbank::get_filterbank(
+            engine.frequency_axis, filterscale, engine.basefreq,
+            engine.bandwidth, engine.overlap);
+    const int top_index = engine.maxfreq*filterscale;
+    std::vector<intpair> ranges;
+    for (;; ++rows_)
+    {
+        const intpair range = filterbank->get_band(rows_);
+        if (range.first > top_index)
+            break;
+        ranges.push_back(range);
+        // the lowest octave that still has the band in its passband
+        const double high = std::min(range.second, top_index)/filterscale;
+        size_t octave = 0;
+        while (high <= passband*rate/(4 << octave) &&
+                (samples >> (octave+1)) >= min_frame)
+            ++octave;
+        if (octave >= octaves_.size())
+            octaves_.resize(octave+1);
+        octaves_[octave].rows.push_back(rows_);
+    }
+
+    for (size_t k = 0; k < octaves_.size(); ++k)
+    {
+        Octave& octave = octaves_[k];
+        const double octave_rate = rate/(1 << k);
+        octave.hop = hop/(1 << k);
+        octave.step = 1;
+        octave.frames = 0;
+        octave.transform = 0;
+        if (octave.rows.empty())
+            continue;
+
+        // the main lobe of the Hann window as wide as the narrowest band
+        double narrowest = octave_rate;
+        for (size_t i = 0; i < octave.rows.size(); ++i)
+        {
+            const intpair& range = ranges[octave.rows[i]];
+            narrowest = std::min(narrowest,
+                    (range.second-range.first)/filterscale);
+        }
+        size_t frame = 4*octave_rate/std::max(narrowest, 1/filterscale);
+        frame = std::max(min_frame, std::min(frame, padded >> k));
+        octave.transform = padded_length(frame);
+        octave.window.resize(frame);
+        for (size_t i = 0; i < frame; ++i)
+            octave.window[i] = window_coef((i+0.5)/frame, WINDOW_HANN);
+
+        // frames overlapping by at least three quarters
+        while (columns_ && 2*octave.step*octave.hop <= frame/4.0)
+            octave.step *= 2;
+        octave.frames = columns_ ? (columns_-1+octave.step-1)/octave.step+1 :
+            0;
+
+        // the band windows over the bins, scaled for the inverse transform
+        const double bins_per_index = octave.transform*(1 << k)/
+            (filterscale*rate);
+        const size_t last_bin = octave.transform/2;
+        for (size_t i = 0; i < octave.rows.size(); ++i)
+        {
+            const intpair& range = ranges[octave.rows[i]];
+            const int high = std::min(range.second, top_index);
+            size_t low_bin = std::ceil(range.first*bins_per_index);
+            size_t high_bin = std::min((size_t)std::ceil(
+                        high*bins_per_index), last_bin+1);
+            if (high_bin <= low_bin)
+            {
+                // narrower than a bin, the nearest one
+                low_bin = std::min((size_t)(filterbank->get_center(
+                                octave.rows[i])*bins_per_index + 0.5),
+                        last_bin);
+                high_bin = low_bin+1;
+            }
+            real_vec kernel(high_bin-low_bin);
+            for (size_t bin = low_bin; bin < high_bin; ++bin)
+                kernel[bin-low_bin] = window_coef_at(bin/bins_per_index,
+                        range.first, range.second, filterscale,
+                        engine.window, engine.frequency_axis)/
+                    octave.transform;
+            octave.first_bins.push_back(low_bin);
+            octave.kernels.push_back(kernel);
+        }
+    }
+}
+
+int ConstantQAnalysis::rows() const
+{
+    return rows_;
+}
+
+size_t ConstantQAnalysis::columns() const
+{
+    return columns_;
+}
+
+size_t ConstantQAnalysis::octaves() const
+{
+    return octaves_.size();
+}
+
+size_t ConstantQAnalysis::frames(size_t octave) const
+{
+    return octaves_[octave].frames;
+}
+
+size_t ConstantQAnalysis::column(const Octave& octave, size_t frame) const
+{
+    return std::min(frame*octave.step, columns_-1);
+}
+
+real_vec ConstantQAnalysis::next_octave(size_t octave, const float* signal,
+        size_t samples, const CancelToken* cancel) const
+{
+    assert(octave+1 < octaves_.size());
+    // decimate() works with whole samplerates, rounding down keeps the
+    // passband
+    const double next_rate = rate_/(2 << octave);
+    return decimate(signal, samples, 2, passband*next_rate/2,
+            (int)(2*next_rate), cancel);
+}
+
+bool ConstantQAnalysis::analyze(size_t octave_index, const float* signal,
+        size_t samples, size_t first, size_t count, intensity_matrix& data,
+        const CancelToken* cancel) const
+{
+    assert(data.size() == (size_t)rows_);
+    const Octave& octave = octaves_[octave_index];
+    assert(first+count <= octave.frames);
+    const long half = octave.window.size()/2;
+    const size_t n = octave.transform;
+    const size_t bins = n/2+1;
+    const size_t howmany = std::min(count, batch);
+    ScratchArena::Frame scope;
+    float* frames = scope.take<float>(howmany*n);
+    Complex* spectra = scope.take<Complex>(howmany*bins);
+    for (size_t done = 0; done < count; done += howmany)
+    {
+        if (cancelled(cancel))
+            return false;
+        const size_t block = std::min(howmany, count-done);
+        {
+            ScopedTimer timer("cqt.frames");
+            std::fill(frames, frames+block*n, 0.0f);
+            for (size_t f = 0; f < block; ++f)
+            {
+                const size_t c = column(octave, first+done+f);
+                const long start = (long)std::floor(c*octave.hop + 0.5) -
+                    half;
+                add_frame(signal, samples, start, octave.window, n,
+                        frames + f*n);
+            }
+        }
+        {
+            ScopedTimer timer("cqt.fft");
+            for (size_t f = 0; f < block; ++f)
+                Profiler::fft(octave.window.size(), n);
+            const fft_plan_ptr plan = fft_plan(FFT_R2C, n, block, true);
+            plan->r2c(frames, spectra);
+        }
+        ScopedTimer timer("cqt.kernels");
+        for (size_t f = 0; f < block; ++f)
+        {
+            const Complex* spectrum = spectra + f*bins;
+            const size_t c = column(octave, first+done+f);
+            for (size_t i = 0; i < octave.rows.size(); ++i)
+            {
+                const real_vec& kernel = octave.kernels[i];
+                const Complex* bin = spectrum + octave.first_bins[i];
+                float re = 0;
+                float im = 0;
+                for (size_t k = 0; k < kernel.size(); ++k)
+                {
+                    re += bin[k].real()*kernel[k];
+                    im += bin[k].imag()*kernel[k];
+                }
+                data[octave.rows[i]][c] = std::sqrt(re*re + im*im);
+            }
+        }
+    }
+    return true;
+}
+
+void ConstantQAnalysis::interpolate(size_t octave_index,
+        intensity_matrix& data) const
+{
+    const Octave& octave = octaves_[octave_index];
+    if (octave.step == 1)
+        return;
+    ScopedTimer timer("cqt.interpolate");
+    for (size_t i = 0; i < octave.rows.size(); ++i)
+    {
+        real_vec& values = data[octave.rows[i]];
+        for (size_t f = 0; f+1 < octave.frames; ++f)
+        {
+            const size_t a = column(octave, f);
+            const size_t b = column(octave, f+1);
+            const float step = (values[b]-values[a])/(b-a);
+            for (size_t c = a+1; c < b; ++c)
+                values[c] = values[a] + step*(c-a);
+        }
+    }
+}
+
+size_t ConstantQAnalysis::bytes() const
+{
+    size_t total = sizeof(*this);
+    size_t transform = 0;
+    for (size_t k = 0; k < octaves_.size(); ++k)
+    {
+        const Octave& octave = octaves_[k];
+        total += sizeof(Octave) + octave.window.size()*sizeof(float) +
+            octave.rows.size()*(sizeof(int) + sizeof(size_t) +
+                    sizeof(real_vec));
+        for (size_t i = 0; i < octave.kernels.size(); ++i)
+            total += octave.kernels[i].size()*sizeof(float);
+        transform = std::max(transform, octave.transform);
+    }
+    return total + ScratchArena::bytes<float>(batch*transform) +
+        ScratchArena::bytes<Complex>(batch*(transform/2+1));
+}
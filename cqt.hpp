@@ -0,0 +1,97 @@
+#ifndef CQT_HPP
+#define CQT_HPP
+
+/** \file cqt.hpp
+ *  \brief Constant-Q analysis with sparse kernels, the fast analysis of
+ *  logarithmic spectrograms.
+ *
+ *  On a logarithmic frequency axis the bands of the filterbank are a
+ *  constant number of cents wide, so the higher ones are wide and their
+ *  envelopes need many samples, while the lower ones are narrow and barely
+ *  change from one column to the next.  The filterbank still transforms
+ *  each of them at the length of the whole signal.
+ *
+ *  With ANALYSIS_CQT, SpectrogramEngine::analyze() uses ConstantQAnalysis
+ *  instead.  Every band is analyzed in the highest octave whose samplerate
+ *  still covers it: the signal is halved by decimate() once per octave.
+ *  Within an octave the signal is cut into frames with a Hann window, long
+ *  enough for the narrowest band of the octave, and each band is a sparse
+ *  kernel over the bins of their spectra: the band window of the
+ *  filterbank.  Frames are centered on sample 0 of the transform, so the
+ *  kernel applied to a spectrum is the inverse transform of the band at
+ *  the center of the frame, the value the filterbank envelope has there.
+ *
+ *  The narrow bands of the lower octaves change slowly, they are computed
+ *  every few columns and linearly interpolated in between.  With constant
+ *  Q, each octave costs about half of the one above it.
+ *
+ *  It works on a linear frequency axis too, but the bands don't narrow
+ *  there, so it gains less.
+ */
+
+#include <vector>
+#include "engine.hpp"
+
+/// Octaves, frames and sparse kernels of a constant-Q analysis of a signal.
+class ConstantQAnalysis
+{
+    public:
+        /// Frames transformed at once by analyze().
+        static const size_t batch = 32;
+
+        /// Plans the analysis of samples at rate, after the decimation.
+        ConstantQAnalysis(const SpectrogramEngine& engine, size_t samples,
+                double rate);
+        /// Number of rows, the bands of the filterbank analysis.
+        int rows() const;
+        /// Number of columns, the width of the filterbank analysis.
+        size_t columns() const;
+        /// Number of octaves, octave k is analyzed at rate/2^k.
+        size_t octaves() const;
+        /// Number of frames analyzed in an octave.
+        size_t frames(size_t octave) const;
+        /// Decimates the signal of an octave to the rate of the next one.
+        /** \return an empty vector if the token was cancelled. */
+        real_vec next_octave(size_t octave, const float* signal,
+                size_t samples, const CancelToken* cancel = 0) const;
+        /// Computes the frames <first,first+count) of an octave.
+        /** The frames are centered on their columns, samples outside of the
+         * signal count as zeros.  The intensities aren't normalized.
+         * \param signal The signal of the octave.
+         * \param data rows() rows of columns() values, only the columns of
+         * the frames are set, see interpolate().
+         * \return false if the token was cancelled. */
+        bool analyze(size_t octave, const float* signal, size_t samples,
+                size_t first, size_t count, intensity_matrix& data,
+                const CancelToken* cancel = 0) const;
+        /// Fills the columns of the rows of an octave between its frames.
+        void interpolate(size_t octave, intensity_matrix& data) const;
+        /// Returns the memory of the plan and of analyze() in bytes.
+        size_t bytes() const;
+
+    private:
+        /// The frames and kernels of the bands analyzed at one rate.
+        struct Octave
+        {
+            double hop;
+            /// Columns between frames, a power of two.
+            size_t step;
+            size_t frames;
+            size_t transform;
+            real_vec window;
+            std::vector<int> rows;
+            /// First bin and weights of the kernel of each row.
+            std::vector<size_t> first_bins;
+            std::vector<real_vec> kernels;
+        };
+
+        /// The column of a frame of an octave.
+        size_t column(const Octave& octave, size_t frame) const;
+
+        int rows_;
+        size_t columns_;
+        double rate_;
+        std::vector<Octave> octaves_;
+};
+
+#endif
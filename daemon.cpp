@@ -0,0 +1,199 @@
+#include "daemon.hpp"
+
+#include <QLocalSocket>
+#include <QStringList>
+#include <QThreadPool>
+#include <QRunnable>
+
+namespace
+{
+    /// Runs a job in the thread pool and posts the result to the daemon.
+    class JobRunner : public QRunnable
+    {
+        public:
+            JobRunner(QObject* daemon, const QString& id, const Job& job,
+                    AudioCache* cache, const CancelToken& cancel)
+                : daemon_(daemon)
+                , id_(id)
+                , job_(job)
+                , cache_(cache)
+                , cancel_(cancel)
+            {
+            }
+            void run()
+            {
+                const QString error = run_job(job_, 0, cache_, &cancel_);
+                QMetaObject::invokeMethod(daemon_, "finished",
+                        Qt::QueuedConnection, Q_ARG(QString, id_),
+                        Q_ARG(QString, error));
+            }
+        private:
+            QObject* daemon_;
+            QString id_;
+            Job job_;
+            AudioCache* cache_;
+            CancelToken cancel_;
+    };
+}
+
+Daemon::Daemon(const Job& defaults, qint64 audio_cache, QObject* parent)
+    : QObject(parent)
+    , defaults_(defaults)
+    , cache_(audio_cache)
+{
+    connect(&server_, SIGNAL(newConnection()), this, SLOT(connection()));
+}
+
+bool Daemon::listen(const QString& name)
+{
+    QLocalServer::removeServer(name);
+    return server_.listen(name);
+}
+
+QString Daemon::error() const
+{
+    return server_.errorString();
+}
+
+void Daemon::set_profile(const QString& summary, const QString& trace)
+{
+    profile_ = summary;
+    trace_ = trace;
+}
+
+void Daemon::connection()
+{
+    while (QLocalSocket* client = server_.nextPendingConnection())
+    {
+        connect(client, SIGNAL(readyRead()), this, SLOT(read()));
+        connect(client, SIGNAL(disconnected()), this, SLOT(disconnected()));
+    }
+}
+
+void Daemon::read()
+{
+    QLocalSocket* client = qobject_cast<QLocalSocket*>(sender());
+    while (client->canReadLine())
+    {
+        const QString line =
+            QString::fromUtf8(client->readLine()).remove('\n').remove('\r');
+        if (line.isEmpty())
+            continue;
+        const QStringList fields = line.split('\t');
+        const QString error = request(client, fields);
+        if (!error.isNull())
+            reply(client, "error\t" + fields.value(1, "-") + "\t" + error);
+    }
+}
+
+void Daemon::disconnected()
+{
+    QLocalSocket* client = qobject_cast<QLocalSocket*>(sender());
+    // nobody is waiting for the results
+    for (QMap<QString, Running>::iterator it = jobs_.begin();
+            it != jobs_.end(); ++it)
+        if (it->client == client)
+        {
+            it->cancel.cancel();
+            it->client = 0;
+        }
+    client->deleteLater();
+}
+
+void Daemon::finished(const QString& id, const QString& error)
+{
+    const Running job = jobs_.take(id);
+    write_profile(profile_, trace_);
+    if (!job.client)
+        return;
+    if (error.isNull())
+        reply(job.client, "ok\t" + id);
+    else if (error == job_cancelled)
+        reply(job.client, "cancelled\t" + id);
+    else
+        reply(job.client, "error\t" + id + "\t" + error);
+}
+
+QString Daemon::request(QLocalSocket* client, const QStringList& fields)
+{
+    const QString command = fields[0];
+    if (command == "cancel" && fields.size() == 2)
+    {
+        if (!jobs_.contains(fields[1]))
+            return "no such job";
+        jobs_[fields[1]].cancel.cancel();
+        return QString();
+    }
+    if ((command != "analyze" && command != "synthesize") ||
+            fields.size() < 5)
+        return "invalid request";
+
+    const QString id = fields[1];
+    if (jobs_.contains(id))
+        return "a job with this id is running";
+    Job job = defaults_;
+    job.synthesis = command == "synthesize";
+    job.input = fields[2];
+    job.output = fields[3];
+    if (fields[4] != "-")
+    {
+        SpectrogramEngine check;
+        if (!check.deserialize(fields[4].toStdString()))
+            return "invalid parameters";
+        job.serialized = fields[4];
+    }
+
+    SpectrogramEngine check; // validates the parameters
+    for (int i = 5; i < fields.size(); ++i)
+    {
+        const QString name = fields[i].section('=', 0, 0);
+        const QString value = fields[i].section('=', 1);
+        bool ok = true;
+        if (name == "channel")
+            ok = (job.channel = value.toInt()-1) >= 0;
+        else if (name == "memory-budget")
+            ok = (job.memory_budget = (qint64)value.toInt() << 20) > 0;
+        else if (name == "deadline")
+            ok = (job.deadline = value.toDouble()) > 0;
+        else if (name == "append")
+        {
+            job.append = value == "1";
+            ok = job.append || value == "0";
+        }
+        else if (name == "shard")
+            ok = parse_shard(value, job);
+        else if (name == "stitch")
+        {
+            job.shard = -1;
+            ok = (job.shards = value.toInt()) > 0;
+        }
+        else if (name == "samplerate")
+            ok = (job.samplerate = value.toInt()) > 0;
+        else if (name == "synthesis")
+        {
+            if (value == "sine")
+                job.type = SYNTHESIS_SINE;
+            else if (value == "noise")
+                job.type = SYNTHESIS_NOISE;
+            else
+                ok = false;
+        }
+        else if (apply_parameter(check, name, value))
+            job.parameters[name] = value;
+        else
+            ok = false;
+        if (!ok)
+            return "invalid value of " + name;
+    }
+
+    Running running = {client, CancelToken()};
+    jobs_.insert(id, running);
+    QThreadPool::globalInstance()->start(
+            new JobRunner(this, id, job, &cache_, running.cancel));
+    return QString();
+}
+
+void Daemon::reply(QLocalSocket* client, const QString& line)
+{
+    client->write((line + "\n").toUtf8());
+}
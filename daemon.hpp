@@ -0,0 +1,62 @@
+#ifndef DAEMON_HPP
+#define DAEMON_HPP
+
+/** \file daemon.hpp
+ *  \brief Local render server of the command line program.
+ *
+ *  A long running process keeps FFT plans, band plans and decoded sound
+ *  files between jobs, so interactive front ends and scripts don't pay for
+ *  them again with every file.
+ */
+
+#include <QObject>
+#include <QMap>
+#include <QStringList>
+#include <QLocalServer>
+#include "batch.hpp"
+
+class QLocalSocket;
+
+/// Accepts jobs on a local socket and runs them in the global thread pool.
+/** Requests are lines of tab separated fields, see the usage text of
+ * spectrogram-cli. */
+class Daemon : public QObject
+{
+    Q_OBJECT
+    public:
+        /// \param defaults Settings of jobs not given in the requests.
+        /// \param audio_cache Memory limit of the decoded sound files.
+        Daemon(const Job& defaults, qint64 audio_cache,
+                QObject* parent = 0);
+        /// Starts listening, a stale socket of the same name is removed.
+        bool listen(const QString& name);
+        /// Describes why listen() failed.
+        QString error() const;
+        /// Rewrites the profile files after every job (see write_profile()).
+        void set_profile(const QString& summary, const QString& trace);
+    private slots:
+        void connection();
+        void read();
+        void disconnected();
+        /// Sends the result of a job to its client.
+        void finished(const QString& id, const QString& error);
+    private:
+        struct Running
+        {
+            QLocalSocket* client;
+            CancelToken cancel;
+        };
+        /// Parses and starts a request.
+        /** \return An error message, or a null string on success. */
+        QString request(QLocalSocket* client, const QStringList& fields);
+        void reply(QLocalSocket* client, const QString& line);
+
+        QLocalServer server_;
+        Job defaults_;
+        AudioCache cache_;
+        QMap<QString, Running> jobs_;
+        QString profile_;
+        QString trace_;
+};
+
+#endif
@@ -0,0 +1,492 @@
+#include "dsp.hpp"
+#include "fft.hpp"
+#include "filterbank.hpp"
+#include "scratch.hpp"
+#include "simd.hpp"
+
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+#include "samplerate.h"
+
+namespace
+{
+    float log10scale(float val)
+    {
+        assert(val >= 0 && val <= 1);
+        return std::log10(1+9*val);
+    }
+
+    float log10scale_inv(float val)
+    {
+        assert(val >= 0 && val <= 1);
+        return (std::pow(10, val)-1)/9;
+    }
+
+    void shift90deg(Complex& x)
+    {
+        x = std::conj(Complex(x.imag(), x.real()));
+    }
+
+    /// The window function, specialized for every Window.
+    template <Window W>
+    double window_value(double x);
+
+    template <>
+    double window_value<WINDOW_HANN>(double x)
+    {
+        return 0.5*(1-std::cos(x*2*PI));
+    }
+
+    template <>
+    double window_value<WINDOW_BLACKMAN>(double x)
+    {
+        return std::max(0.42 - 0.5*cos(2*PI*x) + 0.08*cos(4*PI*x), 0.0);
+    }
+
+    template <>
+    double window_value<WINDOW_RECTANGULAR>(double)
+    {
+        return 1.0;
+    }
+
+    template <>
+    double window_value<WINDOW_TRIANGULAR>(double x)
+    {
+        return 1-std::abs(2*(x-0.5));
+    }
+
+    /// The intensity axis mapping, see calc_intensity().
+    template <AxisScale A>
+    float axis_value(float val)
+    {
+        return A == SCALE_LOGARITHMIC ? log10scale(val) : val;
+    }
+
+    template <AxisScale A>
+    float axis_value_inv(float val)
+    {
+        return A == SCALE_LOGARITHMIC ? log10scale_inv(val) : val;
+    }
+
+    template <BrightCorrection B>
+    float corrected(float intensity)
+    {
+        return B == BRIGHT_SQRT ? std::sqrt(intensity) : intensity;
+    }
+
+    /// window_coefs() for one window and frequency axis.
+    template <Window W, AxisScale A>
+    void fill_window(int lowidx, int highidx, double filterscale,
+            float* coefs)
+    {
+        const int size = highidx-lowidx;
+        if (W == WINDOW_RECTANGULAR)
+            std::fill(coefs, coefs+size, 1.0f);
+        else if (A == SCALE_LINEAR)
+            for (int i = 0; i < size; ++i)
+                coefs[i] = window_value<W>((double)i/(size-1));
+        else
+        {
+            const double rloglow = freq2cent(lowidx/filterscale); // po zaokrouhleni
+            const double rloghigh = freq2cent((highidx-1)/filterscale);
+            for (int i = 0; i < size; ++i)
+            {
+                const double logidx = freq2cent((lowidx+i)/filterscale);
+                const double winidx = (logidx - rloglow)/(rloghigh - rloglow);
+                coefs[i] = window_value<W>(winidx);
+            }
+        }
+    }
+
+    template <AxisScale A, BrightCorrection B>
+    void map_intensities(const float* in, float* out, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+            out[i] = corrected<B>(axis_value<A>(in[i]));
+    }
+
+    template <AxisScale A>
+    void unmap_intensities(const float* in, float* out, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+            out[i] = axis_value_inv<A>(in[i]);
+    }
+
+    /// Input samples resampled at once when the resampling can be cancelled.
+    const size_t resample_chunk = 1 << 18;
+
+    /// Returns the resampler of the calling thread, reset.
+    /** src_simple() creates and frees a resampler for every call. */
+    SRC_STATE* converter()
+    {
+        struct Converter
+        {
+            SRC_STATE* state;
+            Converter()
+                : state(0)
+            {
+                int error = 0;
+                state = src_new(SRC_SINC_FASTEST, 1, &error);
+            }
+            ~Converter()
+            {
+                if (state)
+                    src_delete(state);
+            }
+        };
+        thread_local Converter converter;
+        if (converter.state)
+            src_reset(converter.state);
+        return converter.state;
+    }
+
+    /// Resamples in chunks with the same result as src_simple().
+    /** \return false if the token was cancelled. */
+    bool resample_chunked(SRC_STATE* state, const float* in, size_t size,
+            float* out, size_t len, double ratio, const CancelToken* cancel)
+    {
+        SRC_DATA parms;
+        size_t used = 0;
+        size_t generated = 0;
+        while (generated < len)
+        {
+            if (cancelled(cancel))
+                return false;
+            const size_t chunk = std::min(resample_chunk, size-used);
+            parms.data_in = const_cast<float*>(in) + used;
+            parms.input_frames = chunk;
+            parms.data_out = out + generated;
+            parms.output_frames = len - generated;
+            parms.end_of_input = used+chunk == size;
+            parms.src_ratio = ratio;
+            if (src_process(state, &parms))
+                break;
+            used += parms.input_frames_used;
+            generated += parms.output_frames_gen;
+            if (parms.end_of_input && !parms.output_frames_gen)
+                break;
+        }
+        return true;
+    }
+}
+
+real_vec resample(const real_vec& in, size_t len, const CancelToken* cancel)
+{
+    assert(len > 0);
+    if (in.size() == len)
+        return in;
+    real_vec out(len);
+    return resample(&in[0], in.size(), &out[0], len, cancel) ? out :
+        real_vec();
+}
+
+bool resample(const float* in, size_t size, float* out, size_t len,
+        const CancelToken* cancel)
+{
+    assert(size > 0 && len > 0);
+    //std::cout << "resample(data size: "<<size<<", len: "<<len<<")\n";
+    if (size == len)
+    {
+        std::copy(in, in+size, out);
+        return true;
+    }
+
+    const double ratio = (double)len/size;
+    if (ratio >= 256 || ratio <= 1.0/256)
+    {
+        const size_t between = ratio >= 256 ? size*50 : size/50;
+        ScratchArena::Frame frame;
+        float* step = frame.take<float>(between);
+        return resample(in, size, step, between, cancel) &&
+            resample(step, between, out, len, cancel);
+    }
+
+    SRC_DATA parms = {const_cast<float*>(in), out, (long)size, (long)len,
+        0,0,1, ratio};
+    SRC_STATE* state = converter();
+    if (!state)
+    {
+        // no converter to reuse, src_simple() makes its own
+        if (src_simple(&parms, SRC_SINC_FASTEST, 1))
+            std::fill(out, out+len, 0.0f);
+        return true;
+    }
+    if (cancel && size > resample_chunk)
+        return resample_chunked(state, in, size, out, len, ratio, cancel);
+
+    // what src_simple() does
+    src_process(state, &parms);
+    return true;
+}
+
+int decimation_factor(int samplerate, double maxfreq)
+{
+    if (maxfreq <= 0)
+        return 1;
+    const int factor = 0.8*samplerate/(2*maxfreq);
+    return factor >= 2 ? factor : 1;
+}
+
+real_vec decimate(const float* in, size_t size, int factor,
+        double maxfreq, int samplerate, const CancelToken* cancel)
+{
+    assert(factor > 1);
+    const int half = decimation_reach(factor, maxfreq, samplerate);
+    const double cutoff = 0.5/factor;
+
+    real_vec h(2*half+1);
+    double sum = 0;
+    for (int j = -half; j <= half; ++j)
+    {
+        const double sinc = j ? std::sin(2*PI*cutoff*j)/(PI*j) : 2*cutoff;
+        const double x = (double)(j+half)/(2*half);
+        h[j+half] = sinc*(0.42 - 0.5*std::cos(2*PI*x) +
+                0.08*std::cos(4*PI*x));
+        sum += h[j+half];
+    }
+    for (size_t j = 0; j < h.size(); ++j)
+        h[j] /= sum; // unity gain at DC
+
+    const long n = size;
+    real_vec out((n+factor-1)/factor);
+    for (long k = 0; k < (long)out.size(); ++k)
+    {
+        if (cancelled(cancel, k))
+            return real_vec();
+        const long center = k*factor;
+        const long first = std::max(center-half, 0L);
+        const long last = std::min(center+half, n-1);
+        out[k] = simd::dot(&h[0] + (first-center+half), in + first,
+                last-first+1);
+    }
+    return out;
+}
+
+int decimation_reach(int factor, double maxfreq, int samplerate)
+{
+    // transition band width relative to the original samplerate
+    const double transition = 1.0/factor - 2*maxfreq/samplerate;
+    assert(transition > 0);
+    return std::ceil(2.75/transition);
+}
+
+real_vec get_envelope(complex_vec& band, const CancelToken* cancel)
+{
+    assert(band.size() > 1);
+    const size_t size = band.size();
+    const size_t padded = padded_length((size-1)*2);
+    band.resize(padded/2+1);
+    real_vec envelope(padded);
+    const bool done = get_envelope(&band[0], size, &envelope[0], cancel);
+    band.resize(size);
+    return done ? envelope : real_vec();
+}
+
+bool get_envelope(Complex* band, size_t size, float* out,
+        const CancelToken* cancel)
+{
+    assert(size > 1);
+    const size_t padded = padded_length((size-1)*2);
+    ScratchArena::Frame frame;
+
+    // copy + phase shift
+    Complex* shifted = frame.take<Complex>(padded/2+1);
+    std::copy(band, band+size, shifted);
+    std::for_each(shifted, shifted+size, shift90deg);
+
+    if (!padded_IFFT(band, size, out, cancel))
+        return false;
+    float* shifted_signal = frame.take<float>(padded);
+    if (!padded_IFFT(shifted, size, shifted_signal, cancel))
+        return false;
+
+    simd::magnitude(out, shifted_signal, out, padded);
+    return true;
+}
+
+size_t envelope_scratch(size_t size)
+{
+    const size_t padded = padded_length((size-1)*2);
+    return ScratchArena::bytes<Complex>(padded/2+1) +
+        ScratchArena::bytes<float>(padded);
+}
+
+double window_coef(double x, Window window)
+{
+    assert(x >= 0 && x <= 1);
+    switch (window)
+    {
+        case WINDOW_HANN:
+            return window_value<WINDOW_HANN>(x);
+        case WINDOW_BLACKMAN:
+            return window_value<WINDOW_BLACKMAN>(x);
+        case WINDOW_RECTANGULAR:
+            return window_value<WINDOW_RECTANGULAR>(x);
+        case WINDOW_TRIANGULAR:
+            return window_value<WINDOW_TRIANGULAR>(x);
+    }
+    assert(false);
+}
+
+float calc_intensity(float val, AxisScale intensity_axis)
+{
+    assert(val >= 0 && val <= 1);
+    if (intensity_axis == SCALE_LOGARITHMIC)
+        return axis_value<SCALE_LOGARITHMIC>(val);
+    return axis_value<SCALE_LINEAR>(val);
+}
+
+float calc_intensity_inv(float val, AxisScale intensity_axis)
+{
+    assert(val >= 0 && val <= 1);
+    if (intensity_axis == SCALE_LOGARITHMIC)
+        return axis_value_inv<SCALE_LOGARITHMIC>(val);
+    return axis_value_inv<SCALE_LINEAR>(val);
+}
+
+// cutoff negative
+void normalize_image(std::vector<real_vec>& data)
+{
+    float max = 0.0f;
+    for (std::vector<real_vec>::iterator it=data.begin();
+            it!=data.end(); ++it)
+        if (!it->empty())
+            max = std::max(simd::max(&(*it)[0], it->size()), max);
+    if (max == 0.0f)
+        return;
+    for (std::vector<real_vec>::iterator it=data.begin();
+            it!=data.end(); ++it)
+        if (!it->empty())
+            simd::abs_divide(&(*it)[0], it->size(), max);
+}
+
+
+void normalize_signal(real_vec& vector)
+{
+    const float max = simd::max_abs(vector.data(), vector.size());
+    //std::cout <<"max: "<<max<<"\n";
+    assert(max > 0);
+    simd::divide(vector.data(), vector.size(), max);
+}
+
+float brightness_correction(float intensity, BrightCorrection correction)
+{
+    if (correction == BRIGHT_SQRT)
+        return corrected<BRIGHT_SQRT>(intensity);
+    return corrected<BRIGHT_NONE>(intensity);
+}
+
+real_vec window_coefs(int lowidx, int highidx, double filterscale,
+        Window window, AxisScale frequency_axis)
+{
+    real_vec coefs(highidx-lowidx);
+    window_kernel(window, frequency_axis)(lowidx, highidx, filterscale,
+            coefs.data());
+    return coefs;
+}
+
+double window_coef_at(double index, int lowidx, int highidx,
+        double filterscale, Window window, AxisScale frequency_axis)
+{
+    const int size = highidx-lowidx;
+    if (window == WINDOW_RECTANGULAR || size < 2)
+        return 1;
+    double x;
+    if (frequency_axis == SCALE_LINEAR)
+        x = (index-lowidx)/(size-1);
+    else
+    {
+        const double rloglow = freq2cent(lowidx/filterscale);
+        const double rloghigh = freq2cent((highidx-1)/filterscale);
+        x = (freq2cent(index/filterscale) - rloglow)/(rloghigh - rloglow);
+    }
+    // also catches the -infinity of freq2cent(0)
+    if (!(x > 0))
+        return window_coef(0, window);
+    return window_coef(std::min(x, 1.0), window);
+}
+
+WindowKernel window_kernel(Window window, AxisScale frequency_axis)
+{
+    static const WindowKernel kernels[4][2] = {
+        {fill_window<WINDOW_HANN, SCALE_LINEAR>,
+            fill_window<WINDOW_HANN, SCALE_LOGARITHMIC>},
+        {fill_window<WINDOW_BLACKMAN, SCALE_LINEAR>,
+            fill_window<WINDOW_BLACKMAN, SCALE_LOGARITHMIC>},
+        {fill_window<WINDOW_RECTANGULAR, SCALE_LINEAR>,
+            fill_window<WINDOW_RECTANGULAR, SCALE_LOGARITHMIC>},
+        {fill_window<WINDOW_TRIANGULAR, SCALE_LINEAR>,
+            fill_window<WINDOW_TRIANGULAR, SCALE_LOGARITHMIC>}};
+    assert(window >= 0 && window < 4);
+    return kernels[window][frequency_axis == SCALE_LOGARITHMIC];
+}
+
+IntensityKernel intensity_kernel(AxisScale intensity_axis,
+        BrightCorrection correction)
+{
+    static const IntensityKernel kernels[2][2] = {
+        {map_intensities<SCALE_LINEAR, BRIGHT_NONE>,
+            map_intensities<SCALE_LINEAR, BRIGHT_SQRT>},
+        {map_intensities<SCALE_LOGARITHMIC, BRIGHT_NONE>,
+            map_intensities<SCALE_LOGARITHMIC, BRIGHT_SQRT>}};
+    return kernels[intensity_axis == SCALE_LOGARITHMIC]
+        [correction == BRIGHT_SQRT];
+}
+
+IntensityKernel intensity_inv_kernel(AxisScale intensity_axis)
+{
+    if (intensity_axis == SCALE_LOGARITHMIC)
+        return unmap_intensities<SCALE_LOGARITHMIC>;
+    return unmap_intensities<SCALE_LINEAR>;
+}
+
+void apply_window(complex_vec& band, const real_vec& coefs)
+{
+    assert(band.size() == coefs.size());
+    apply_window(band.data(), coefs.data(), band.size());
+}
+
+void apply_window(Complex* band, const float* coefs, size_t n)
+{
+    simd::scale_complex(reinterpret_cast<float*>(band), coefs, n);
+}
+
+real_vec sine_carrier(const real_vec& envelope, double phase)
+{
+    real_vec bandsignal(envelope.size()*2);
+    sine_carrier(envelope.data(), envelope.size(), phase, bandsignal.data());
+    return bandsignal;
+}
+
+void sine_carrier(const float* envelope, size_t n, double phase, float* out)
+{
+    float sines[4];
+    for (int j = 0; j < 4; ++j)
+        sines[j] = std::cos(j*PI/2 + phase);
+    simd::carrier(envelope, n, sines, out);
+}
+
+void modulate_noise(const real_vec& envelope, const real_vec& noise,
+        real_vec& out, const CancelToken* cancel)
+{
+    assert(envelope.size() == out.size());
+    modulate_noise(envelope.data(), noise.data(), noise.size(), out.data(),
+            out.size(), cancel);
+}
+
+void modulate_noise(const float* envelope, const float* noise,
+        size_t noise_size, float* out, size_t n, const CancelToken* cancel)
+{
+    // one pass over the noise loop at a time, in pieces for cancellation
+    for (size_t i = 0; i < n; )
+    {
+        if (cancelled(cancel))
+            return;
+        const size_t offset = i % noise_size;
+        const size_t count = std::min(std::min(n-i, noise_size-offset),
+                (size_t)1 << 16);
+        simd::multiply_add(out+i, envelope+i, noise+offset, count);
+        i += count;
+    }
+}
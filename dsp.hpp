@@ -0,0 +1,119 @@
+#ifndef DSP_HPP
+#define DSP_HPP
+
+/** \file dsp.hpp
+ *  \brief Signal processing kernels used by the spectrogram engine.
+ *
+ *  They are exposed separately from SpectrogramEngine so that they can be
+ *  benchmarked on their own.  The kernels that run over whole signals take
+ *  an optional CancelToken, which they check every few thousand samples;
+ *  they return an empty or partial result when it was cancelled.
+ *
+ *  The kernels that return vectors allocate them for every call.  Each of
+ *  them has a variant writing to buffers of the caller, which takes its
+ *  temporaries from the thread's ScratchArena; the engine uses those for
+ *  the bands.
+ */
+
+#include "types.hpp"
+#include "cancel.hpp"
+
+/// Uses libsrc to resample the input vector to a given length.
+real_vec resample(const real_vec& in, size_t len,
+        const CancelToken* cancel = 0);
+/// Resamples size samples to len samples at out.
+/** \return false if the token was cancelled. */
+bool resample(const float* in, size_t size, float* out, size_t len,
+        const CancelToken* cancel = 0);
+
+/// Returns the integer factor by which the signal can be decimated before analysis.
+/** Only frequencies up to maxfreq end up in the spectrogram, so the signal
+ * can be downsampled as long as maxfreq stays safely below the new
+ * Nyquist frequency (at most 80 % of it, which leaves room for the
+ * transition band of the anti-alias filter).
+ * \return 1 if decimation isn't worth it. */
+int decimation_factor(int samplerate, double maxfreq);
+
+/// Lowpass filters the signal and keeps every factor-th sample.
+/** A Blackman windowed sinc filter with the cutoff at the new Nyquist
+ * frequency is used.  Aliases only land above the passband, so the
+ * transition band can extend up to the first alias of maxfreq.
+ *
+ * Only the kept output samples are computed (polyphase form), so the cost
+ * is about filter length / factor multiplications per input sample.  The
+ * filter is symmetric and centered, the output isn't delayed.
+ */
+real_vec decimate(const float* in, size_t size, int factor,
+        double maxfreq, int samplerate, const CancelToken* cancel = 0);
+/// Returns the samples decimate() reads on each side of an output sample.
+/** Signals decimated piece by piece need this much overlap. */
+int decimation_reach(int factor, double maxfreq, int samplerate);
+
+/// Envelope detection: http://www.numerix-dsp.com/envelope.html
+/** The band is destroyed. */
+real_vec get_envelope(complex_vec& band, const CancelToken* cancel = 0);
+/// Envelope detection into the caller's buffer.
+/** \param band size values with room for the padding of padded_IFFT(),
+ * it is destroyed.
+ * \param out Room for padded_length((size-1)*2) samples.
+ * \return false if the token was cancelled. */
+bool get_envelope(Complex* band, size_t size, float* out,
+        const CancelToken* cancel = 0);
+/// Returns the ScratchArena bytes get_envelope() takes for a band.
+size_t envelope_scratch(size_t size);
+
+/// Returns the value of a window function at x from <0,1>.
+double window_coef(double x, Window window);
+/// Computes the window function for the frequency-domain interval <lowidx,highidx).
+/** On a logarithmic frequency axis, the window is spread logarithmically. */
+real_vec window_coefs(int lowidx, int highidx, double filterscale,
+        Window window, AxisScale frequency_axis);
+/// Returns the window_coefs() of <lowidx,highidx) at a fractional index.
+/** Used to weight spectra of other lengths than the whole signal's. */
+double window_coef_at(double index, int lowidx, int highidx,
+        double filterscale, Window window, AxisScale frequency_axis);
+/// Fills coefs with the window_coefs() of <lowidx,highidx).
+typedef void (*WindowKernel)(int lowidx, int highidx, double filterscale,
+        float* coefs);
+/// Returns the window kernel for the given window and frequency axis.
+/** The kernels are instantiated for every combination, so their loops
+ * don't branch on the parameters. */
+WindowKernel window_kernel(Window window, AxisScale frequency_axis);
+/// Multiplies a frequency-domain interval by precomputed window coefficients.
+void apply_window(complex_vec& band, const real_vec& coefs);
+void apply_window(Complex* band, const float* coefs, size_t n);
+
+/// Maps an analyzed intensity from <0,1> to the intensity axis.
+float calc_intensity(float val, AxisScale intensity_axis);
+/// The inverse of calc_intensity().
+float calc_intensity_inv(float val, AxisScale intensity_axis);
+float brightness_correction(float intensity, BrightCorrection correction);
+
+/// Maps n values at once, in may be equal to out.
+typedef void (*IntensityKernel)(const float* in, float* out, size_t n);
+/// Returns the kernel of calc_intensity() followed by brightness_correction().
+/** Like window_kernel(), it is selected once and doesn't branch per value. */
+IntensityKernel intensity_kernel(AxisScale intensity_axis,
+        BrightCorrection correction);
+/// Returns the kernel of calc_intensity_inv().
+IntensityKernel intensity_inv_kernel(AxisScale intensity_axis);
+
+/// Scales the intensities to <0,1>.
+void normalize_image(std::vector<real_vec>& data);
+/// Scales the signal to <-1,1>.
+void normalize_signal(real_vec& vector);
+
+/// Modulates a sine at a quarter of the samplerate by the envelope.
+/** The result has twice the samples of the envelope, it is shifted to the
+ * band's frequency in the frequency domain by sine synthesis. */
+real_vec sine_carrier(const real_vec& envelope, double phase);
+/// sine_carrier() of n envelope values into 2n samples at out.
+void sine_carrier(const float* envelope, size_t n, double phase, float* out);
+/// Adds looped noise modulated by the envelope to the output.
+void modulate_noise(const real_vec& envelope, const real_vec& noise,
+        real_vec& out, const CancelToken* cancel = 0);
+void modulate_noise(const float* envelope, const float* noise,
+        size_t noise_size, float* out, size_t n,
+        const CancelToken* cancel = 0);
+
+#endif
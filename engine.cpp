@@ -0,0 +1,704 @@
+#include "engine.hpp"
+#include "filterbank.hpp"
+#include "fft.hpp"
+#include "dsp.hpp"
+#include "instrument.hpp"
+#include "progress.hpp"
+#include "scratch.hpp"
+#include "stft.hpp"
+#include "cqt.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <cassert>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <sstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+
+namespace 
+{
+    // random number from <0,1>
+    double random_double()
+    {
+        return ((double)rand()/(double)RAND_MAX);
+    }
+
+    /// Creates a random pink noise signal in the frequency domain
+    /** \param size Desired number of samples in time domain (after IFFT). */
+    complex_vec get_pink_noise(size_t size)
+    {
+        complex_vec res;
+        for (size_t i = 0; i < (size+1)/2; ++i)
+        {
+            const float mag = std::pow((float) i, -0.5f);
+            const double phase = (2*random_double()-1) * PI;//+-pi random phase 
+            res.push_back(Complex(mag*std::cos(phase), mag*std::sin(phase)));
+        }
+        return res;
+    }
+
+    void report_status(ProgressListener* listener, const std::string& text)
+    {
+        if (listener)
+            listener->status(text);
+    }
+
+    void report_progress(ProgressListener* listener, int percent)
+    {
+        if (listener)
+            listener->progress(percent);
+    }
+
+    /// Recently used band plans, shared by all engines of the process.
+    /** Long running processes analyze many signals of the same length with
+     * the same parameters, the plans don't have to be recomputed then. */
+    class BandPlanCache
+    {
+        public:
+            typedef std::shared_ptr<const BandPlan> plan_ptr;
+
+            plan_ptr lookup(const std::string& key)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                std::map<std::string, Entry>::iterator it = plans_.find(key);
+                if (it == plans_.end())
+                    return plan_ptr();
+                it->second.last_use = ++uses_;
+                return it->second.plan;
+            }
+
+            void store(const std::string& key, const plan_ptr& plan)
+            {
+                const size_t bytes = plan->bytes();
+                if (bytes > max_bytes/2)
+                    return;
+                std::vector<plan_ptr> evicted; // released after unlocking
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (plans_.count(key))
+                    return;
+                while (!plans_.empty() && bytes_ + bytes > max_bytes)
+                {
+                    std::map<std::string, Entry>::iterator oldest =
+                        plans_.begin();
+                    for (std::map<std::string, Entry>::iterator it =
+                            plans_.begin(); it != plans_.end(); ++it)
+                        if (it->second.last_use < oldest->second.last_use)
+                            oldest = it;
+                    bytes_ -= oldest->second.plan->bytes();
+                    evicted.push_back(oldest->second.plan);
+                    plans_.erase(oldest);
+                }
+                Entry entry = {plan, ++uses_};
+                plans_[key] = entry;
+                bytes_ += bytes;
+            }
+
+        private:
+            struct Entry
+            {
+                plan_ptr plan;
+                unsigned long last_use;
+            };
+            static const size_t max_bytes = 64 << 20;
+
+            std::mutex mutex_;
+            std::map<std::string, Entry> plans_;
+            size_t bytes_ = 0;
+            unsigned long uses_ = 0;
+    };
+
+    BandPlanCache band_plans;
+}
+
+size_t BandPlan::bytes() const
+{
+    size_t total = sizeof(*this) + ranges.size()*sizeof(intpair);
+    for (size_t i = 0; i < windows.size(); ++i)
+        total += sizeof(real_vec) + windows[i].size()*sizeof(float);
+    return total;
+}
+
+size_t BandPlan::scratch_bytes() const
+{
+    size_t widest = 2;
+    for (size_t i = 0; i < ranges.size(); ++i)
+        widest = std::max(widest, (size_t)(ranges[i].second-ranges[i].first));
+    // the band with its padding, its envelope and the temporaries of
+    // get_envelope()
+    const size_t padded = padded_length((widest-1)*2);
+    return ScratchArena::bytes<Complex>(padded/2+1) +
+        ScratchArena::bytes<float>(padded) + envelope_scratch(widest);
+}
+
+SpectrogramEngine::SpectrogramEngine() // defaults
+    : bandwidth(100)
+    , basefreq(55)
+    , maxfreq(22050)
+    , overlap(0.8)
+    , pixpersec(100)
+    , window(WINDOW_HANN)
+    , intensity_axis(SCALE_LOGARITHMIC)
+    , frequency_axis(SCALE_LOGARITHMIC)
+    , correction(BRIGHT_NONE)
+    , method(ANALYSIS_FILTERBANK)
+{
+}
+
+intensity_matrix SpectrogramEngine::analyze(const float* signal,
+        size_t samples, int samplerate, ProgressListener* listener,
+        const CancelToken* cancel) const
+{
+    intensity_matrix image_data = analyze_raw(signal, samples, samplerate,
+            listener, cancel);
+    if (image_data.empty())
+        return image_data;
+
+    {
+        ScopedTimer timer("normalize");
+        normalize_image(image_data);
+    }
+
+    report_progress(listener, 99);
+    return image_data;
+}
+
+intensity_matrix SpectrogramEngine::analyze_raw(const float* signal,
+        size_t samples, int samplerate, ProgressListener* listener,
+        const CancelToken* cancel) const
+{
+    report_progress(listener, 0);
+    // frequencies above maxfreq aren't needed, transform at a lower rate
+    const int factor = decimation_factor(samplerate, maxfreq);
+    real_vec decimated;
+    if (factor > 1)
+    {
+        report_status(listener, "Decimating input");
+        ScopedTimer timer("decimate");
+        decimated = decimate(signal, samples, factor, maxfreq, samplerate,
+                cancel);
+        Profiler::allocated(decimated.size()*sizeof(float));
+    }
+    if (cancelled(cancel))
+        return intensity_matrix();
+    const double rate = (double)samplerate/factor;
+    if (method == ANALYSIS_STFT)
+        return factor > 1 ?
+            stft_analysis(&decimated[0], decimated.size(), rate, listener,
+                    cancel) :
+            stft_analysis(signal, samples, rate, listener, cancel);
+    if (method == ANALYSIS_CQT)
+        return factor > 1 ?
+            cqt_analysis(&decimated[0], decimated.size(), rate, listener,
+                    cancel) :
+            cqt_analysis(signal, samples, rate, listener, cancel);
+
+    report_status(listener, "Transforming input");
+    const complex_vec spectrum = factor > 1 ? padded_FFT(decimated, cancel) :
+        padded_FFT(signal, samples, cancel);
+    if (cancelled(cancel))
+        return intensity_matrix();
+
+    const size_t width = (spectrum.size()-1)*2*pixpersec/rate;
+
+    const std::shared_ptr<const BandPlan> plan =
+        band_plan(spectrum.size(), rate);
+    const int bands = plan->ranges.size();
+    const int top_index = plan->top_index;
+
+    intensity_matrix image_data;
+    image_data.reserve(bands);
+    ScratchArena& scratch = ScratchArena::local();
+    ScratchArena::Frame job(scratch);
+    scratch.reserve(plan->scratch_bytes());
+    ProgressCounter counter(bands);
+    {
+        ProgressReporter reporter(listener, counter, "bands", 5, 93);
+        for (int bandidx = 0; bandidx < bands; ++bandidx)
+        {
+            if (cancelled(cancel))
+                return intensity_matrix();
+            // filtering
+            const intpair range = plan->ranges[bandidx];
+            //std::cout << "-----\n";
+            //std::cout << "spectrum size: " << spectrum.size() << "\n";
+            //std::cout << "lowidx: "<<range.first<<" highidx: "<<range.second<<"\n";
+            //std::cout << "(real)lowfreq: " << range.first/filterscale << " (real)highfreq: "<<range.second/filterscale<< "\n";
+            //std::cout << "skutecna sirka: " << (range.second-range.first)/filterscale<< " hz\n";
+            //std::cout << "svislych hodnot: "<<(range.second-range.first)<<"\n";
+            //std::cout << "dava vzorku: "<<(range.second-range.first-1)*2<<"\n";
+            //std::cout << "teoreticky staci: " << 2*(range.second-range.first)/filterscale<< " hz samplerate\n";
+            //std::cout << "ja beru: " <<width << "\n";
+
+            ScratchArena::Frame frame(scratch);
+            const size_t size = range.second - range.first;
+            const size_t padded = padded_length((size-1)*2);
+            Complex* filterband = frame.take<Complex>(padded/2+1);
+            {
+                ScopedTimer timer("band.extract");
+                std::copy(spectrum.begin()+range.first, 
+                        spectrum.begin()+std::min(range.second, top_index),
+                        filterband);
+                    
+                if (range.second > top_index)
+                    std::fill(filterband+top_index-range.first,
+                            filterband+size, Complex(0,0));
+            }
+
+            // windowing
+            {
+                ScopedTimer timer("band.window");
+                apply_window(filterband, plan->windows[bandidx].data(), size);
+            }
+
+            // envelope detection + resampling
+            float* envelope = frame.take<float>(padded);
+            {
+                ScopedTimer timer("band.envelope");
+                if (!get_envelope(filterband, size, envelope, cancel))
+                    return intensity_matrix();
+            }
+            {
+                ScopedTimer timer("band.resample");
+                image_data.push_back(real_vec(width));
+                Profiler::allocated(width*sizeof(float));
+                if (!resample(envelope, padded, &image_data.back()[0], width,
+                            cancel))
+                    return intensity_matrix();
+            }
+            counter.advance();
+        }
+    }
+
+    return image_data;
+}
+
+intensity_matrix SpectrogramEngine::stft_analysis(const float* signal,
+        size_t samples, double rate, ProgressListener* listener,
+        const CancelToken* cancel) const
+{
+    report_status(listener, "Transforming frames");
+    const StftAnalysis stft(*this, samples, rate);
+    intensity_matrix image_data(stft.rows());
+    for (size_t i = 0; i < image_data.size(); ++i)
+        image_data[i].resize(stft.columns());
+    Profiler::allocated(stft.rows()*stft.columns()*sizeof(float));
+
+    ScratchArena& scratch = ScratchArena::local();
+    ScratchArena::Frame job(scratch);
+    scratch.reserve(stft.bytes());
+    const size_t block = StftAnalysis::batch;
+    ProgressCounter counter((stft.columns()+block-1)/block);
+    {
+        ProgressReporter reporter(listener, counter, "frames", 5, 93);
+        for (size_t first = 0; first < stft.columns(); first += block)
+        {
+            if (!stft.analyze(signal, samples, first,
+                        std::min(block, stft.columns()-first), image_data,
+                        cancel))
+                return intensity_matrix();
+            counter.advance();
+        }
+    }
+
+    return image_data;
+}
+
+intensity_matrix SpectrogramEngine::cqt_analysis(const float* signal,
+        size_t samples, double rate, ProgressListener* listener,
+        const CancelToken* cancel) const
+{
+    report_status(listener, "Transforming octaves");
+    const ConstantQAnalysis cqt(*this, samples, rate);
+    intensity_matrix image_data(cqt.rows());
+    for (size_t i = 0; i < image_data.size(); ++i)
+        image_data[i].resize(cqt.columns());
+    Profiler::allocated(cqt.rows()*cqt.columns()*sizeof(float));
+
+    ScratchArena& scratch = ScratchArena::local();
+    ScratchArena::Frame job(scratch);
+    scratch.reserve(cqt.bytes());
+    const size_t block = ConstantQAnalysis::batch;
+    long blocks = 0;
+    for (size_t octave = 0; octave < cqt.octaves(); ++octave)
+        blocks += (cqt.frames(octave)+block-1)/block;
+    ProgressCounter counter(blocks);
+    {
+        ProgressReporter reporter(listener, counter, "frames", 5, 93);
+        // the signal of the octave, decimated from the one above
+        real_vec decimated;
+        const float* input = signal;
+        size_t size = samples;
+        for (size_t octave = 0; octave < cqt.octaves(); ++octave)
+        {
+            if (octave > 0)
+            {
+                ScopedTimer timer("cqt.decimate");
+                decimated = cqt.next_octave(octave-1, input, size, cancel);
+                if (cancelled(cancel))
+                    return intensity_matrix();
+                Profiler::allocated(decimated.size()*sizeof(float));
+                input = decimated.data();
+                size = decimated.size();
+            }
+            const size_t frames = cqt.frames(octave);
+            for (size_t first = 0; first < frames; first += block)
+            {
+                if (!cqt.analyze(octave, input, size, first,
+                            std::min(block, frames-first), image_data,
+                            cancel))
+                    return intensity_matrix();
+                counter.advance();
+            }
+            cqt.interpolate(octave, image_data);
+        }
+    }
+
+    return image_data;
+}
+
+PixelBuffer SpectrogramEngine::render(const intensity_matrix& data) const
+{
+    ScopedTimer timer("image.map");
+    PixelBuffer out;
+    out.height = data.size();
+    out.width = data.empty() ? 0 : data[0].size();
+    out.indexed = palette.indexable();
+    out.pixels.resize((size_t)out.width*out.height);
+    Profiler::allocated(out.pixels.size()*sizeof(unsigned int));
+    const IntensityKernel map = intensity_kernel(intensity_axis, correction);
+    real_vec intensities(out.width);
+    for (int y = 0; y < out.height; ++y)
+    {
+        assert((int)data[y].size() == out.width);
+        unsigned int* row = &out.pixels[(size_t)(out.height-1-y)*out.width];
+        map(data[y].data(), intensities.data(), out.width);
+        palette.get_colors(intensities.data(), out.width, row);
+    }
+    return out;
+}
+
+unsigned int SpectrogramEngine::pixel(float value) const
+{
+    float intensity = calc_intensity(value, intensity_axis);
+    intensity = brightness_correction(intensity, correction);
+    return palette.get_color(intensity);
+}
+
+float SpectrogramEngine::intensity(rgb_t color) const
+{
+    return calc_intensity_inv(palette.get_intensity(color), intensity_axis);
+}
+
+std::shared_ptr<const BandPlan> SpectrogramEngine::band_plan(
+        size_t spectrum_size, double rate) const
+{
+    std::ostringstream key;
+    key << std::setprecision(17) << spectrum_size << delimiter << rate
+        << delimiter << bandwidth << delimiter << basefreq << delimiter
+        << maxfreq << delimiter << overlap << delimiter << (int)window
+        << delimiter << (int)frequency_axis;
+    std::shared_ptr<const BandPlan> cached = band_plans.lookup(key.str());
+    Profiler::count(cached ? "band_plan.hits" : "band_plan.misses");
+    if (cached)
+        return cached;
+    ScopedTimer timer("band_plan");
+
+    // transformation of frequency in hz to index in spectrum
+    const double filterscale = ((double)spectrum_size*2)/rate;
+    std::unique_ptr<Filterbank> filterbank = Filterbank::get_filterbank(
+            frequency_axis, filterscale, basefreq, bandwidth, overlap);
+
+    std::shared_ptr<BandPlan> plan(new BandPlan);
+    plan->top_index = maxfreq*filterscale;
+    // maxfreq has to be at most nyquist
+    assert(plan->top_index <= (int)spectrum_size);
+    for (size_t bandidx = 0;; ++bandidx)
+    {
+        const intpair range = filterbank->get_band(bandidx);
+        if (range.first > plan->top_index)
+            break;
+        plan->ranges.push_back(range);
+        plan->windows.push_back(window_coefs(range.first, range.second,
+                    filterscale, window, frequency_axis));
+    }
+    band_plans.store(key.str(), plan);
+    return plan;
+}
+
+size_t SpectrogramEngine::analysis_memory(size_t samples,
+        int samplerate) const
+{
+    const int factor = decimation_factor(samplerate, maxfreq);
+    const size_t decimated = factor > 1 ? (samples+factor-1)/factor : 0;
+    const size_t padded = padded_length(factor > 1 ? decimated : samples);
+    const size_t spectrum = padded/2+1;
+    const double rate = (double)samplerate/factor;
+    if (method == ANALYSIS_STFT)
+    {
+        // the decimated signal, the intensities with the frames, then the
+        // rendering
+        const StftAnalysis stft(*this, factor > 1 ? decimated : samples,
+                rate);
+        const size_t image = stft.rows()*stft.columns()*sizeof(float);
+        return std::max(decimated*sizeof(float) + image + stft.bytes(),
+                image + 2*stft.rows()*stft.columns()*sizeof(unsigned int));
+    }
+    if (method == ANALYSIS_CQT)
+    {
+        // the decimated signal, the intensities with the signals of two
+        // octaves and the frames, then the rendering
+        const size_t input = factor > 1 ? decimated : samples;
+        const ConstantQAnalysis cqt(*this, input, rate);
+        const size_t image = cqt.rows()*cqt.columns()*sizeof(float);
+        const size_t octaves = cqt.octaves() > 1 ?
+            (input/2 + input/4)*sizeof(float) : 0;
+        return std::max(decimated*sizeof(float) + image + octaves +
+                cqt.bytes(),
+                image + 2*cqt.rows()*cqt.columns()*sizeof(unsigned int));
+    }
+    const size_t width = (spectrum-1)*2*pixpersec/rate;
+
+    const double filterscale = ((double)spectrum*2)/rate;
+    std::unique_ptr<Filterbank> filterbank = Filterbank::get_filterbank(
+            frequency_axis, filterscale, basefreq, bandwidth, overlap);
+    const size_t bands = filterbank->num_bands_est(maxfreq)+1;
+    const intpair widest = filterbank->get_band(bands-1);
+    const size_t band = widest.second-widest.first;
+
+    // the transform: decimated signal, padded input and the spectrum
+    const size_t transform = decimated*sizeof(float) +
+        padded*sizeof(float) + spectrum*sizeof(Complex);
+    // the bands: spectrum, window plan, intensities and the temporaries of
+    // the widest band (two copies, two inverse transforms, resampling)
+    const size_t image = bands*width*sizeof(float);
+    const size_t band_plan = bands*band*sizeof(float);
+    const size_t temporaries = 2*band*sizeof(Complex) +
+        2*padded_length(2*band)*sizeof(float) + width*sizeof(float);
+    const size_t analysis = spectrum*sizeof(Complex) + band_plan + image +
+        temporaries;
+    // rendering: intensities, pixels and an RGB image
+    const size_t rendering = image + 2*bands*width*sizeof(unsigned int);
+    return std::max(transform, std::max(analysis, rendering));
+}
+
+bool SpectrogramEngine::fit_memory(size_t samples, int samplerate,
+        size_t budget)
+{
+    const double original = pixpersec;
+    while (analysis_memory(samples, samplerate) > budget)
+    {
+        if (pixpersec <= 1)
+        {
+            pixpersec = original;
+            return false;
+        }
+        pixpersec = std::max(1.0, pixpersec/2);
+    }
+    return true;
+}
+
+real_vec SpectrogramEngine::synthetize(const intensity_matrix& data,
+        int samplerate, SynthesisType type, ProgressListener* listener,
+        const CancelToken* cancel) const
+{
+    switch (type)
+    {
+        case SYNTHESIS_SINE:
+            return sine_synthesis(data, samplerate, listener, cancel);
+        case SYNTHESIS_NOISE:
+            return noise_synthesis(data, samplerate, listener, cancel);
+    }
+    assert(false);
+}
+
+real_vec SpectrogramEngine::sine_synthesis(const intensity_matrix& data,
+        int samplerate, ProgressListener* listener,
+        const CancelToken* cancel) const
+{
+    ScopedTimer timer("synthesis.sine");
+    const int height = data.size();
+    const size_t samples = data[0].size()*samplerate/pixpersec;
+    complex_vec spectrum(samples/2+1);
+    Profiler::allocated(spectrum.size()*sizeof(Complex));
+
+    const double filterscale = ((double)spectrum.size()*2)/samplerate;
+
+    std::unique_ptr<Filterbank> filterbank = Filterbank::get_filterbank(
+            frequency_axis, filterscale, basefreq, bandwidth, overlap);
+
+    // every band has the same width
+    const size_t band_samples = data[0].size()*2;
+    const size_t band_bins = padded_length(band_samples)/2+1;
+    ScratchArena& scratch = ScratchArena::local();
+    ScratchArena::Frame job(scratch);
+    scratch.reserve(ScratchArena::bytes<float>(band_samples) +
+            ScratchArena::bytes<Complex>(band_bins) +
+            ScratchArena::bytes<float>(padded_length(band_samples)));
+
+    ProgressCounter counter(height);
+    {
+        ProgressReporter reporter(listener, counter, "bands");
+        for (int bandidx = 0; bandidx < height; ++bandidx)
+        {
+            if (cancelled(cancel))
+                return real_vec();
+
+            ScopedTimer band_timer("synthesis.band");
+            const real_vec& envelope = data[bandidx];
+            assert(envelope.size()*2 == band_samples);
+
+            // random phase between +-pi
+            const double phase = (2*random_double()-1) * PI; 
+
+            ScratchArena::Frame frame(scratch);
+            float* bandsignal = frame.take<float>(band_samples);
+            sine_carrier(envelope.data(), envelope.size(), phase, bandsignal);
+            Complex* filterband = frame.take<Complex>(band_bins);
+            padded_FFT(bandsignal, band_samples, filterband);
+
+            for (size_t i = 0; i < band_bins; ++i)
+            {
+                const double x = (double)i/(band_bins-1);
+                // normalized blackman window antiderivative
+                filterband[i] *= x - ((0.5/(2.0*PI))*sin(2.0*PI*x) +
+                       (0.08/(4.0*PI))*sin(4.0*PI*x)/0.42);
+            }
+
+            //std::cout << "spectrum size: " << spectrum.size() << "\n";
+            //std::cout << bandidx << ". filterband size: " << band_bins << "; start: " << filterbank->get_band(bandidx).first <<"; end: " << filterbank->get_band(bandidx).second << "\n";
+
+            const size_t center = filterbank->get_center(bandidx);
+            const size_t offset = std::max((size_t)0, center - band_bins/2);
+            //std::cout << "offset: " <<offset<<" = "<<offset/filterscale<<" hz\n";
+            for (size_t i = 0; i < band_bins; ++i)
+                if (offset+i > 0 && offset+i < spectrum.size())
+                    spectrum[offset+i] += filterband[i];
+            counter.advance();
+        }
+    }
+
+    real_vec out = padded_IFFT(spectrum, cancel);
+    if (cancelled(cancel))
+        return real_vec();
+    //std::cout << "samples: " << out.size() << " -> " << samples << "\n";
+    normalize_signal(out);
+    return out;
+}
+
+real_vec SpectrogramEngine::noise_synthesis(const intensity_matrix& data,
+        int samplerate, ProgressListener* listener,
+        const CancelToken* cancel) const
+{
+    ScopedTimer timer("synthesis.noise");
+    const int height = data.size();
+    size_t samples = data[0].size()*samplerate/pixpersec;
+
+    complex_vec noise = get_pink_noise(samplerate*10); // 10 sec loop
+
+    const double filterscale = ((double)noise.size()*2)/samplerate;
+    std::unique_ptr<Filterbank> filterbank = Filterbank::get_filterbank(
+            frequency_axis, filterscale, basefreq, bandwidth, overlap);
+
+    const int top_index = maxfreq*filterscale;
+
+    real_vec out(samples);
+    Profiler::allocated(samples*sizeof(float));
+
+    const size_t noise_samples = padded_length((noise.size()-1)*2);
+    ScratchArena& scratch = ScratchArena::local();
+    ScratchArena::Frame job(scratch);
+    scratch.reserve(ScratchArena::bytes<Complex>(noise_samples/2+1) +
+            ScratchArena::bytes<float>(noise_samples) +
+            ScratchArena::bytes<float>(samples));
+
+    ProgressCounter counter(height);
+    {
+        ProgressReporter reporter(listener, counter, "bands");
+        for (int bandidx = 0; bandidx < height; ++bandidx)
+        {
+            if (cancelled(cancel))
+                return real_vec();
+
+            ScopedTimer band_timer("synthesis.band");
+            // filter noise
+            intpair range = filterbank->get_band(bandidx);
+            //std::cout << bandidx << "/"<<height<<"\n";
+            //std::cout << "(noise) vzorku: "<<range.second-range.first<<"\n";
+
+            ScratchArena::Frame frame(scratch);
+            Complex* filtered_noise = frame.take<Complex>(noise_samples/2+1);
+            const int end = std::max(range.first,
+                    std::min(range.second, top_index));
+            std::fill(filtered_noise, filtered_noise+noise.size(),
+                    Complex(0, 0));
+            std::copy(noise.begin()+range.first, noise.begin()+end,
+                    filtered_noise+range.first);
+
+            //window_coefs(range.first, range.second, filterscale, ...);
+
+            // ifft noise
+            float* noise_mod = frame.take<float>(noise_samples);
+            padded_IFFT(filtered_noise, noise.size(), noise_mod);
+            // resample spectrogram band
+            float* envelope = frame.take<float>(samples);
+            if (!resample(&data[bandidx][0], data[bandidx].size(), envelope,
+                        samples, cancel))
+                return real_vec();
+            // modulate with looped noise
+            modulate_noise(envelope, noise_mod, noise_samples, &out[0],
+                    samples, cancel);
+            counter.advance();
+        }
+    }
+    if (cancelled(cancel))
+        return real_vec();
+    normalize_signal(out);
+    return out;
+}
+
+std::string SpectrogramEngine::serialize() const
+{
+    std::ostringstream desc;
+    desc << std::fixed << std::setprecision(4);
+    desc << "Spectrogram:" << delimiter
+        << bandwidth << delimiter
+        << basefreq << delimiter
+        << maxfreq << delimiter
+        << overlap*100 << delimiter
+        << pixpersec << delimiter
+        << (int)window << delimiter
+        << (int)intensity_axis << delimiter
+        << (int)frequency_axis << delimiter
+        << (int)method << delimiter
+        ;
+    //std::cout << "serialized: " << desc.str() << "\n";
+    return desc.str();
+}
+
+bool SpectrogramEngine::deserialize(const std::string& text)
+{
+    std::vector<std::string> tokens;
+    std::istringstream desc(text);
+    std::string token;
+    while (std::getline(desc, token, delimiter))
+        tokens.push_back(token);
+    if (tokens.size() < 9 || tokens[0] != "Spectrogram:")
+        return false;
+
+    bandwidth = std::atof(tokens[1].c_str());
+    basefreq = std::atof(tokens[2].c_str());
+    maxfreq = std::atof(tokens[3].c_str());
+    overlap = std::atof(tokens[4].c_str())/100.0;
+    pixpersec = std::atof(tokens[5].c_str());
+    window = (Window)std::atoi(tokens[6].c_str());
+    intensity_axis = (AxisScale)std::atoi(tokens[7].c_str());
+    frequency_axis = (AxisScale)std::atoi(tokens[8].c_str());
+    // saved before the STFT existed
+    method = tokens.size() > 9 ?
+        (AnalysisMethod)std::atoi(tokens[9].c_str()) : ANALYSIS_FILTERBANK;
+    return true;
+}
@@ -0,0 +1,163 @@
+#ifndef ENGINE_HPP
+#define ENGINE_HPP
+
+/** \file engine.hpp
+ *  \brief The spectrogram analysis and synthesis engine.
+ *
+ *  This is the core of the program, it only depends on the standard library,
+ *  libsamplerate and optionally FFTW.  Results are plain float or pixel
+ *  buffers, progress is reported through a ProgressListener and
+ *  cancellation is requested through a CancelToken.
+ */
+
+#include <string>
+#include <vector>
+#include <memory>
+#include "types.hpp"
+#include "palette.hpp"
+#include "cancel.hpp"
+
+/// Receives progress reports from the engine.
+/** The functions are called from the thread performing the computation.
+ * While the bands are processed, they are called from a ProgressReporter
+ * thread instead, about 20 times per second. */
+class ProgressListener
+{
+    public:
+        virtual ~ProgressListener() {}
+        /// Reports percentual progress.
+        virtual void progress(int percent) = 0;
+        /// Reports the state of the computation.
+        virtual void status(const std::string& text) = 0;
+};
+
+/// Intensities of a spectrogram, values from <0,1>.
+/** One vector per band (a row of the image), starting with the lowest
+ * frequency, which is drawn at the bottom of the image.  All rows have the
+ * same length. */
+typedef std::vector<real_vec> intensity_matrix;
+
+/// Pixels of a spectrogram image, row by row from the top.
+/** Holds palette indexes for an indexed palette, RGB values otherwise (see
+ * Palette::indexable()). */
+struct PixelBuffer
+{
+    int width;
+    int height;
+    bool indexed;
+    std::vector<unsigned int, TrackedAllocator<unsigned int> > pixels;
+};
+
+/// The frequency-domain bands of an analysis, with window coefficients.
+/** It only depends on the parameters and the size of the spectrum, so it is
+ * computed once and shared by all analyses of signals of the same length. */
+struct BandPlan
+{
+    /// Spectrum index of the maximum frequency, the bands are cut there.
+    int top_index;
+    /// Spectrum index range of each band, starting with the lowest.
+    std::vector<intpair> ranges;
+    /// Window coefficients of each band, one for every index of its range.
+    std::vector<real_vec> windows;
+
+    /// Returns the approximate memory used by the plan.
+    size_t bytes() const;
+    /// Returns the ScratchArena bytes analyze() needs for one band.
+    size_t scratch_bytes() const;
+};
+
+/// This class holds the parameters for a spectrogram and implements its synthesis and generation.
+class SpectrogramEngine
+{
+    public:
+        SpectrogramEngine(); // defaults
+        /// Changes whenever the engine starts producing different results.
+        /** It is a part of the keys of cached spectrograms. */
+        static const int version = 3;
+        /// Computes the band intensities of the given signal.
+        /** The signal isn't modified or copied, it can be memory-mapped.
+         * \param cancel Interrupts the computation, may be null.
+         * \return Empty data if the computation was cancelled. */
+        intensity_matrix analyze(const float* signal, size_t samples,
+                int samplerate, ProgressListener* listener = 0,
+                const CancelToken* cancel = 0) const;
+        /// Like analyze(), but the intensities aren't normalized.
+        /** Their scale depends on the method and the padded length, so only
+         * analyses of signals of the same length compare, see ShardPlan. */
+        intensity_matrix analyze_raw(const float* signal, size_t samples,
+                int samplerate, ProgressListener* listener = 0,
+                const CancelToken* cancel = 0) const;
+        /// Draws the intensities using the palette.
+        PixelBuffer render(const intensity_matrix& data) const;
+        /// Returns the pixel value (index or RGB) for an analyzed intensity.
+        unsigned int pixel(float intensity) const;
+        /// Returns the intensity (from <0,1>) represented by a pixel color.
+        /** This is the inverse of pixel(), except for the brightness
+         * correction. */
+        float intensity(rgb_t color) const;
+        /// Synthesizes the given spectrogram intensities to sound.
+        /** \return An empty vector if the computation was cancelled. */
+        real_vec synthetize(const intensity_matrix& data, int samplerate,
+                SynthesisType type, ProgressListener* listener = 0,
+                const CancelToken* cancel = 0) const;
+        /// Estimates the peak memory of analyze() and render() in bytes.
+        /** The signal itself isn't included, it belongs to the caller. */
+        size_t analysis_memory(size_t samples, int samplerate) const;
+        /// Lowers the time resolution until the analysis fits in the budget.
+        /** pixpersec is halved while analysis_memory() exceeds the budget.
+         * \return false if the analysis doesn't fit at any resolution, the
+         * parameters are unchanged then. */
+        bool fit_memory(size_t samples, int samplerate, size_t budget);
+        /// Serializes the parameters.
+        /** The serialized string is saved in image metadata to indicate parameters with which the spectrogram has been generated.  */
+        std::string serialize() const;
+        /// Loads serialized parameters.
+        /** \return false if the text isn't valid, nothing is changed then. */
+        bool deserialize(const std::string& text);
+
+        /// Bandwidth of the frequency-domain filters.
+        /** In Hz for linear spectrograms, in cents (cent = octave/1200) for logarithmic spectrograms.*/
+        double bandwidth;
+        /// Base frequency of the spectrogram.
+        double basefreq;
+        /// Maximum frequency of the spectrogram.
+        double maxfreq;
+        /// Overlap of the frequency-domain filters, 1 = full overlap (useless), 0 = no overlap.
+        double overlap;
+        /// Time resolution of the spectrogram, pixels per second.
+        double pixpersec;
+        /// Window function used on the frequency-domain intervals.
+        Window window;
+        /// Scale type of the intensity axis (linear or logarithmic)
+        AxisScale intensity_axis;
+        /// Scale type of the frequency axis (linear or logarithmic)
+        AxisScale frequency_axis;
+        /// Brightness correction used in generation of the spectrogram.
+        BrightCorrection correction;
+        /// How analyze() computes the intensities.
+        AnalysisMethod method;
+        /// Palette used for drawing the spectrogram.
+        Palette palette;
+    private:
+        /// Computes the intensities with an StftAnalysis.
+        intensity_matrix stft_analysis(const float* signal, size_t samples,
+                double rate, ProgressListener* listener,
+                const CancelToken* cancel) const;
+        /// Computes the intensities with a ConstantQAnalysis.
+        intensity_matrix cqt_analysis(const float* signal, size_t samples,
+                double rate, ProgressListener* listener,
+                const CancelToken* cancel) const;
+        /// Performs sine synthesis on the given spectrogram.
+        real_vec sine_synthesis(const intensity_matrix& data, int samplerate,
+                ProgressListener* listener, const CancelToken* cancel) const;
+        /// Performs noise synthesis on the given spectrogram.
+        real_vec noise_synthesis(const intensity_matrix& data, int samplerate,
+                ProgressListener* listener, const CancelToken* cancel) const;
+        /// Returns the (possibly cached) bands for a spectrum of the given size.
+        std::shared_ptr<const BandPlan> band_plan(size_t spectrum_size,
+                double rate) const;
+        /// Delimiter of the serialized data
+        static const char delimiter = ';';
+};
+
+#endif
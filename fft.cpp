@@ -1,61 +1,516 @@
 #include "fft.hpp"
+#include "instrument.hpp"
+#include "scratch.hpp"
 #include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
 
 namespace
 {
-    /// Returns 1 if x is only made of small primes.
-    int smallprimes(int x)
+    /// Returns 1 if x is only made of 2, 3 and 5.
+    size_t smallprimes(size_t x)
     {
-        int p[3] = {2, 3, 5};
+        const size_t p[3] = {2, 3, 5};
         for (int i = 0; i < 3; ++i)
             while (x%p[i] == 0)
                 x /= p[i];
         return x;
     }
 
-    /// Returns the next integer only made of small primes.
-    int padded_size(int x)
+    /// Returns the next integer only made of 2, 3 and 5.
+    size_t padded_size(size_t x)
     {
         while (smallprimes(x)!=1)
             x++;
 
         return x;
     }
+
+    /// Backend, kind, size, batch and whether the plan needs aligned arrays.
+    typedef std::tuple<const FFTBackend*, FFTKind, size_t, size_t, bool>
+        plan_key;
+
+    struct CachedPlan
+    {
+        fft_plan_ptr plan;
+        unsigned long last_use;
+    };
+
+    /// Guards the plan cache.
+    std::mutex plans_mutex;
+    /// Plans kept for reuse, so long running processes don't plan again.
+    std::map<plan_key, CachedPlan> plans;
+    unsigned long plan_uses = 0;
+    const size_t max_cached_plans = 64;
+
+    /// Returns true if aligned plans of the backend can use both arrays.
+    bool simd_aligned(const FFTBackend& backend, const void* real,
+            const void* complex)
+    {
+        return backend.aligned(real) && backend.aligned(complex);
+    }
+
+    /// Returns a plan of the backend from the cache.
+    /** Plans in use stay valid even if they are dropped from the cache in
+     * the meantime. */
+    fft_plan_ptr get_plan(FFTBackend& backend, FFTKind kind, size_t n,
+            size_t howmany, bool aligned)
+    {
+        fft_plan_ptr evicted; // destroyed after unlocking
+        std::lock_guard<std::mutex> lock(plans_mutex);
+        const plan_key key(&backend, kind, n, howmany, aligned);
+        std::map<plan_key, CachedPlan>::iterator it = plans.find(key);
+        if (it != plans.end())
+        {
+            it->second.last_use = ++plan_uses;
+            return it->second.plan;
+        }
+
+        CachedPlan cached = {fft_plan_ptr(backend.plan(kind, n, howmany,
+                    aligned ? FFTBackend::ALIGNED : 0)), ++plan_uses};
+        assert(cached.plan);
+
+        if (plans.size() >= max_cached_plans)
+        {
+            std::map<plan_key, CachedPlan>::iterator oldest = plans.begin();
+            for (it = plans.begin(); it != plans.end(); ++it)
+                if (it->second.last_use < oldest->second.last_use)
+                    oldest = it;
+            evicted = oldest->second.plan;
+            plans.erase(oldest);
+        }
+        plans[key] = cached;
+        return cached.plan;
+    }
+
+    /// Cancellable transforms at least this long are split.
+    const size_t split_length = 1 << 21;
+
+    /// Returns the number of sub-transforms a transform is split into.
+    size_t split_factor(size_t padded)
+    {
+        const size_t factors[] = {4, 3, 5, 2, 7, 11};
+        for (size_t i = 0; i < sizeof(factors)/sizeof(factors[0]); ++i)
+            if (padded%factors[i] == 0)
+                return factors[i];
+        return 1;
+    }
+
+    /// Radices the transform lengths are made of.
+    const size_t radices[] = {2, 3, 5, 7, 11};
+    const int radix_count = sizeof(radices)/sizeof(radices[0]);
+
+    /// Cost of a pass of each radix per sample, relative to radix 2.
+    /** A length m = 2^a 3^b ... costs m (a c_2 + b c_3 + ...).  The
+     * defaults are log2 of the radix with a penalty for the radices
+     * FFTW has fewer codelets for, calibrate_fft() measures them. */
+    struct CostTable
+    {
+        double radix[radix_count];
+    };
+    const CostTable default_costs = {{1.0, 1.74, 2.67, 3.51, 4.84}};
+
+    const char* const cost_header = "spectrogram fft costs 2";
+
+    /// Guards the cost table and the planned lengths.
+    std::mutex costs_mutex;
+    CostTable costs = default_costs;
+    bool costs_loaded = false;
+    /// Whether the costs were measured on the machine, not the defaults.
+    bool costs_measured = false;
+    /// Lengths chosen so far, n -> padded length.
+    std::map<size_t, size_t> planned_lengths;
+    const size_t max_planned_lengths = 4096;
+
+    bool load_costs(const std::string& filename);
+
+    /// Loads $SPECTROGRAM_FFT_WISDOM the first time costs are needed.
+    void ensure_costs(std::unique_lock<std::mutex>& lock)
+    {
+        if (costs_loaded)
+            return;
+        costs_loaded = true;
+        const char* filename = std::getenv("SPECTROGRAM_FFT_WISDOM");
+        if (!filename || !*filename)
+            return;
+        lock.unlock();
+        load_costs(filename);
+        lock.lock();
+    }
+
+    /// Returns the cost of a length made of the radices, 0 otherwise.
+    double transform_cost(size_t m, const CostTable& table)
+    {
+        double cost = 0;
+        for (int i = 0; i < radix_count; ++i)
+            for (; m%radices[i] == 0; m /= radices[i])
+                cost += table.radix[i];
+        return m == 1 ? cost : 0;
+    }
+
+    /// Returns the cheapest length made of the radices from <n,limit>.
+    /** limit has to be made of the radices. */
+    size_t cheapest_length(size_t n, size_t limit, const CostTable& table)
+    {
+        size_t best = limit;
+        double best_cost = limit*transform_cost(limit, table);
+        // every q made of the odd radices, times the smallest power of two
+        // that reaches n
+        for (size_t q11 = 1; q11 <= limit; q11 *= 11)
+            for (size_t q7 = q11; q7 <= limit; q7 *= 7)
+                for (size_t q5 = q7; q5 <= limit; q5 *= 5)
+                    for (size_t q3 = q5; q3 <= limit; q3 *= 3)
+                    {
+                        size_t m = q3;
+                        while (m < n)
+                            m *= 2;
+                        if (m > limit)
+                            continue;
+                        const double cost = m*transform_cost(m, table);
+                        if (cost < best_cost ||
+                                (cost == best_cost && m < best))
+                        {
+                            best = m;
+                            best_cost = cost;
+                        }
+                    }
+        return best;
+    }
+
+    /// Returns the fastest time of a transform of length m in seconds.
+    /** The plan is measured, which leaves its wisdom to the backend. */
+    double time_transform(FFTBackend& backend, size_t m)
+    {
+        std::unique_ptr<FFTPlan> plan(backend.plan(FFT_R2C, m, 1,
+                    FFTBackend::ALIGNED | FFTBackend::MEASURE));
+        float* real = static_cast<float*>(fft_malloc(m*sizeof(float)));
+        Complex* complex = static_cast<Complex*>(
+                fft_malloc((m/2+1)*sizeof(Complex)));
+        std::fill(real, real+m, 0.0f);
+        real[1] = 1;
+        double best = 1e9;
+        double total = 0;
+        for (int run = 0; run < 1000 && (run < 5 || total < 0.05); ++run)
+        {
+            const std::chrono::steady_clock::time_point start =
+                std::chrono::steady_clock::now();
+            plan->r2c(real, complex);
+            const double time = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - start).count();
+            best = std::min(best, time);
+            total += time;
+        }
+        fft_free(complex);
+        fft_free(real);
+        return best;
+    }
+
+    bool load_costs(const std::string& filename)
+    {
+        std::ifstream file(filename.c_str());
+        std::string header;
+        CostTable table;
+        std::string name;
+        if (!std::getline(file, header) || header != cost_header ||
+                !std::getline(file, name))
+            return false;
+        FFTBackend* backend = find_fft_backend(name);
+        if (!backend)
+            return false;
+        for (int i = 0; i < radix_count; ++i)
+            if (!(file >> table.radix[i]) || table.radix[i] <= 0)
+                return false;
+        file >> std::ws;
+        const std::string wisdom((std::istreambuf_iterator<char>(file)),
+                std::istreambuf_iterator<char>());
+        if (!wisdom.empty() && !backend->import_wisdom(wisdom))
+            return false;
+        std::lock_guard<std::mutex> lock(costs_mutex);
+        costs = table;
+        costs_loaded = true;
+        costs_measured = true;
+        planned_lengths.clear();
+        return true;
+    }
+
+    /// Walks through the powers of exp(i*step) without a sin() per step.
+    /** The value is computed exactly every 1024 steps, so the rounding
+     * errors of the multiplications don't accumulate. */
+    class Twiddle
+    {
+        public:
+            explicit Twiddle(double step)
+                : angle_(step)
+                , index_(0)
+                , step_(std::polar(1.0, step))
+                , value_(1)
+            {
+            }
+            const std::complex<double>& value() const
+            {
+                return value_;
+            }
+            void next()
+            {
+                if ((++index_ & 1023) == 0)
+                    value_ = std::polar(1.0, angle_*index_);
+                else
+                    value_ *= step_;
+            }
+        private:
+            double angle_;
+            size_t index_;
+            std::complex<double> step_;
+            std::complex<double> value_;
+    };
+
+    /// Forward transform as k transforms of the samples i == r (mod k).
+    /** This is one decimation in time step of the Cooley-Tukey algorithm,
+     * the token is checked between the sub-transforms and while they are
+     * combined.  The combination costs about as much as log2(k) radix-2
+     * passes. */
+    complex_vec split_FFT(const float* in, size_t n, size_t padded,
+            size_t k, const CancelToken* cancel)
+    {
+        const size_t m = padded/k;
+        const size_t half = m/2+1;
+        complex_vec spectra(k*half);
+        real_vec part(m);
+        const fft_plan_ptr plan = fft_plan(FFT_R2C, m);
+        for (size_t r = 0; r < k; ++r)
+        {
+            if (cancelled(cancel))
+                return complex_vec();
+            for (size_t q = 0, i = r; q < m; ++q, i += k)
+                part[q] = i < n ? in[i] : 0;
+            plan->r2c(&part[0], &spectra[r*half]);
+        }
+        part = real_vec();
+
+        // X[j] = sum of exp(-2 pi i r j/padded) Y_r[j mod m]
+        complex_vec out(padded/2+1);
+        Twiddle twiddle(-2*PI/padded);
+        for (size_t j = 0, l = 0; j < out.size(); ++j, twiddle.next())
+        {
+            if (cancelled(cancel, j))
+                return complex_vec();
+            const bool mirrored = l > m/2;
+            const size_t index = mirrored ? m-l : l;
+            std::complex<double> sum = 0;
+            std::complex<double> rotation = 1;
+            for (size_t r = 0; r < k; ++r)
+            {
+                const Complex y = spectra[r*half+index];
+                sum += rotation*std::complex<double>(y.real(),
+                        mirrored ? -y.imag() : y.imag());
+                rotation *= twiddle.value();
+            }
+            out[j] = Complex(sum.real(), sum.imag());
+            if (++l == m)
+                l = 0;
+        }
+        return out;
+    }
+
+    /// Inverse transform as k transforms giving the samples i == r (mod k).
+    /** The decimation in time counterpart of split_FFT(), the input holds
+     * padded/2+1 values. */
+    bool split_IFFT(const Complex* in, size_t padded, size_t k, float* out,
+            const CancelToken* cancel)
+    {
+        const size_t m = padded/k;
+        const size_t size = padded/2+1;
+        complex_vec z(m/2+1);
+        real_vec part(m);
+        const fft_plan_ptr plan = fft_plan(FFT_C2R, m);
+        for (size_t r = 0; r < k; ++r)
+        {
+            if (cancelled(cancel))
+                return false;
+            std::vector<std::complex<double> > roots(k);
+            for (size_t s = 0; s < k; ++s)
+                roots[s] = std::polar(1.0, 2*PI*r*s/k);
+
+            // Z_r[l] = exp(2 pi i r l/padded) sum of X[l+m s] exp(2 pi i r s/k)
+            Twiddle twiddle(2*PI*r/padded);
+            for (size_t l = 0; l < z.size(); ++l, twiddle.next())
+            {
+                if (cancelled(cancel, l))
+                    return false;
+                std::complex<double> sum = 0;
+                for (size_t s = 0; s < k; ++s)
+                {
+                    const size_t j = l+m*s;
+                    const Complex x = j < size ? in[j] :
+                        std::conj(in[padded-j]);
+                    sum += roots[s]*std::complex<double>(x.real(), x.imag());
+                }
+                sum *= twiddle.value();
+                z[l] = Complex(sum.real(), sum.imag());
+            }
+            plan->c2r(&z[0], &part[0]);
+            for (size_t q = 0, i = r; q < m; ++q, i += k)
+                out[i] = part[q];
+        }
+        return true;
+    }
 }
 
-complex_vec padded_FFT(real_vec& in)
+fft_plan_ptr fft_plan(FFTKind kind, size_t n, size_t howmany, bool aligned)
 {
-    assert(in.size() > 0);
-    const size_t n = in.size();
-    const size_t padded = n > 256 ? padded_size(n) : n;
-    in.resize(padded);
+    return get_plan(fft_backend(), kind, n, howmany, aligned);
+}
+
+size_t padded_length(size_t n)
+{
+    if (n < 2)
+        return n;
+    std::unique_lock<std::mutex> lock(costs_mutex);
+    ensure_costs(lock);
+    std::map<size_t, size_t>::iterator it = planned_lengths.find(n);
+    if (it != planned_lengths.end())
+        return it->second;
+    // lengths made of the radices are kept, unless the measured costs make
+    // a longer one cheaper
+    const size_t length = !costs_measured && transform_cost(n, costs) > 0 ?
+        n : cheapest_length(n, padded_size(n), costs);
+    if (planned_lengths.size() >= max_planned_lengths)
+        planned_lengths.clear();
+    planned_lengths[n] = length;
+    return length;
+}
+
+bool load_fft_wisdom(const std::string& filename)
+{
+    return load_costs(filename);
+}
+
+bool calibrate_fft(const std::string& filename)
+{
+    // transforms of about 2^16 samples, where FFTW is past the small size
+    // special cases and the data still fits in the cache
+    const size_t reference = 1 << 16;
+    FFTBackend& backend = fft_backend();
+    CostTable table;
+    const double radix2 = time_transform(backend, reference)/
+        (reference*16);
+    table.radix[0] = 1;
+    for (int i = 1; i < radix_count; ++i)
+    {
+        // at least 64 of the radix, the rest made of twos
+        size_t m = 1;
+        int passes = 0;
+        for (; m < 64; m *= radices[i])
+            ++passes;
+        int twos = 0;
+        for (; m*2 <= reference; m *= 2)
+            ++twos;
+        const double pass = (time_transform(backend, m)/m - twos*radix2)/
+            passes;
+        // a timer too coarse for the transforms
+        table.radix[i] = radix2 > 0 ? std::max(pass/radix2, 1.0) :
+            default_costs.radix[i];
+    }
+
+    const std::string wisdom = backend.export_wisdom();
+    {
+        std::lock_guard<std::mutex> lock(costs_mutex);
+        costs = table;
+        costs_loaded = true;
+        costs_measured = true;
+        planned_lengths.clear();
+    }
+
+    std::ofstream file(filename.c_str());
+    file << cost_header << "\n" << backend.name() << "\n";
+    for (int i = 0; i < radix_count; ++i)
+        file << table.radix[i] << (i+1 < radix_count ? " " : "\n");
+    file << wisdom;
+    return (bool)file;
+}
+
+complex_vec padded_FFT(const float* in, size_t n, const CancelToken* cancel)
+{
+    assert(n > 0);
+    ScopedTimer timer("fft");
+    const size_t padded = padded_length(n);
+    Profiler::fft(n, padded);
+    Profiler::allocated(padded*sizeof(float) + (padded/2+1)*sizeof(Complex));
+    if (cancel && padded >= split_length)
+        return split_FFT(in, n, padded, split_factor(padded), cancel);
+    real_vec input(padded);
+    std::copy(in, in+n, input.begin());
 
     complex_vec out(padded/2+1);
 
-    fftwf_plan plan = fftwf_plan_dft_r2c_1d(padded,
-            &in[0], (fftwf_complex*)&out[0], FFTW_ESTIMATE);
-    fftwf_execute(plan);
-    fftwf_destroy_plan(plan);
+    FFTBackend& backend = fft_backend();
+    const fft_plan_ptr plan = get_plan(backend, FFT_R2C, padded, 1,
+            simd_aligned(backend, &input[0], &out[0]));
+    plan->r2c(&input[0], &out[0]);
 
-    in.resize(n);
     return out;
 }
 
-real_vec padded_IFFT(complex_vec& in)
+complex_vec padded_FFT(const real_vec& in, const CancelToken* cancel)
+{
+    assert(in.size() > 0);
+    return padded_FFT(&in[0], in.size(), cancel);
+}
+
+void padded_FFT(const float* in, size_t n, Complex* out)
+{
+    assert(n > 0);
+    ScopedTimer timer("fft");
+    const size_t padded = padded_length(n);
+    Profiler::fft(n, padded);
+    ScratchArena::Frame frame;
+    float* input = frame.take<float>(padded);
+    std::copy(in, in+n, input);
+    std::fill(input+n, input+padded, 0.0f);
+
+    FFTBackend& backend = fft_backend();
+    const fft_plan_ptr plan = get_plan(backend, FFT_R2C, padded, 1,
+            simd_aligned(backend, input, out));
+    plan->r2c(input, out);
+}
+
+real_vec padded_IFFT(complex_vec& in, const CancelToken* cancel)
 {
     assert(in.size() > 1);
-    const size_t n = (in.size()-1)*2;
-    const size_t padded = n > 256 ? padded_size(n) : n;
+    const size_t size = in.size();
+    const size_t padded = padded_length((size-1)*2);
+    Profiler::allocated(padded*sizeof(float));
     in.resize(padded/2+1);
-
     real_vec out(padded);
+    const bool done = padded_IFFT(&in[0], size, &out[0], cancel);
+    in.resize(size);
+    return done ? out : real_vec();
+}
 
-    // note: fftw3 destroys the input array for c2r transform
-    fftwf_plan plan = fftwf_plan_dft_c2r_1d(padded,
-            (fftwf_complex*)&in[0], &out[0], FFTW_ESTIMATE);
-    fftwf_execute(plan);
-    fftwf_destroy_plan(plan);
+bool padded_IFFT(Complex* in, size_t size, float* out,
+        const CancelToken* cancel)
+{
+    assert(size > 1);
+    ScopedTimer timer("ifft");
+    const size_t n = (size-1)*2;
+    const size_t padded = padded_length(n);
+    Profiler::fft(n, padded);
+    std::fill(in+size, in+padded/2+1, Complex(0, 0));
+    if (cancel && padded >= split_length)
+        return split_IFFT(in, padded, split_factor(padded), out, cancel);
 
-    in.resize(n/2+1);
-    return out;
+    // note: c2r transforms destroy their input
+    FFTBackend& backend = fft_backend();
+    const fft_plan_ptr plan = get_plan(backend, FFT_C2R, padded, 1,
+            simd_aligned(backend, out, in));
+    plan->c2r(in, out);
+    return true;
 }
@@ -4,19 +4,78 @@
 /** \file fft.hpp
  * \brief Contains utility functions for performing the fast fourier transform and its inverse.
  *
- * It uses the FFTW3 library to perform the transforms.  For better performance, the functions temporarily change the size of the input vector by padding it with zeros to a size that can be expressed as a product of small primes, that is 2^x * 3^y * 5^z.
+ * The transforms are done by the FFTBackend in use, see fftbackend.hpp.  For better performance, the functions temporarily change the size of the input vector by padding it with zeros to a size that can be expressed as a product of small primes, that is 2^a * 3^b * 5^c * 7^d * 11^e.
+ *
+ * padded_length() keeps sizes that are such products already.  Others
+ * are padded to the cheapest such size that isn't longer than the next
+ * 2^a * 3^b * 5^c, using the cost of a pass of each radix.  The costs can
+ * be measured on the machine with calibrate_fft(), which saves them with
+ * the wisdom of the backend's measured plans.  Processes load that file
+ * from the \c SPECTROGRAM_FFT_WISDOM environment variable, or when
+ * load_fft_wisdom() is called.  With measured costs, a longer size is also
+ * chosen for a product if it is cheaper, so the padded sizes, and the width
+ * of spectrograms, depend on the file.
+ *
+ * Plans are cached and reused by later transforms of the same size, which
+ * pays off in long running processes.  The functions can be called from
+ * several threads at once.
+ *
+ * The variants that write to the caller's buffers don't allocate, when the
+ * buffers come from a ScratchArena, FFTW can also use its aligned SIMD code.
+ * The pocket backend takes its work buffers from the ScratchArena too.
+ *
+ * Transforms of millions of samples take seconds.  When they are given a
+ * CancelToken, they are split into a few shorter transforms, so that the
+ * token can be checked in between.
  */
 
 #include <vector>
 #include <complex>
-#include <fftw3.h>
+#include <memory>
+#include <string>
 #include "types.hpp"
+#include "fftbackend.hpp"
+#include "cancel.hpp"
 
+/// A plan shared with the plan cache.
+typedef std::shared_ptr<const FFTPlan> fft_plan_ptr;
+/// Returns a cached plan of the backend in use.
+/** Unless aligned is set, the plan can be executed on any arrays,
+ * otherwise only on arrays for which FFTBackend::aligned() holds. */
+fft_plan_ptr fft_plan(FFTKind kind, size_t n, size_t howmany = 1,
+        bool aligned = false);
 /// Performs a fast fourier transform.
-/** The input vector is padded with zeros for better performance and shrunk again to original size when the transform is done. */
-complex_vec padded_FFT(real_vec& in);
+/** The input is copied to a buffer padded with zeros for better performance, it isn't modified.
+ * \return An empty vector if the token was cancelled. */
+complex_vec padded_FFT(const float* in, size_t n,
+        const CancelToken* cancel = 0);
+/// Performs a fast fourier transform of the whole vector.
+complex_vec padded_FFT(const real_vec& in, const CancelToken* cancel = 0);
+/// Performs a fast fourier transform into the caller's buffer.
+/** The padded input is kept in the ScratchArena of the thread.
+ * \param out Room for padded_length(n)/2+1 values. */
+void padded_FFT(const float* in, size_t n, Complex* out);
 /// Performs a fast inverse fourier transform.
-/** The input vector is destroyed in the process! */
-real_vec padded_IFFT(complex_vec& in);
+/** The input vector is destroyed in the process!
+ * \return An empty vector if the token was cancelled. */
+real_vec padded_IFFT(complex_vec& in, const CancelToken* cancel = 0);
+/// Performs a fast inverse fourier transform into the caller's buffer.
+/** \param in size values, with room for padded_length((size-1)*2)/2+1
+ * values.  The padding is zeroed and the input destroyed.
+ * \param out Room for padded_length((size-1)*2) samples.
+ * \return false if the token was cancelled. */
+bool padded_IFFT(Complex* in, size_t size, float* out,
+        const CancelToken* cancel = 0);
+/// Returns the size to which the transforms pad n samples.
+size_t padded_length(size_t n);
+/// Measures the cost of the radices and saves it with the backend's wisdom.
+/** The backend in use is measured, it takes a few seconds and the costs
+ * are used by the process right away.
+ * \return false if the file couldn't be written. */
+bool calibrate_fft(const std::string& filename);
+/// Loads the costs and the wisdom saved by calibrate_fft().
+/** The wisdom goes to the backend that was calibrated, whichever is in use.
+ * \return false if the file couldn't be read, nothing changes then. */
+bool load_fft_wisdom(const std::string& filename);
 
 #endif
@@ -0,0 +1,173 @@
+#include "fftbackend.hpp"
+#include <cstdlib>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <fftw3.h>
+
+namespace
+{
+    /// Serializes FFTW planning, only the execute functions are thread-safe.
+    std::mutex planner_mutex;
+
+#ifdef HAVE_FFTW_THREADS
+    /// Transforms shorter than this don't pay for the threads.
+    /** Batches of frames are short transforms too, whatever their total
+     * length. */
+    const size_t threaded_size = 1 << 18;
+
+    /// The threads of a transform, $SPECTROGRAM_FFT_THREADS or the cores.
+    int fft_threads()
+    {
+        const char* value = std::getenv("SPECTROGRAM_FFT_THREADS");
+        const int threads = value ? std::atoi(value) :
+            (int)std::thread::hardware_concurrency();
+        return std::max(threads, 1);
+    }
+#endif
+
+    class FFTWPlan : public FFTPlan
+    {
+        public:
+            FFTWPlan(FFTKind kind, size_t n, size_t howmany, fftwf_plan plan)
+                : FFTPlan(kind, n, howmany)
+                , plan_(plan)
+            {
+            }
+            ~FFTWPlan()
+            {
+                std::lock_guard<std::mutex> lock(planner_mutex);
+                fftwf_destroy_plan(plan_);
+            }
+            void r2c(const float* in, Complex* out) const
+            {
+                fftwf_execute_dft_r2c(plan_, const_cast<float*>(in),
+                        (fftwf_complex*)out);
+            }
+            void c2r(Complex* in, float* out) const
+            {
+                fftwf_execute_dft_c2r(plan_, (fftwf_complex*)in, out);
+            }
+            void c2c(const Complex* in, Complex* out) const
+            {
+                fftwf_execute_dft(plan_,
+                        (fftwf_complex*)const_cast<Complex*>(in),
+                        (fftwf_complex*)out);
+            }
+        private:
+            fftwf_plan plan_;
+    };
+
+    class FFTWBackend : public FFTBackend
+    {
+        public:
+            /// \param threads Threads of the transforms of whole files.
+            FFTWBackend(const char* name, int threads)
+                : name_(name)
+                , threads_(threads)
+            {
+            }
+
+            const char* name() const
+            {
+                return name_;
+            }
+
+            /// Plans on arrays of its own, FFTW only reads them to measure.
+            /** Unless the plan is ALIGNED, it is made with FFTW_UNALIGNED,
+             * so it can be executed on any arrays with the new-array
+             * execute functions. */
+            FFTPlan* plan(FFTKind kind, size_t n, size_t howmany,
+                    unsigned flags)
+            {
+                const bool real = kind == FFT_R2C || kind == FFT_C2R;
+                const size_t complex_size = real ? n/2+1 : n;
+                float* in = 0;
+                fftwf_complex* out = fftwf_alloc_complex(howmany*complex_size);
+                if (real)
+                    in = fftwf_alloc_real(howmany*n);
+                else
+                    in = (float*)fftwf_alloc_complex(howmany*n);
+
+                const unsigned planner_flags =
+                    (flags & MEASURE ? FFTW_MEASURE : FFTW_ESTIMATE) |
+                    (flags & ALIGNED ? 0 : FFTW_UNALIGNED);
+                const int size = n;
+                fftwf_plan plan = 0;
+                {
+                    std::lock_guard<std::mutex> lock(planner_mutex);
+#ifdef HAVE_FFTW_THREADS
+                    // the planner's number of threads is global
+                    fftwf_plan_with_nthreads(howmany == 1 &&
+                            n >= threaded_size ? threads_ : 1);
+#endif
+                    switch (kind)
+                    {
+                        case FFT_R2C:
+                            plan = fftwf_plan_many_dft_r2c(1, &size, howmany,
+                                    in, 0, 1, n, out, 0, 1, complex_size,
+                                    planner_flags);
+                            break;
+                        case FFT_C2R:
+                            plan = fftwf_plan_many_dft_c2r(1, &size, howmany,
+                                    out, 0, 1, complex_size, in, 0, 1, n,
+                                    planner_flags);
+                            break;
+                        case FFT_FORWARD:
+                        case FFT_INVERSE:
+                            plan = fftwf_plan_many_dft(1, &size, howmany,
+                                    (fftwf_complex*)in, 0, 1, n, out, 0, 1, n,
+                                    kind == FFT_FORWARD ? FFTW_FORWARD :
+                                    FFTW_BACKWARD, planner_flags);
+                            break;
+                    }
+                }
+                fftwf_free(out);
+                fftwf_free(in);
+                return plan ? new FFTWPlan(kind, n, howmany, plan) : 0;
+            }
+
+            bool aligned(const void* array) const
+            {
+                return fftwf_alignment_of((float*)array) == 0;
+            }
+
+            std::string export_wisdom()
+            {
+                std::lock_guard<std::mutex> lock(planner_mutex);
+                std::string wisdom;
+                char* text = fftwf_export_wisdom_to_string();
+                if (text)
+                    wisdom = text;
+                std::free(text);
+                return wisdom;
+            }
+
+            bool import_wisdom(const std::string& wisdom)
+            {
+                std::lock_guard<std::mutex> lock(planner_mutex);
+                return fftwf_import_wisdom_from_string(wisdom.c_str());
+            }
+
+        private:
+            const char* name_;
+            int threads_;
+    };
+}
+
+FFTBackend& fftw_backend()
+{
+    static FFTWBackend backend("fftw", 1);
+    return backend;
+}
+
+#ifdef HAVE_FFTW_THREADS
+FFTBackend& fftw_threads_backend()
+{
+    // before any other FFTW call, the backends are made before planning
+    static const int initialized = fftwf_init_threads();
+    static FFTWBackend backend("fftw-threads",
+            initialized ? fft_threads() : 1);
+    return backend;
+}
+#endif
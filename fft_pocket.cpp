@@ -0,0 +1,473 @@
+#include "fftbackend.hpp"
+#include "scratch.hpp"
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <memory>
+
+namespace
+{
+    /// Returns exp(sign 2 pi i j/n).
+    Complex root(int sign, size_t j, size_t n)
+    {
+        const std::complex<double> value =
+            std::polar(1.0, sign*2*PI*double(j%n)/n);
+        return Complex(value.real(), value.imag());
+    }
+
+    /// Complex product without the checks for infinities of operator*.
+    inline Complex mul(const Complex& a, const Complex& b)
+    {
+        return Complex(a.real()*b.real() - a.imag()*b.imag(),
+                a.real()*b.imag() + a.imag()*b.real());
+    }
+
+    /// Multiplies by i, or by -i for a negative sign.
+    inline Complex rotate(int sign, const Complex& x)
+    {
+        return sign > 0 ? Complex(-x.imag(), x.real()) :
+            Complex(x.imag(), -x.real());
+    }
+
+    /// Complex transform of one length, in Stockham passes.
+    /** A pass of radix r splits sequences of length l = r m, interleaved s
+     * times, into r sequences of length m:
+     *
+     *   y[q+s(r p+k)] = w^(p k) sum over j of x[q+s(p+j m)] exp(sign 2 pi i j k/r)
+     *
+     * with w = exp(sign 2 pi i/l), so no bit reversal is needed.  The
+     * twiddles of all passes take n-1 values. */
+    class ComplexFFT
+    {
+        public:
+            ComplexFFT(size_t n, int sign);
+            /// Transforms in into out.
+            /** \param work Room for n values, it mustn't overlap in or out. */
+            void run(const Complex* in, Complex* out, Complex* work) const;
+            size_t bytes() const;
+
+        private:
+            struct Pass
+            {
+                size_t radix;
+                /// Length of the sequences after the pass.
+                size_t length;
+                size_t stride;
+                /// Offset of w^(p k) for k > 0 in twiddles_.
+                size_t twiddles;
+                /// Offset of exp(sign 2 pi i j/r) in roots_.
+                size_t roots;
+            };
+
+            void radix2(const Pass& pass, const Complex* x, Complex* y) const;
+            void radix3(const Pass& pass, const Complex* x, Complex* y) const;
+            void radix4(const Pass& pass, const Complex* x, Complex* y) const;
+            void radix5(const Pass& pass, const Complex* x, Complex* y) const;
+            void generic(const Pass& pass, const Complex* x, Complex* y) const;
+
+            size_t size_;
+            int sign_;
+            std::vector<Pass> passes_;
+            complex_vec twiddles_;
+            complex_vec roots_;
+    };
+
+    ComplexFFT::ComplexFFT(size_t n, int sign)
+        : size_(n)
+        , sign_(sign)
+    {
+        std::vector<size_t> factors;
+        size_t rest = n;
+        for (; rest%4 == 0; rest /= 4)
+            factors.push_back(4);
+        for (size_t p = 2; p*p <= rest; p += p == 2 ? 1 : 2)
+            for (; rest%p == 0; rest /= p)
+                factors.push_back(p);
+        if (rest > 1)
+            factors.push_back(rest);
+
+        size_t total = 0;
+        for (size_t i = 0; i < factors.size(); ++i)
+            total += factors[i];
+        twiddles_.reserve(n);
+        roots_.reserve(total);
+
+        size_t length = n;
+        size_t stride = 1;
+        for (size_t i = 0; i < factors.size(); ++i)
+        {
+            const size_t r = factors[i];
+            Pass pass = {r, length/r, stride, twiddles_.size(),
+                roots_.size()};
+            for (size_t p = 0; p < pass.length; ++p)
+                for (size_t k = 1; k < r; ++k)
+                    twiddles_.push_back(root(sign, p*k, length));
+            if (r > 5)
+            {
+                for (size_t j = 0; j < i; ++j)
+                    if (passes_[j].radix == r)
+                        pass.roots = passes_[j].roots;
+                if (pass.roots == roots_.size())
+                    for (size_t j = 0; j < r; ++j)
+                        roots_.push_back(root(sign, j, r));
+            }
+            passes_.push_back(pass);
+            length = pass.length;
+            stride *= r;
+        }
+    }
+
+    size_t ComplexFFT::bytes() const
+    {
+        return (twiddles_.capacity() + roots_.capacity())*sizeof(Complex);
+    }
+
+    void ComplexFFT::run(const Complex* in, Complex* out, Complex* work) const
+    {
+        if (passes_.empty())
+        {
+            std::copy(in, in+size_, out);
+            return;
+        }
+        // the last pass has to write to out
+        const Complex* x = in;
+        for (size_t i = 0; i < passes_.size(); ++i)
+        {
+            const Pass& pass = passes_[i];
+            Complex* y = (passes_.size()-1-i)%2 == 0 ? out : work;
+            switch (pass.radix)
+            {
+                case 2: radix2(pass, x, y); break;
+                case 3: radix3(pass, x, y); break;
+                case 4: radix4(pass, x, y); break;
+                case 5: radix5(pass, x, y); break;
+                default: generic(pass, x, y); break;
+            }
+            x = y;
+        }
+    }
+
+    void ComplexFFT::radix2(const Pass& pass, const Complex* x,
+            Complex* y) const
+    {
+        const size_t m = pass.length;
+        const size_t s = pass.stride;
+        const Complex* w = &twiddles_[pass.twiddles];
+        for (size_t p = 0; p < m; ++p)
+        {
+            const Complex* a = x + s*p;
+            Complex* b = y + s*2*p;
+            for (size_t q = 0; q < s; ++q)
+            {
+                const Complex a0 = a[q];
+                const Complex a1 = a[q+s*m];
+                b[q] = a0 + a1;
+                b[q+s] = mul(a0 - a1, w[p]);
+            }
+        }
+    }
+
+    void ComplexFFT::radix3(const Pass& pass, const Complex* x,
+            Complex* y) const
+    {
+        const size_t m = pass.length;
+        const size_t s = pass.stride;
+        const Complex* w = &twiddles_[pass.twiddles];
+        const float sin60 = 0.86602540378443865f;
+        for (size_t p = 0; p < m; ++p)
+        {
+            const Complex* a = x + s*p;
+            Complex* b = y + s*3*p;
+            const Complex w1 = w[2*p];
+            const Complex w2 = w[2*p+1];
+            for (size_t q = 0; q < s; ++q)
+            {
+                const Complex a0 = a[q];
+                const Complex a1 = a[q+s*m];
+                const Complex a2 = a[q+2*s*m];
+                const Complex t1 = a1 + a2;
+                const Complex t2 = a0 - 0.5f*t1;
+                const Complex t3 = sin60*rotate(sign_, a1 - a2);
+                b[q] = a0 + t1;
+                b[q+s] = mul(t2 + t3, w1);
+                b[q+2*s] = mul(t2 - t3, w2);
+            }
+        }
+    }
+
+    void ComplexFFT::radix4(const Pass& pass, const Complex* x,
+            Complex* y) const
+    {
+        const size_t m = pass.length;
+        const size_t s = pass.stride;
+        const Complex* w = &twiddles_[pass.twiddles];
+        for (size_t p = 0; p < m; ++p)
+        {
+            const Complex* a = x + s*p;
+            Complex* b = y + s*4*p;
+            const Complex w1 = w[3*p];
+            const Complex w2 = w[3*p+1];
+            const Complex w3 = w[3*p+2];
+            for (size_t q = 0; q < s; ++q)
+            {
+                const Complex a0 = a[q];
+                const Complex a1 = a[q+s*m];
+                const Complex a2 = a[q+2*s*m];
+                const Complex a3 = a[q+3*s*m];
+                const Complex t0 = a0 + a2;
+                const Complex t1 = a0 - a2;
+                const Complex t2 = a1 + a3;
+                const Complex t3 = rotate(sign_, a1 - a3);
+                b[q] = t0 + t2;
+                b[q+s] = mul(t1 + t3, w1);
+                b[q+2*s] = mul(t0 - t2, w2);
+                b[q+3*s] = mul(t1 - t3, w3);
+            }
+        }
+    }
+
+    void ComplexFFT::radix5(const Pass& pass, const Complex* x,
+            Complex* y) const
+    {
+        const size_t m = pass.length;
+        const size_t s = pass.stride;
+        const Complex* w = &twiddles_[pass.twiddles];
+        // cos and sin of 2 pi/5 and 4 pi/5
+        const float c1 = 0.30901699437494742f;
+        const float c2 = -0.80901699437494742f;
+        const float s1 = 0.95105651629515357f;
+        const float s2 = 0.58778525229247313f;
+        for (size_t p = 0; p < m; ++p)
+        {
+            const Complex* a = x + s*p;
+            Complex* b = y + s*5*p;
+            const Complex* wp = w + 4*p;
+            for (size_t q = 0; q < s; ++q)
+            {
+                const Complex a0 = a[q];
+                const Complex a1 = a[q+s*m];
+                const Complex a2 = a[q+2*s*m];
+                const Complex a3 = a[q+3*s*m];
+                const Complex a4 = a[q+4*s*m];
+                const Complex t1 = a1 + a4;
+                const Complex t2 = a2 + a3;
+                const Complex t3 = a1 - a4;
+                const Complex t4 = a2 - a3;
+                const Complex b1 = a0 + c1*t1 + c2*t2;
+                const Complex b2 = a0 + c2*t1 + c1*t2;
+                const Complex d1 = rotate(sign_, s1*t3 + s2*t4);
+                const Complex d2 = rotate(sign_, s2*t3 - s1*t4);
+                b[q] = a0 + t1 + t2;
+                b[q+s] = mul(b1 + d1, wp[0]);
+                b[q+2*s] = mul(b2 + d2, wp[1]);
+                b[q+3*s] = mul(b2 - d2, wp[2]);
+                b[q+4*s] = mul(b1 - d1, wp[3]);
+            }
+        }
+    }
+
+    void ComplexFFT::generic(const Pass& pass, const Complex* x,
+            Complex* y) const
+    {
+        const size_t r = pass.radix;
+        const size_t m = pass.length;
+        const size_t s = pass.stride;
+        const Complex* w = &twiddles_[pass.twiddles];
+        const Complex* roots = &roots_[pass.roots];
+        ScratchArena::Frame frame;
+        Complex* a = frame.take<Complex>(r);
+        for (size_t p = 0; p < m; ++p)
+            for (size_t q = 0; q < s; ++q)
+            {
+                for (size_t j = 0; j < r; ++j)
+                    a[j] = x[q+s*(p+j*m)];
+                Complex* b = y + q + s*r*p;
+                Complex sum = 0;
+                for (size_t j = 0; j < r; ++j)
+                    sum += a[j];
+                b[0] = sum;
+                for (size_t k = 1; k < r; ++k)
+                {
+                    sum = a[0];
+                    for (size_t j = 1, jk = k; j < r; ++j, jk += k)
+                    {
+                        if (jk >= r)
+                            jk -= r;
+                        sum += mul(a[j], roots[jk]);
+                    }
+                    b[s*k] = mul(sum, w[p*(r-1)+k-1]);
+                }
+            }
+    }
+
+    /// Plan of the pocket backend.
+    /** Real transforms of even lengths are done as complex transforms of
+     * half the length on the even and odd samples, which are then
+     * separated with the twiddles exp(-+2 pi i k/n). */
+    class PocketPlan : public FFTPlan
+    {
+        public:
+            PocketPlan(FFTKind kind, size_t n, size_t howmany);
+            void r2c(const float* in, Complex* out) const;
+            void c2r(Complex* in, float* out) const;
+            void c2c(const Complex* in, Complex* out) const;
+            size_t bytes() const;
+
+        private:
+            bool packed() const;
+
+            std::unique_ptr<ComplexFFT> fft_;
+            complex_vec twiddles_;
+    };
+
+    PocketPlan::PocketPlan(FFTKind kind, size_t n, size_t howmany)
+        : FFTPlan(kind, n, howmany)
+    {
+        const int sign = kind == FFT_R2C || kind == FFT_FORWARD ? -1 : 1;
+        fft_.reset(new ComplexFFT(packed() ? n/2 : n, sign));
+        if (packed())
+        {
+            twiddles_.reserve(n/2+1);
+            for (size_t k = 0; k <= n/2; ++k)
+                twiddles_.push_back(root(sign, k, n));
+        }
+    }
+
+    bool PocketPlan::packed() const
+    {
+        return kind() != FFT_FORWARD && kind() != FFT_INVERSE &&
+            size()%2 == 0;
+    }
+
+    size_t PocketPlan::bytes() const
+    {
+        return fft_->bytes() + twiddles_.capacity()*sizeof(Complex);
+    }
+
+    void PocketPlan::r2c(const float* in, Complex* out) const
+    {
+        assert(kind() == FFT_R2C);
+        const size_t n = size();
+        const size_t half = n/2;
+        ScratchArena::Frame frame;
+        if (!packed())
+        {
+            Complex* signal = frame.take<Complex>(n);
+            Complex* spectrum = frame.take<Complex>(n);
+            Complex* work = frame.take<Complex>(n);
+            for (size_t b = 0; b < howmany(); ++b)
+            {
+                const float* x = in + b*n;
+                std::copy(x, x+n, signal);
+                fft_->run(signal, spectrum, work);
+                std::copy(spectrum, spectrum+half+1, out + b*(half+1));
+            }
+            return;
+        }
+
+        Complex* work = frame.take<Complex>(half);
+        const Complex* w = &twiddles_[0];
+        for (size_t b = 0; b < howmany(); ++b)
+        {
+            // the even samples as real parts, the odd ones as imaginary
+            Complex* z = out + b*(half+1);
+            fft_->run(reinterpret_cast<const Complex*>(in + b*n), z, work);
+            const Complex z0 = z[0];
+            z[0] = Complex(z0.real() + z0.imag(), 0);
+            z[half] = Complex(z0.real() - z0.imag(), 0);
+            // X[k] = E[k] + w^k O[k] and X[h-k] = conj(E[k] - w^k O[k])
+            for (size_t k = 1; k <= half/2; ++k)
+            {
+                const Complex a = z[k];
+                const Complex c = std::conj(z[half-k]);
+                const Complex even = 0.5f*(a + c);
+                const Complex odd = mul(rotate(-1, 0.5f*(a - c)), w[k]);
+                z[k] = even + odd;
+                z[half-k] = std::conj(even - odd);
+            }
+        }
+    }
+
+    void PocketPlan::c2r(Complex* in, float* out) const
+    {
+        assert(kind() == FFT_C2R);
+        const size_t n = size();
+        const size_t half = n/2;
+        ScratchArena::Frame frame;
+        if (!packed())
+        {
+            Complex* spectrum = frame.take<Complex>(n);
+            Complex* signal = frame.take<Complex>(n);
+            Complex* work = frame.take<Complex>(n);
+            for (size_t b = 0; b < howmany(); ++b)
+            {
+                const Complex* x = in + b*(half+1);
+                spectrum[0] = x[0].real();
+                for (size_t k = 1; k <= half; ++k)
+                {
+                    spectrum[k] = x[k];
+                    spectrum[n-k] = std::conj(x[k]);
+                }
+                fft_->run(spectrum, signal, work);
+                float* y = out + b*n;
+                for (size_t i = 0; i < n; ++i)
+                    y[i] = signal[i].real();
+            }
+            return;
+        }
+
+        Complex* work = frame.take<Complex>(half);
+        const Complex* w = &twiddles_[0];
+        for (size_t b = 0; b < howmany(); ++b)
+        {
+            // twice the transform of the even and odd samples, as in r2c()
+            Complex* z = in + b*(half+1);
+            const float x0 = z[0].real();
+            const float xh = z[half].real();
+            z[0] = Complex(x0 + xh, x0 - xh);
+            for (size_t k = 1; k <= half/2; ++k)
+            {
+                const Complex a = z[k];
+                const Complex c = std::conj(z[half-k]);
+                const Complex sum = a + c;
+                const Complex difference = rotate(1, mul(a - c, w[k]));
+                z[k] = sum + difference;
+                z[half-k] = std::conj(sum) - std::conj(difference);
+            }
+            fft_->run(z, reinterpret_cast<Complex*>(out + b*n), work);
+        }
+    }
+
+    void PocketPlan::c2c(const Complex* in, Complex* out) const
+    {
+        assert(kind() == FFT_FORWARD || kind() == FFT_INVERSE);
+        const size_t n = size();
+        ScratchArena::Frame frame;
+        Complex* work = frame.take<Complex>(n);
+        for (size_t b = 0; b < howmany(); ++b)
+            fft_->run(in + b*n, out + b*n, work);
+    }
+
+    class PocketBackend : public FFTBackend
+    {
+        public:
+            const char* name() const
+            {
+                return "pocket";
+            }
+            FFTPlan* plan(FFTKind kind, size_t n, size_t howmany, unsigned)
+            {
+                return new PocketPlan(kind, n, howmany);
+            }
+            bool aligned(const void*) const
+            {
+                return true;
+            }
+    };
+}
+
+FFTBackend& pocket_backend()
+{
+    static PocketBackend backend;
+    return backend;
+}
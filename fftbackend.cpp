@@ -0,0 +1,162 @@
+#include "fftbackend.hpp"
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <atomic>
+
+#ifdef HAVE_FFTW
+FFTBackend& fftw_backend();
+#endif
+#ifdef HAVE_FFTW_THREADS
+FFTBackend& fftw_threads_backend();
+#endif
+FFTBackend& pocket_backend();
+
+namespace
+{
+    /// Returns the backends of the build, the default first.
+    const std::vector<FFTBackend*>& backends()
+    {
+        static const std::vector<FFTBackend*> list = {
+#ifdef HAVE_FFTW
+            &fftw_backend(),
+#endif
+#ifdef HAVE_FFTW_THREADS
+            &fftw_threads_backend(),
+#endif
+            &pocket_backend()
+        };
+        return list;
+    }
+
+    /// The backend in use, 0 until the first transform.
+    std::atomic<FFTBackend*> current(0);
+}
+
+FFTPlan::FFTPlan(FFTKind kind, size_t n, size_t howmany)
+    : kind_(kind)
+    , size_(n)
+    , howmany_(howmany)
+{
+}
+
+FFTPlan::~FFTPlan()
+{
+}
+
+FFTKind FFTPlan::kind() const
+{
+    return kind_;
+}
+
+size_t FFTPlan::size() const
+{
+    return size_;
+}
+
+size_t FFTPlan::howmany() const
+{
+    return howmany_;
+}
+
+void FFTPlan::r2c(const float*, Complex*) const
+{
+    assert(false);
+}
+
+void FFTPlan::c2r(Complex*, float*) const
+{
+    assert(false);
+}
+
+void FFTPlan::c2c(const Complex*, Complex*) const
+{
+    assert(false);
+}
+
+size_t FFTPlan::bytes() const
+{
+    return 0;
+}
+
+FFTBackend::~FFTBackend()
+{
+}
+
+bool FFTBackend::aligned(const void* array) const
+{
+    return reinterpret_cast<uintptr_t>(array)%64 == 0;
+}
+
+std::string FFTBackend::export_wisdom()
+{
+    return std::string();
+}
+
+bool FFTBackend::import_wisdom(const std::string& wisdom)
+{
+    return wisdom.empty();
+}
+
+std::vector<std::string> fft_backends()
+{
+    std::vector<std::string> names;
+    for (size_t i = 0; i < backends().size(); ++i)
+        names.push_back(backends()[i]->name());
+    return names;
+}
+
+FFTBackend* find_fft_backend(const std::string& name)
+{
+    for (size_t i = 0; i < backends().size(); ++i)
+        if (name == backends()[i]->name())
+            return backends()[i];
+    return 0;
+}
+
+FFTBackend& fft_backend()
+{
+    FFTBackend* backend = current.load();
+    if (backend)
+        return *backend;
+    const char* name = std::getenv("SPECTROGRAM_FFT");
+    backend = name ? find_fft_backend(name) : 0;
+    if (!backend)
+        backend = backends()[0];
+    // a concurrent set_fft_backend() wins
+    FFTBackend* expected = 0;
+    current.compare_exchange_strong(expected, backend);
+    return *current.load();
+}
+
+bool set_fft_backend(const std::string& name)
+{
+    FFTBackend* backend = find_fft_backend(name);
+    if (!backend)
+        return false;
+    current.store(backend);
+    return true;
+}
+
+void* fft_malloc(size_t bytes)
+{
+    // the offset to the allocated block is kept in front of the result
+    const size_t alignment = 64;
+    char* block = static_cast<char*>(std::malloc(bytes + alignment +
+                sizeof(size_t)));
+    if (!block)
+        return 0;
+    char* result = block + sizeof(size_t);
+    result += (alignment - reinterpret_cast<uintptr_t>(result)%alignment)%
+        alignment;
+    reinterpret_cast<size_t*>(result)[-1] = result - block;
+    return result;
+}
+
+void fft_free(void* pointer)
+{
+    if (!pointer)
+        return;
+    char* result = static_cast<char*>(pointer);
+    std::free(result - reinterpret_cast<size_t*>(result)[-1]);
+}
@@ -0,0 +1,114 @@
+#ifndef FFTBACKEND_HPP
+#define FFTBACKEND_HPP
+
+/** \file fftbackend.hpp
+ *  \brief Interchangeable implementations of the discrete Fourier transform.
+ *
+ *  fft.cpp plans and runs all transforms through an FFTBackend:
+ *
+ *  - \c fftw uses FFTW3 in single precision.  It is built when the
+ *    spectrogram_FFTW CMake option is on (the default) and is the default
+ *    backend then.
+ *  - \c fftw-threads is the same with the threads of FFTW, for machines
+ *    with many cores.  Single transforms of 2^18 samples or more, such as
+ *    the one of the whole file in the filterbank analysis, use
+ *    \c SPECTROGRAM_FFT_THREADS threads (default: one per core), the rest
+ *    runs like \c fftw.  It is built when the spectrogram_FFTW_THREADS
+ *    CMake option is on, which needs the fftw3f_threads library.
+ *  - \c pocket is a bundled mixed-radix implementation without
+ *    dependencies, for builds without FFTW and for comparisons.
+ *
+ *  The backend can be switched at run time with set_fft_backend() or the
+ *  \c SPECTROGRAM_FFT environment variable.  Like FFTW, the backends don't
+ *  normalize, an inverse transform of a forward transform multiplies the
+ *  signal by its length.
+ */
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "types.hpp"
+
+/// The transforms a plan can do.
+enum FFTKind
+{
+    FFT_R2C, /**< real signal to the n/2+1 values of its spectrum */
+    FFT_C2R, /**< the inverse of FFT_R2C, destroys its input */
+    FFT_FORWARD, /**< complex to complex, exp(-2 pi i jk/n) */
+    FFT_INVERSE /**< complex to complex, exp(+2 pi i jk/n) */
+};
+
+/// A transform of a given kind and length, for any arrays.
+/** One call does howmany transforms of arrays stored one after another: n
+ * real values, n/2+1 complex values of a real transform or n complex
+ * values.  The input and output arrays must not overlap.  Plans don't
+ * change once made, so they can be executed by several threads at once. */
+class FFTPlan
+{
+    public:
+        FFTPlan(FFTKind kind, size_t n, size_t howmany);
+        virtual ~FFTPlan();
+        FFTKind kind() const;
+        /// Length of each transform.
+        size_t size() const;
+        size_t howmany() const;
+        /// Executes an FFT_R2C plan.
+        virtual void r2c(const float* in, Complex* out) const;
+        /// Executes an FFT_C2R plan, the input is destroyed.
+        virtual void c2r(Complex* in, float* out) const;
+        /// Executes an FFT_FORWARD or FFT_INVERSE plan.
+        virtual void c2c(const Complex* in, Complex* out) const;
+        /// Returns the approximate memory held by the plan.
+        virtual size_t bytes() const;
+    private:
+        FFTPlan(const FFTPlan&);
+        FFTPlan& operator=(const FFTPlan&);
+        FFTKind kind_;
+        size_t size_;
+        size_t howmany_;
+};
+
+/// Makes plans of one implementation.
+class FFTBackend
+{
+    public:
+        /// Options of plan().
+        enum Flags
+        {
+            /// The plan may require arrays for which aligned() holds.
+            ALIGNED = 1,
+            /// Takes time to find the fastest plan.
+            MEASURE = 2
+        };
+
+        virtual ~FFTBackend();
+        /// The name used by set_fft_backend().
+        virtual const char* name() const = 0;
+        /// Creates a plan, can be called from several threads at once.
+        virtual FFTPlan* plan(FFTKind kind, size_t n, size_t howmany,
+                unsigned flags) = 0;
+        /// Returns true if plans made with ALIGNED can use the array.
+        virtual bool aligned(const void* array) const;
+        /// Returns what the backend learned about plans, e.g. FFTW wisdom.
+        virtual std::string export_wisdom();
+        /// Uses what export_wisdom() returned.
+        /** \return false if the text wasn't understood. */
+        virtual bool import_wisdom(const std::string& wisdom);
+};
+
+/// Returns the names of the backends of the build, the default first.
+std::vector<std::string> fft_backends();
+/// Returns a backend by name, or 0 if the build doesn't have it.
+FFTBackend* find_fft_backend(const std::string& name);
+/// Returns the backend in use.
+/** It is the default backend, or the one named by $SPECTROGRAM_FFT. */
+FFTBackend& fft_backend();
+/// Switches the backend of the transforms started from now on.
+/** \return false if there's no backend of the name, nothing changes then. */
+bool set_fft_backend(const std::string& name);
+
+/// Allocates memory aligned to 64 bytes, enough for every backend.
+void* fft_malloc(size_t bytes);
+void fft_free(void* pointer);
+
+#endif
@@ -0,0 +1,102 @@
+#include "filterbank.hpp"
+
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+
+// cent = octave/1200
+double cent2freq(double cents)
+{
+    return std::pow(2, cents/1200);
+}
+
+double freq2cent(double freq)
+{
+    return std::log(freq)/std::log(2)*1200;
+}
+
+Filterbank::Filterbank(double scale)
+    : scale_(scale)
+{
+}
+
+Filterbank::~Filterbank()
+{
+}
+
+LinearFilterbank::LinearFilterbank(double scale, double base, 
+        double hzbandwidth, double overlap)
+    : Filterbank(scale)
+    , bandwidth_(hzbandwidth*scale)
+    , startidx_(std::max(scale_*base-bandwidth_/2, 0.0))
+    , step_((1-overlap)*bandwidth_)
+{
+    //std::cout << "bandwidth: " << bandwidth_ << "\n";
+    //std::cout << "step_: " << step_ << " hz\n";
+    assert(step_ > 0);
+}
+
+int LinearFilterbank::num_bands_est(double maxfreq) const
+{
+    return (maxfreq*scale_-startidx_)/step_;
+}
+
+intpair LinearFilterbank::get_band(int i) const
+{
+    intpair out;
+    out.first = startidx_ + i*step_;
+    out.second = out.first + bandwidth_;
+    return out;
+}
+
+int LinearFilterbank::get_center(int i) const
+{
+    return startidx_ + i*step_ + bandwidth_/2.0;
+}
+
+LogFilterbank::LogFilterbank(double scale, double base, 
+        double centsperband, double overlap)
+    : Filterbank(scale)
+    , centsperband_(centsperband)
+    , logstart_(freq2cent(base))
+    , logstep_((1-overlap)*centsperband_)
+{
+    assert(logstep_ > 0);
+    //std::cout << "bandwidth: " << centsperband_ << " cpb\n";
+    //std::cout << "logstep_: " << logstep_ << " cents\n";
+}
+
+int LogFilterbank::num_bands_est(double maxfreq) const
+{
+    return (freq2cent(maxfreq)-logstart_)/logstep_+4;
+}
+
+int LogFilterbank::get_center(int i) const
+{
+    const double logcenter = logstart_ + i*logstep_;
+    return cent2freq(logcenter)*scale_;
+}
+
+intpair LogFilterbank::get_band(int i) const
+{
+    const double logcenter = logstart_ + i*logstep_;
+    const double loglow = logcenter - centsperband_/2.0;
+    const double loghigh = loglow + centsperband_;
+    intpair out;
+    out.first = cent2freq(loglow)*scale_;
+    out.second = cent2freq(loghigh)*scale_;
+    //std::cout << "centerfreq: " << cent2freq(logcenter)<< "\n";
+    //std::cout << "lowfreq: " << cent2freq(loglow) << " highfreq: "<<cent2freq(loghigh)<< "\n";
+    return out;
+}
+
+std::unique_ptr<Filterbank> Filterbank::get_filterbank(AxisScale type,
+        double scale, double base, double bandwidth, double overlap)
+{
+    Filterbank* filterbank;
+    if (type == SCALE_LINEAR)
+        filterbank=new LinearFilterbank(scale, base, bandwidth, overlap);
+    else
+        filterbank=new LogFilterbank(scale, base, bandwidth, overlap);
+    return std::unique_ptr<Filterbank>(filterbank);
+}
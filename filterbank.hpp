@@ -0,0 +1,67 @@
+#ifndef FILTERBANK_HPP
+#define FILTERBANK_HPP
+
+/** \file filterbank.hpp
+ *  \brief Division of the frequency domain into the bands of a spectrogram.
+ */
+
+#include <memory>
+#include "types.hpp"
+
+/// Converts cents (cent = octave/1200) to a frequency in Hz.
+double cent2freq(double cents);
+/// Converts a frequency in Hz to cents.
+double freq2cent(double freq);
+
+/// Used to divide the frequency domain into suitable intervals.
+/** Each interval represents a horizontal band in a spectrogram. */
+class Filterbank
+{
+    public:
+        static std::unique_ptr<Filterbank> get_filterbank(AxisScale type,
+                double scale, double base, double hzbandwidth, double overlap);
+
+        Filterbank(double scale);
+        /// Returns start-finish indexes for a given filterband.
+        virtual intpair get_band(int i) const = 0;
+        /// Returns the index of the filterband's center.
+        virtual int get_center(int i) const = 0;
+        /// Estimated total number of intervals.
+        virtual int num_bands_est(double maxfreq) const = 0;
+        virtual ~Filterbank();
+    protected:
+        /// The proportion of frequency versus vector indices.
+        const double scale_;
+};
+
+/// Divides the frequency domain to intervals of constant bandwidth.
+class LinearFilterbank : public Filterbank
+{
+    public:
+        LinearFilterbank(double scale, double base, double hzbandwidth,
+                double overlap);
+        intpair get_band(int i) const;
+        int get_center(int i) const;
+        int num_bands_est(double maxfreq) const;
+    private:
+        const double bandwidth_;
+        const int startidx_;
+        const double step_;
+};
+
+/// Divides the frequency domain to intervals with variable (logarithmic, constant-Q) bandwidth.
+class LogFilterbank : public Filterbank
+{
+    public:
+        LogFilterbank(double scale, double base, double centsperband,
+                double overlap);
+        intpair get_band(int i) const;
+        int get_center(int i) const;
+        int num_bands_est(double maxfreq) const;
+    private:
+        const double centsperband_;
+        const double logstart_;
+        const double logstep_;
+};
+
+#endif
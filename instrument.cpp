@@ -0,0 +1,189 @@
+#include "instrument.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    /// Statistics of one timer.
+    struct TimerStats
+    {
+        long long calls;
+        long long total; // ns
+        long long min;
+        long long max;
+    };
+
+    struct TraceEvent
+    {
+        const char* name;
+        int thread;
+        long long start; // ns
+        long long duration;
+    };
+
+    /// More events aren't kept, the trace of a long job would exhaust memory.
+    const size_t max_trace_events = 1 << 20;
+
+    std::atomic<bool> recording(false);
+    bool tracing = false;
+    std::mutex mutex;
+    std::map<std::string, TimerStats> timers;
+    std::map<std::string, long long> counters;
+    std::map<size_t, long long> fft_sizes;
+    std::vector<TraceEvent> events;
+    std::map<std::thread::id, int> threads;
+    const std::chrono::steady_clock::time_point epoch =
+        std::chrono::steady_clock::now();
+
+    /// Small thread numbers for the trace, in the order of appearance.
+    int thread_number()
+    {
+        const std::thread::id id = std::this_thread::get_id();
+        std::map<std::thread::id, int>::iterator it = threads.find(id);
+        if (it != threads.end())
+            return it->second;
+        const int number = threads.size()+1;
+        threads[id] = number;
+        return number;
+    }
+}
+
+void Profiler::enable(bool trace)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    tracing = tracing || trace;
+    recording = true;
+}
+
+bool Profiler::enabled()
+{
+    return recording.load(std::memory_order_relaxed);
+}
+
+void Profiler::reset()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    timers.clear();
+    counters.clear();
+    fft_sizes.clear();
+    events.clear();
+}
+
+void Profiler::count(const char* counter, long long value)
+{
+    if (!enabled())
+        return;
+    std::lock_guard<std::mutex> lock(mutex);
+    counters[counter] += value;
+}
+
+void Profiler::fft(size_t n, size_t padded)
+{
+    if (!enabled())
+        return;
+    std::lock_guard<std::mutex> lock(mutex);
+    ++fft_sizes[padded];
+    counters["fft.transforms"] += 1;
+    counters["fft.samples"] += n;
+    counters["fft.padding"] += padded-n;
+}
+
+void Profiler::allocated(size_t bytes)
+{
+    if (!enabled())
+        return;
+    std::lock_guard<std::mutex> lock(mutex);
+    counters["alloc.buffers"] += 1;
+    counters["alloc.bytes"] += bytes;
+}
+
+long long Profiler::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - epoch).count();
+}
+
+void Profiler::record(const char* name, long long start, long long end)
+{
+    const long long duration = end-start;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<std::string, TimerStats>::iterator it = timers.find(name);
+    if (it == timers.end())
+    {
+        TimerStats stats = {1, duration, duration, duration};
+        timers[name] = stats;
+    }
+    else
+    {
+        TimerStats& stats = it->second;
+        ++stats.calls;
+        stats.total += duration;
+        stats.min = std::min(stats.min, duration);
+        stats.max = std::max(stats.max, duration);
+    }
+    if (tracing && events.size() < max_trace_events)
+    {
+        TraceEvent event = {name, thread_number(), start, duration};
+        events.push_back(event);
+    }
+}
+
+std::string Profiler::summary()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ostringstream out;
+    out << "{\n  \"timers\": {";
+    for (std::map<std::string, TimerStats>::const_iterator it =
+            timers.begin(); it != timers.end(); ++it)
+    {
+        const TimerStats& s = it->second;
+        out << (it == timers.begin() ? "\n" : ",\n")
+            << "    \"" << it->first << "\": {\"calls\": " << s.calls
+            << ", \"total_ms\": " << s.total/1e6
+            << ", \"min_ms\": " << s.min/1e6
+            << ", \"max_ms\": " << s.max/1e6 << "}";
+    }
+    out << "\n  },\n  \"counters\": {";
+    for (std::map<std::string, long long>::const_iterator it =
+            counters.begin(); it != counters.end(); ++it)
+        out << (it == counters.begin() ? "\n" : ",\n")
+            << "    \"" << it->first << "\": " << it->second;
+    out << "\n  },\n  \"fft_sizes\": {";
+    for (std::map<size_t, long long>::const_iterator it = fft_sizes.begin();
+            it != fft_sizes.end(); ++it)
+        out << (it == fft_sizes.begin() ? "\n" : ",\n")
+            << "    \"" << it->first << "\": " << it->second;
+    out << "\n  },\n  \"memory\": " << MemoryTracker::summary() << "\n}\n";
+    return out.str();
+}
+
+std::string Profiler::trace()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ostringstream out;
+    out << std::fixed;
+    out.precision(3);
+    out << "{\"traceEvents\": [";
+    for (size_t i = 0; i < events.size(); ++i)
+        out << (i ? ",\n" : "\n") << "{\"name\": \"" << events[i].name
+            << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << events[i].thread
+            << ", \"ts\": " << events[i].start/1e3
+            << ", \"dur\": " << events[i].duration/1e3 << "}";
+    out << "\n], \"displayTimeUnit\": \"ms\"}\n";
+    return out.str();
+}
+
+bool Profiler::write(const std::string& filename, const std::string& contents)
+{
+    std::ofstream file(filename.c_str());
+    file << contents;
+    return (bool)file;
+}
@@ -0,0 +1,75 @@
+#ifndef INSTRUMENT_HPP
+#define INSTRUMENT_HPP
+
+/** \file instrument.hpp
+ *  \brief Timers and counters showing where the time of a job goes.
+ *
+ *  The stages of the engine (FFT, band extraction, windowing, envelope
+ *  detection, resampling, normalization, image mapping, synthesis) and the
+ *  decoding of sound files are wrapped in ScopedTimer objects.  Nothing is
+ *  recorded until Profiler::enable() is called, a disabled timer costs one
+ *  atomic load.
+ */
+
+#include <string>
+#include <cstddef>
+#include "memory.hpp"
+
+/// Collects the measurements of all threads of the process.
+class Profiler
+{
+    public:
+        /// Starts recording.
+        /** \param trace Also keep every timed interval for trace(). */
+        static void enable(bool trace = false);
+        static bool enabled();
+        /// Forgets everything recorded so far.
+        static void reset();
+        /// Adds a value to a named counter.
+        static void count(const char* counter, long long value = 1);
+        /// Records a transform of n samples that was padded to padded samples.
+        static void fft(size_t n, size_t padded);
+        /// Records the allocation of a large buffer.
+        static void allocated(size_t bytes);
+
+        /// Returns the timers, counters and FFT sizes as JSON.
+        static std::string summary();
+        /// Returns the timed intervals in the Chrome trace event format.
+        /** It can be opened in chrome://tracing or Perfetto. */
+        static std::string trace();
+        /// Writes a string to a file, returns false on failure.
+        static bool write(const std::string& filename,
+                const std::string& contents);
+
+        /// Used by ScopedTimer.
+        static long long now();
+        static void record(const char* name, long long start, long long end);
+};
+
+/// Measures the time until it goes out of scope.
+/** Tracked buffers allocated in the meantime are charged to its stage. */
+class ScopedTimer
+{
+    public:
+        /// \param name A string literal naming the stage.
+        explicit ScopedTimer(const char* name)
+            : name_(name)
+            , outer_(MemoryTracker::enter(name))
+            , start_(Profiler::enabled() ? Profiler::now() : -1)
+        {
+        }
+        ~ScopedTimer()
+        {
+            if (start_ >= 0)
+                Profiler::record(name_, start_, Profiler::now());
+            MemoryTracker::enter(outer_);
+        }
+    private:
+        ScopedTimer(const ScopedTimer&);
+        ScopedTimer& operator=(const ScopedTimer&);
+        const char* name_;
+        const char* outer_;
+        long long start_;
+};
+
+#endif
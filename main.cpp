@@ -16,7 +16,7 @@
  * The development versions of the following libraries need to be usable
  * before compiling:
  * \li Qt4 (used for the GUI): http://www.qtsoftware.com/products
- * \li FFTW (the single-precision version, used for fast fourier transform):
+ * \li FFTW (the single-precision version, used for fast fourier transform, optional):
  * http://www.fftw.org
  * \li SRC (aka libsamplerate, used for audio resampling):
  * http://www.mega-nerd.com/SRC/
@@ -40,6 +40,102 @@
  *
  * The executable \c spectrogram will appear in the \c build directory.
  *
+ * Next to it, \c spectrogram-cli is built.  It does the same analysis and
+ * synthesis from the command line for any number of files at once, without
+ * the GUI (and without a display).  Run <tt>spectrogram-cli --help</tt> for
+ * the list of options.
+ *
+ * With <tt>--daemon SOCKET</tt> it keeps running as a local render server,
+ * which takes jobs from other programs and keeps the FFT plans, band plans
+ * and decoded sound files from earlier jobs, so repeated requests start
+ * faster.
+ *
+ * \c spectrogram-bench times the signal processing kernels (dsp.hpp, the FFT
+ * and palette functions) on synthetic data and prints the results as JSON.
+ * Build it in release mode (<tt>-Dspectrogram_DEBUG=OFF</tt>) to get
+ * meaningful numbers.
+ *
+ * The inner loops use SSE2, AVX2 or AVX-512 kernels (simd.hpp), chosen at
+ * run time for the CPU.  \c SPECTROGRAM_SIMD=scalar (or sse2, avx2) selects
+ * a lower level, <tt>spectrogram-bench --check</tt> verifies that all levels
+ * the CPU supports give the results of the scalar code.  \c ctest runs it.
+ *
+ * The transforms are done by FFTW, or by a bundled implementation without
+ * dependencies when the project is configured with
+ * <tt>-Dspectrogram_FFTW=OFF</tt>.  Builds with FFTW have both;
+ * \c SPECTROGRAM_FFT=pocket (or <tt>spectrogram-cli --fft pocket</tt>)
+ * selects the bundled one, <tt>spectrogram-bench</tt> times them on the
+ * same transforms and <tt>--check</tt> compares their results.  On machines
+ * with many cores, configure with <tt>-Dspectrogram_FFTW_THREADS=ON</tt>
+ * and select \c fftw-threads: the transform of the whole file then uses
+ * \c SPECTROGRAM_FFT_THREADS threads, one per core by default.
+ *
+ * Transforms are padded to the length that is cheapest for the backend,
+ * judged by default costs of its radices.  <tt>spectrogram-cli
+ * --calibrate-fft FILE</tt> measures them on the machine and saves them
+ * with the backend's wisdom; set \c SPECTROGRAM_FFT_WISDOM to FILE to use
+ * them.
+ *
+ * On Unix, \c spectrogram-scaling runs whole analyses and syntheses of
+ * synthetic tracks with several parameter sets and numbers of concurrent
+ * jobs, and prints the wall time, time per stage and peak memory as CSV.
+ * Save the output of a release build on the reference machine;
+ * <tt>spectrogram-scaling --compare FILE</tt> then fails when a case got
+ * slower than in that run.
+ *
+ * To see where the time of a slow job goes, run the command line program
+ * with <tt>--profile FILE</tt> (a JSON summary of the time spent in each
+ * stage, counters and FFT sizes) or <tt>--trace FILE</tt> (a Chrome trace,
+ * to be opened in chrome://tracing).  The GUI writes the same files after
+ * every job when the \c SPECTROGRAM_PROFILE or \c SPECTROGRAM_TRACE
+ * environment variables name them.  The profile also shows the live and
+ * peak memory of the sample, spectrum and pixel buffers of each stage.
+ *
+ * <tt>--memory-budget MB</tt> makes the command line program estimate the
+ * memory of every analysis before starting it.  If it wouldn't fit, the
+ * time resolution is lowered, and if it doesn't fit at all, the file is
+ * refused instead of running out of memory halfway.
+ *
+ * <tt>--deadline SECONDS</tt> (or <tt>deadline=SECONDS</tt> in a daemon
+ * request) stops jobs that run longer, the \c SPECTROGRAM_DEADLINE
+ * environment variable does the same for the GUI.  Cancelled and expired
+ * jobs stop within milliseconds, also in the middle of long transforms.
+ *
+ * For recordings that keep growing, <tt>--append</tt> (or
+ * <tt>append=1</tt> in a daemon request) only analyzes the part of the
+ * sound file that is new since the last run and adds its columns to the
+ * spectrogram.  The image remembers where it ended and its brightness
+ * reference, so the new columns join the old ones seamlessly.  Appending
+ * always uses the STFT.  Only the new part of the sound is decoded, except
+ * for MP3 files, and neither the PCM cache nor the daemon's audio cache
+ * keeps it.  The image itself is still read and saved whole, which costs in
+ * proportion to the length of the recording, although far less per second
+ * than the audio.
+ *
+ * <tt>--live</tt> analyzes a sound while it is being recorded, from the
+ * standard input or a FIFO, as a WAV stream or raw PCM.  Every column is
+ * written to the standard output as soon as its frame is complete, with the
+ * same parameters and palette as the images, so another program can scroll
+ * them on screen.  The delay is about half a frame, below 100 ms at the
+ * default settings, and is reported at the start.  Every column is
+ * normalized by the loudest one so far, so <tt>cat sound.wav |
+ * spectrogram-cli --live -</tt> gives the columns of <tt>--append</tt> on
+ * the whole file, whatever the pipe delivers at a time.
+ *
+ * Recordings too long for one machine can be divided between processes
+ * with <tt>--shard K/N</tt> (or <tt>shard=K/N</tt> in a daemon request),
+ * on other machines too, as long as they share the output directory.  Each
+ * one analyzes a part of the file with a guard on each side, long enough
+ * for the slowest band of the filterbank, and writes its columns
+ * unnormalized.  <tt>--stitch N</tt> then normalizes all of them by the
+ * loudest one and joins them into the spectrogram, which differs from one
+ * analyzed at once only by the interpolation between the columns.
+ *
+ * If the \c SPECTROGRAM_RESULT_CACHE environment variable names a directory
+ * (or <tt>--result-cache</tt> is given), rendered spectrograms are kept there
+ * and both programs reuse them when the same sound is analyzed with the same
+ * parameters and palette again.
+ *
  * \subsection Windows Windows
  * Besides the dependencies you should have MinGW and MSYS installed.
  *
@@ -56,9 +152,12 @@
  * A Makefile now appears in the build directory.  Navigate to that directory in the MSYS shell and type \c make to compile the program.
  *
  * \section code Code overview
- * The most interesting class of the program is Spectrogram, it holds the
- * parameters for a spectrogram and performs analysis (turning sounds to
- * images) and synthesis (turning images to sounds).
+ * The most interesting class of the program is SpectrogramEngine, it holds
+ * the parameters for a spectrogram and performs analysis (turning sounds to
+ * intensities) and synthesis (turning intensities to sounds).  Together with
+ * Filterbank, Palette and the FFT functions it forms the \c spectrogram_core
+ * library, which doesn't depend on Qt.  The Spectrogram class adapts it to
+ * Qt: it works with QImage spectrograms and reports progress with signals.
  *
  * The MainWindow class handles the GUI.  The MainWindow::ui member is used to
  * access the widgets as designed in mainwindow.ui created with Qt Designer.
@@ -130,6 +229,15 @@
  * \li <b>Overlap</b>:  Larger overlap gives more detail in the frequency
  * domain and makes the spectrogram taller.  If no window function is used, it
  * can be set to zero, otherwise setting at least 60% overlap is recommended.
+ * \li <b>Method</b>:  The filterbank filters the whole sound for each band,
+ * which is exact but slow for long files.  The short-time Fourier transform
+ * (STFT) analyzes short frames instead, each one pixel apart, and is much
+ * faster.  Its frequency resolution is the same for all bands, so on the
+ * logarithmic scale the lowest bands get blurred.  It is meant for a quick
+ * look, the spectrogram has the same size either way.  The constant-Q
+ * transform is made for the logarithmic scale: each octave is analyzed at a
+ * samplerate and with frames of its own, so the lowest bands stay sharp.
+ * On that scale it is the fastest method.
  * \li <b>%Palette</b>:  Shows the colors in which the spectrogram will be
  * drawn.  You can supply your own palette from an image, in that case the
  * first row of pixels of the image is used.  For synthesis, the colors in the
@@ -197,8 +305,9 @@ namespace
         Soundfile file("/home/jan/music/Windir/1999-Arntor/01-Byrjing.mp3");
         Spectrogram spec;
         //spec.palette = Palette("/home/jan/spectrogram/palettes/fiery.png");
-        real_vec signal = file.read_channel(0);
-        QImage out = spec.to_image(signal, file.data().samplerate());
+        pcm_buffer signal = file.map_channel(0);
+        QImage out = spec.to_image(signal->data(), signal->size(),
+                file.data().samplerate());
         out.save("out.png");
     }
 
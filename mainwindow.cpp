@@ -8,8 +8,11 @@
 #include <QPixmap>
 #include <QWhatsThis>
 #include "mainwindow.hpp"
+#include "resultcache.hpp"
+#include "instrument.hpp"
 #include <iostream>
 #include <cassert>
+#include <cstdlib>
 
 namespace
 {
@@ -19,6 +22,37 @@ namespace
             if (combo->itemData(index) == value)
                 combo->setCurrentIndex(index);
     }
+
+    /// Decodes the channel and analyzes it, runs in a worker thread.
+    /** The decoded samples are only referenced by the worker and released
+     * when the analysis is done. */
+    AnalysisResult analyze(const Spectrogram* spectrogram, Soundfile soundfile,
+            int channel)
+    {
+        AnalysisResult result;
+        const pcm_buffer signal = soundfile.map_channel(channel);
+        if (!signal || signal->empty())
+        {
+            result.error = "Error reading sound file.";
+            return result;
+        }
+        const int samplerate = soundfile.data().samplerate();
+        const ResultCache cache;
+        QByteArray key;
+        if (cache.enabled())
+        {
+            key = ResultCache::key(*spectrogram, signal->data(),
+                    signal->size(), samplerate, channel);
+            const QString cached = cache.lookup(key);
+            if (!cached.isNull() && result.image.load(cached))
+                return result;
+        }
+        result.image = spectrogram->to_image(signal->data(), signal->size(),
+                samplerate);
+        if (cache.enabled() && !result.image.isNull())
+            cache.store(key, result.image);
+        return result;
+    }
 }
 
 MainWindow::MainWindow()
@@ -58,6 +92,11 @@ MainWindow::MainWindow()
     ui.windowCombo->addItem("Triangular", (int)WINDOW_TRIANGULAR);
     ui.windowCombo->addItem("Rectangular (none)", (int)WINDOW_RECTANGULAR);
 
+    ui.methodCombo->addItem("Filterbank (exact)", (int)ANALYSIS_FILTERBANK);
+    ui.methodCombo->addItem("STFT (fast)", (int)ANALYSIS_STFT);
+    ui.methodCombo->addItem("Constant-Q (fast, logarithmic)",
+            (int)ANALYSIS_CQT);
+
     ui.syntCombo->addItem("sine", (int)SYNTHESIS_SINE);
     ui.syntCombo->addItem("noise", (int)SYNTHESIS_NOISE);
 
@@ -70,15 +109,22 @@ MainWindow::MainWindow()
             ui.specProgress, SLOT(setValue(int)));
     connect(spectrogram, SIGNAL(status(const QString&)),
             ui.specStatus, SLOT(setText(const QString&)));
+    spectrogram->set_deadline(QString::fromLocal8Bit(
+                std::getenv("SPECTROGRAM_DEADLINE")).toDouble());
     setValues();
 
-    image_watcher = new QFutureWatcher<QImage>(this);
+    image_watcher = new QFutureWatcher<AnalysisResult>(this);
     connect(image_watcher, SIGNAL(finished()), this, SLOT(newSpectrogram()));
     sound_watcher = new QFutureWatcher<real_vec>(this);
     connect(sound_watcher, SIGNAL(finished()), this, SLOT(newSound()));
 
     ui.lengthEdit->setDisplayFormat("hh:mm:ss");
 
+    profile_file = QString::fromLocal8Bit(std::getenv("SPECTROGRAM_PROFILE"));
+    trace_file = QString::fromLocal8Bit(std::getenv("SPECTROGRAM_TRACE"));
+    if (!profile_file.isEmpty() || !trace_file.isEmpty())
+        Profiler::enable(!trace_file.isEmpty());
+
     idleState();
 }
 
@@ -143,7 +189,7 @@ void MainWindow::choosePalette()
                 "The picture format was not recognised.");
         return;
     }
-    spectrogram->palette = Palette(img);
+    spectrogram->palette = palette_from_image(img);
     updatePalette();
 }
 
@@ -160,7 +206,7 @@ void MainWindow::chooseSoundfile()
 
 void MainWindow::updatePalette()
 {
-    ui.paletteLabel->setPixmap(spectrogram->palette.preview(
+    ui.paletteLabel->setPixmap(palette_preview(spectrogram->palette,
                 spectrogram->palette.numColors(), ui.paletteLabel->height()));
 }
 
@@ -213,17 +259,11 @@ void MainWindow::makeSpectrogram()
 
     const int channelidx = ui.channelSpin->value()-1;
     ui.specStatus->setText("Loading sound file");
-    qApp->processEvents();
-    real_vec signal = soundfile.read_channel(channelidx);
-    if (!signal.size())
-    {
-        QMessageBox::warning(this, "Error", "Error reading sound file.");
-        idleState();
-        return;
-    }
-
-    QFuture<QImage> future = QtConcurrent::run(spectrogram,
-          &Spectrogram::to_image, signal, soundfile.data().samplerate());
+    // the worker gets its own handle to the file, which may be reloaded
+    // in the meantime
+    spectrogram->submit();
+    QFuture<AnalysisResult> future = QtConcurrent::run(analyze,
+            (const Spectrogram*)spectrogram, soundfile, channelidx);
     image_watcher->setFuture(future);
 }
 
@@ -242,16 +282,25 @@ void MainWindow::loadValues()
         itemData(ui.intensityCombo->currentIndex()).toInt();
     spectrogram->correction = (BrightCorrection)ui.brightCombo->
         itemData(ui.brightCombo->currentIndex()).toInt();
+    spectrogram->method = (AnalysisMethod)ui.methodCombo->
+        itemData(ui.methodCombo->currentIndex()).toInt();
 }
 
 void MainWindow::newSpectrogram()
 {
-    if (!image_watcher->future().result().isNull()) // cancelled?
+    const AnalysisResult result = image_watcher->future().result();
+    if (!result.error.isNull())
+        QMessageBox::warning(this, "Error", result.error);
+    else if (result.image.isNull() && spectrogram->expired())
+        QMessageBox::warning(this, "Deadline exceeded",
+                "The analysis took too long and was stopped.");
+    else if (!result.image.isNull()) // cancelled?
     {
-        image = image_watcher->future().result();
+        image = result.image;
         ui.speclocEdit->setText("unsaved");
         updateImage();
     }
+    writeProfile();
     idleState();
 }
 
@@ -395,6 +444,7 @@ void MainWindow::makeSound()
         itemData(ui.syntCombo->currentIndex()).toInt();
     //const int samplerate = ui.samplerateSpin->value();
     const int samplerate = 44100;
+    spectrogram->submit();
     QFuture<real_vec> future = QtConcurrent::run(spectrogram,
            &Spectrogram::synthetize, image, samplerate, type);
     sound_watcher->setFuture(future);
@@ -402,15 +452,33 @@ void MainWindow::makeSound()
 
 void MainWindow::newSound()
 {
-    if (sound_watcher->future().result().size()) // cancelled?
+    const real_vec sound = sound_watcher->future().result();
+    if (sound.empty() && spectrogram->expired())
+        QMessageBox::warning(this, "Deadline exceeded",
+                "The synthesis took too long and was stopped.");
+    else if (sound.size()) // cancelled?
     {
-        saveSoundfile(sound_watcher->future().result());
+        saveSoundfile(sound);
         loadSoundfile();
     }
 
+    writeProfile();
     idleState();
 }
 
+void MainWindow::writeProfile()
+{
+    if (!profile_file.isEmpty() &&
+            !Profiler::write(profile_file.toLocal8Bit().constData(),
+                Profiler::summary()))
+        std::cerr << "Couldn't write the profile.\n";
+    if (!trace_file.isEmpty() &&
+            !Profiler::write(trace_file.toLocal8Bit().constData(),
+                Profiler::trace()))
+        std::cerr << "Couldn't write the trace.\n";
+    Profiler::reset();
+}
+
 void MainWindow::setValues()
 {
     ui.bandwidthSpin->setValue((int)spectrogram->bandwidth);
@@ -422,6 +490,7 @@ void MainWindow::setValues()
     setCombo(ui.intensityCombo, spectrogram->intensity_axis);
     setCombo(ui.frequencyCombo, spectrogram->frequency_axis);
     setCombo(ui.brightCombo, spectrogram->correction);
+    setCombo(ui.methodCombo, spectrogram->method);
     updatePalette();
 }
 
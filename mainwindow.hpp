@@ -6,8 +6,18 @@
 
 #include <QFutureWatcher>
 #include "spectrogram.hpp"
+#include "soundfile.hpp"
 #include "ui_mainwindow.h"
 
+/// Outcome of a spectrogram analysis running in the background.
+struct AnalysisResult
+{
+    /// The spectrogram, null if the analysis was cancelled.
+    QImage image;
+    /// Reason of a failure, null if there was none.
+    QString error;
+};
+
 /// Represents the main application window.
 class MainWindow : public QMainWindow
 {
@@ -27,8 +37,14 @@ class MainWindow : public QMainWindow
 
         void workingState();
         void idleState();
+        /// Writes the profile of the finished job, if it was requested.
+        /** $SPECTROGRAM_PROFILE and $SPECTROGRAM_TRACE name the JSON summary
+         * and the Chrome trace files. */
+        void writeProfile();
+        QString profile_file;
+        QString trace_file;
 
-        QFutureWatcher<QImage>* image_watcher;
+        QFutureWatcher<AnalysisResult>* image_watcher;
         QFutureWatcher<real_vec>* sound_watcher;
     private slots:
         void setFilterUnits(int scale);
@@ -57,10 +73,6 @@ class MainWindow : public QMainWindow
 
         void newSpectrogram();
         void newSound();
-    signals:
-        //void makeSound(Spectrogram* spectrogram, QImage image, int samplerate);
-        void makeSpectrogram(Spectrogram* spectrogram, real_vec signal,
-                int samplerate);
 };
 
 #endif
@@ -0,0 +1,159 @@
+#include "memory.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+
+namespace
+{
+    /// Live and peak bytes of one stage.
+    struct Usage
+    {
+        std::atomic<const char*> name;
+        std::atomic<long long> live;
+        std::atomic<long long> peak;
+    };
+
+    /// Stages are numbered in the order of their first allocation, slot 0
+    /// is for allocations outside of any stage.
+    const size_t max_stages = 64;
+    Usage stages[max_stages];
+    std::atomic<size_t> stage_count(1);
+    std::mutex stage_mutex;
+    Usage total;
+
+    thread_local const char* current_stage = 0;
+
+    /// Stored in front of each allocation, keeps the alignment of malloc().
+    union Header
+    {
+        struct
+        {
+            size_t bytes;
+            size_t stage;
+        } info;
+        long double align;
+    };
+
+    void raise_peak(std::atomic<long long>& peak, long long value)
+    {
+        long long old = peak.load(std::memory_order_relaxed);
+        while (value > old && !peak.compare_exchange_weak(old, value,
+                    std::memory_order_relaxed))
+            ;
+    }
+
+    void charge(Usage& usage, long long bytes)
+    {
+        const long long live = usage.live.fetch_add(bytes,
+                std::memory_order_relaxed) + bytes;
+        raise_peak(usage.peak, live);
+    }
+
+    /// Returns the slot of the stage of the calling thread.
+    size_t stage_slot()
+    {
+        const char* name = current_stage;
+        if (!name)
+            return 0;
+        const size_t count = stage_count.load(std::memory_order_acquire);
+        for (size_t i = 1; i < count; ++i)
+        {
+            const char* stage = stages[i].name.load(std::memory_order_relaxed);
+            if (stage == name || std::strcmp(stage, name) == 0)
+                return i;
+        }
+        std::lock_guard<std::mutex> lock(stage_mutex);
+        const size_t now = stage_count.load(std::memory_order_relaxed);
+        for (size_t i = count; i < now; ++i)
+            if (std::strcmp(stages[i].name.load(), name) == 0)
+                return i;
+        if (now == max_stages)
+            return 0;
+        stages[now].name = name;
+        stage_count.store(now+1, std::memory_order_release);
+        return now;
+    }
+}
+
+void* MemoryTracker::allocate(size_t bytes)
+{
+    Header* header = (Header*)std::malloc(sizeof(Header) + bytes);
+    if (!header)
+        throw std::bad_alloc();
+    header->info.bytes = bytes;
+    header->info.stage = stage_slot();
+    charge(stages[header->info.stage], bytes);
+    charge(total, bytes);
+    return header+1;
+}
+
+void MemoryTracker::deallocate(void* pointer)
+{
+    if (!pointer)
+        return;
+    Header* header = (Header*)pointer - 1;
+    const long long bytes = header->info.bytes;
+    stages[header->info.stage].live.fetch_sub(bytes,
+            std::memory_order_relaxed);
+    total.live.fetch_sub(bytes, std::memory_order_relaxed);
+    std::free(header);
+}
+
+size_t MemoryTracker::live()
+{
+    return total.live.load(std::memory_order_relaxed);
+}
+
+size_t MemoryTracker::peak()
+{
+    return total.peak.load(std::memory_order_relaxed);
+}
+
+void MemoryTracker::reset_peak()
+{
+    total.peak = total.live.load();
+    const size_t count = stage_count.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; ++i)
+        stages[i].peak = stages[i].live.load();
+}
+
+size_t MemoryTracker::add(size_t bytes)
+{
+    const size_t stage = stage_slot();
+    charge(stages[stage], bytes);
+    charge(total, bytes);
+    return stage;
+}
+
+void MemoryTracker::remove(size_t bytes, size_t stage)
+{
+    stages[stage].live.fetch_sub(bytes, std::memory_order_relaxed);
+    total.live.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+std::string MemoryTracker::summary()
+{
+    std::ostringstream out;
+    out << "{\"live_bytes\": " << live() << ", \"peak_bytes\": " << peak()
+        << ", \"stages\": {";
+    const size_t count = stage_count.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const char* name = i ? stages[i].name.load() : "other";
+        out << (i ? ",\n" : "\n") << "    \"" << name
+            << "\": {\"live_bytes\": " << stages[i].live.load()
+            << ", \"peak_bytes\": " << stages[i].peak.load() << "}";
+    }
+    out << "\n  }}";
+    return out.str();
+}
+
+const char* MemoryTracker::enter(const char* name)
+{
+    const char* previous = current_stage;
+    current_stage = name;
+    return previous;
+}
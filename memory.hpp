@@ -0,0 +1,96 @@
+#ifndef MEMORY_HPP
+#define MEMORY_HPP
+
+/** \file memory.hpp
+ *  \brief Accounting of the memory held by the sample, spectrum and pixel
+ *  buffers.
+ *
+ *  real_vec, complex_vec and the pixels of a PixelBuffer allocate through
+ *  TrackedAllocator.  Every allocation is charged to the stage (the name of
+ *  the innermost ScopedTimer) of the thread that made it, so the live and
+ *  peak bytes can be reported per stage.
+ */
+
+#include <cstddef>
+#include <string>
+#include <new>
+
+/// Keeps the live and peak bytes of the tracked buffers.
+class MemoryTracker
+{
+    public:
+        /// Allocates memory charged to the current stage of the thread.
+        static void* allocate(size_t bytes);
+        static void deallocate(void* pointer);
+        /// Bytes held by the tracked buffers right now.
+        static size_t live();
+        /// The highest value of live() so far.
+        static size_t peak();
+        /// Starts measuring the peak from the current live bytes.
+        static void reset_peak();
+        /// Charges memory held outside of the tracked buffers (e.g. a QImage).
+        /** \return The stage charged, to be passed to remove(). */
+        static size_t add(size_t bytes);
+        static void remove(size_t bytes, size_t stage);
+        /// Returns the live and peak bytes, in total and per stage, as JSON.
+        static std::string summary();
+
+        /// Sets the stage of the calling thread, returns the previous one.
+        /** \param name A string literal, or 0 for none. */
+        static const char* enter(const char* name);
+};
+
+/// Charges memory held by an untracked buffer while it exists.
+class MemoryCharge
+{
+    public:
+        explicit MemoryCharge(size_t bytes)
+            : bytes_(bytes)
+            , stage_(MemoryTracker::add(bytes))
+        {
+        }
+        ~MemoryCharge()
+        {
+            MemoryTracker::remove(bytes_, stage_);
+        }
+    private:
+        MemoryCharge(const MemoryCharge&);
+        MemoryCharge& operator=(const MemoryCharge&);
+        size_t bytes_;
+        size_t stage_;
+};
+
+/// Standard allocator that goes through MemoryTracker.
+template <class T>
+class TrackedAllocator
+{
+    public:
+        typedef T value_type;
+        template <class U> struct rebind { typedef TrackedAllocator<U> other; };
+
+        TrackedAllocator() {}
+        template <class U> TrackedAllocator(const TrackedAllocator<U>&) {}
+
+        T* allocate(size_t n)
+        {
+            return static_cast<T*>(MemoryTracker::allocate(n*sizeof(T)));
+        }
+        void deallocate(T* pointer, size_t)
+        {
+            MemoryTracker::deallocate(pointer);
+        }
+};
+
+template <class T, class U>
+bool operator==(const TrackedAllocator<T>&, const TrackedAllocator<U>&)
+{
+    return true;
+}
+
+template <class T, class U>
+bool operator!=(const TrackedAllocator<T>&, const TrackedAllocator<U>&)
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,69 @@
+#include "palette.hpp"
+
+#include <cassert>
+#include <algorithm>
+
+Palette::Palette(const std::vector<rgb_t>& colors)
+    : colors_(colors)
+{
+    assert(!colors_.empty());
+}
+
+Palette::Palette()
+{
+    for (int i = 0; i < 256; ++i)
+        colors_.push_back(0xff000000u | (i << 16) | (i << 8) | i);
+}
+
+int Palette::get_color(float val) const
+{
+    assert(val >= 0 && val <= 1);
+    if (indexable())
+        // returns the color index
+        return (colors_.size()-1)*val;
+    else
+        // returns the RGB value
+        return colors_[(colors_.size()-1)*val];
+}
+
+void Palette::get_colors(const float* vals, size_t n,
+        unsigned int* out) const
+{
+    const float last = colors_.size()-1;
+    if (indexable())
+        for (size_t i = 0; i < n; ++i)
+            out[i] = (int)(last*vals[i]);
+    else
+        for (size_t i = 0; i < n; ++i)
+            out[i] = colors_[(size_t)(last*vals[i])];
+}
+
+bool Palette::has_color(rgb_t color) const
+{
+    return std::find(colors_.begin(), colors_.end(), color) != colors_.end();
+}
+
+// ne moc efektivni
+float Palette::get_intensity(rgb_t color) const
+{
+    std::vector<rgb_t>::const_iterator it =
+        std::find(colors_.begin(), colors_.end(), color);
+    if (it == colors_.end()) // shouldn't happen
+        return 0;
+    return (float)(it-colors_.begin())/(colors_.size()-1);
+}
+
+bool Palette::indexable() const
+{
+    return colors_.size() <= 256;
+}
+
+int Palette::numColors() const
+{
+    return colors_.size();
+}
+
+const std::vector<rgb_t>& Palette::colors() const
+{
+    return colors_;
+}
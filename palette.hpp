@@ -0,0 +1,60 @@
+#ifndef PALETTE_HPP
+#define PALETTE_HPP
+
+/** \file palette.hpp
+ *  \brief Mapping of spectrogram intensities to colors.
+ */
+
+#include <vector>
+#include "types.hpp"
+
+/// Represents a palette used to draw a spectrogram.
+/** It is basically a mapping of intensity values from the interval <0,1> to a
+ * set of colors (the palette), where 0 represents zero intensity of the pixel
+ * and 1 represents maximum intensity.  Ideally, the mapping is 1:1
+ * (bijection), otherwise there will be ambiguity in the synthesis process and
+ * quality will be affected.  Both the Intensity -> Color and Color ->
+ * Intensity mappings are implemented by the Palette::get_color() and
+ * Palette::get_intensity() functions respectively.
+ *
+ * For optimal image sizes, the palette will be either indexed or RGB,
+ * depending on how many colors it contains.  If there are 256 or less colors
+ * (eg. in the default grayscale case), the palette will be 8-bit indexed,
+ * otherwise it's RGB (24-bit, no index).
+ *
+ * Pixels of an indexed image hold the color index and pixels of an RGB image
+ * the color itself, which is exactly what Palette::get_color() returns in
+ * either case.
+ */
+class Palette
+{
+    public:
+        /// Default constructor -- 8-bit grayscale palette.
+        Palette();
+        /// Creates a palette from a list of colors, from zero intensity up.
+        Palette(const std::vector<rgb_t>& colors);
+        /// Mapping of intensity values from <0,1> to an index or RGB value.
+        /** 
+         * \param val A float where 0 <= val <= 1
+         * \return Index of the color for an indexed palette or RGB value.
+         */
+        int get_color(float val) const;
+        /// get_color() of n values, which are all from <0,1>.
+        void get_colors(const float* vals, size_t n, unsigned int* out) const;
+        /// Inverse mapping of color values to intensity, used for spectrogram synthesis.
+        /** \return Corresponding intensity, a value from <0,1>.  */
+        float get_intensity(rgb_t color) const;
+        /// Returns true if the palette contains the given color, false otherwise.
+        bool has_color(rgb_t color) const;
+        /// Used to determine if the palette is indexed or RGB.
+        /** \return \c true if the palette is indexed, otherwise \c false.*/
+        bool indexable() const;
+        /// Returns the number of colors in the palette.
+        int numColors() const;
+        /// Returns the colors, from zero intensity up.
+        const std::vector<rgb_t>& colors() const;
+    private:
+        std::vector<rgb_t> colors_;
+};
+
+#endif
@@ -0,0 +1,102 @@
+#include "progress.hpp"
+#include "engine.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+
+ProgressCounter::ProgressCounter(long total)
+    : total_(total)
+    , start_(std::chrono::steady_clock::now())
+{
+    for (int i = 0; i < max_workers; ++i)
+        workers_[i].done = 0;
+}
+
+long ProgressCounter::done() const
+{
+    long sum = 0;
+    for (int i = 0; i < max_workers; ++i)
+        sum += workers_[i].done.load(std::memory_order_relaxed);
+    return sum;
+}
+
+long ProgressCounter::total() const
+{
+    return total_;
+}
+
+double ProgressCounter::elapsed() const
+{
+    return std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start_).count();
+}
+
+double ProgressCounter::rate() const
+{
+    const double seconds = elapsed();
+    return seconds > 0 ? done()/seconds : 0;
+}
+
+double ProgressCounter::eta() const
+{
+    const long finished = done();
+    if (finished <= 0 || total_ <= 0)
+        return -1;
+    return elapsed()*(total_-finished)/finished;
+}
+
+ProgressReporter::ProgressReporter(ProgressListener* listener,
+        const ProgressCounter& counter, const std::string& what, int from,
+        int to, double hz)
+    : listener_(listener)
+    , counter_(counter)
+    , what_(what)
+    , from_(from)
+    , to_(to)
+    , period_((long long)(1e6/hz))
+    , stop_(false)
+{
+    if (listener_)
+        thread_ = std::thread(&ProgressReporter::run, this);
+}
+
+ProgressReporter::~ProgressReporter()
+{
+    if (!listener_)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wakeup_.notify_one();
+    thread_.join();
+}
+
+void ProgressReporter::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    report();
+    while (!wakeup_.wait_for(lock, period_, [this]() { return stop_; }))
+        report();
+    report();
+}
+
+void ProgressReporter::report()
+{
+    const long done = counter_.done();
+    const long total = counter_.total();
+    const double fraction = total > 0 ? std::min(1.0, (double)done/total) : 0;
+    listener_->progress(from_ + (int)((to_-from_)*fraction));
+
+    std::ostringstream text;
+    text << "Processing " << what_ << ": " << done << " of " << total;
+    const double rate = counter_.rate();
+    if (rate > 0)
+        text << ", " << std::fixed << std::setprecision(1) << rate << " "
+            << what_ << "/s";
+    const double eta = counter_.eta();
+    if (eta >= 0)
+        text << ", " << (long)(eta+0.5) << " s left";
+    listener_->status(text.str());
+}
@@ -0,0 +1,89 @@
+#ifndef PROGRESS_HPP
+#define PROGRESS_HPP
+
+/** \file progress.hpp
+ *  \brief Progress of long computations, cheap enough for inner loops.
+ *
+ *  Workers only increment their own atomic counter.  A ProgressReporter
+ *  thread adds the counters up a few times a second and passes percentage,
+ *  speed and the estimated remaining time to a ProgressListener, so the
+ *  number of reports doesn't depend on the number of bands.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class ProgressListener;
+
+/// Counts the work units (e.g. bands) done by up to max_workers threads.
+class ProgressCounter
+{
+    public:
+        static const int max_workers = 32;
+
+        /// \param total Number of units of the whole job.
+        explicit ProgressCounter(long total = 0);
+        /// Records units done by a worker, never blocks.
+        void advance(int worker = 0, long units = 1)
+        {
+            workers_[worker % max_workers].done.fetch_add(units,
+                    std::memory_order_relaxed);
+        }
+        /// Units done by all workers.
+        long done() const;
+        long total() const;
+        /// Seconds since the counter was created.
+        double elapsed() const;
+        /// Units done per second so far.
+        double rate() const;
+        /// Estimated seconds to finish, negative if unknown yet.
+        double eta() const;
+    private:
+        /// Counters of different workers don't share a cache line.
+        struct alignas(64) Worker
+        {
+            std::atomic<long> done;
+        };
+        Worker workers_[max_workers];
+        long total_;
+        std::chrono::steady_clock::time_point start_;
+};
+
+/// Reports a ProgressCounter to a listener at a fixed rate.
+/** The reports come from a thread of the reporter, which runs while the
+ * object exists: one when it starts, then one per period and a final one
+ * when it's destroyed.  Nothing is started for a null listener. */
+class ProgressReporter
+{
+    public:
+        /// \param what Description of the units, e.g. "bands".
+        /// \param from, to Range of percents the counter is mapped to.
+        /// \param hz Number of reports per second.
+        ProgressReporter(ProgressListener* listener,
+                const ProgressCounter& counter, const std::string& what,
+                int from = 0, int to = 100, double hz = 20);
+        /// Sends the final report and stops the thread.
+        ~ProgressReporter();
+    private:
+        ProgressReporter(const ProgressReporter&);
+        ProgressReporter& operator=(const ProgressReporter&);
+        void run();
+        void report();
+
+        ProgressListener* listener_;
+        const ProgressCounter& counter_;
+        std::string what_;
+        int from_;
+        int to_;
+        std::chrono::microseconds period_;
+        bool stop_;
+        std::mutex mutex_;
+        std::condition_variable wakeup_;
+        std::thread thread_;
+};
+
+#endif
@@ -0,0 +1,108 @@
+#include "resultcache.hpp"
+#include "dsp.hpp"
+#include "fft.hpp"
+
+#include <cstdlib>
+#include <algorithm>
+#include <utime.h>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFileInfo>
+#include <QTemporaryFile>
+#include <QTextStream>
+
+ResultCache::ResultCache()
+    : directory_(QString::fromLocal8Bit(std::getenv("SPECTROGRAM_RESULT_CACHE")))
+    , max_bytes_(1024 << 20)
+{
+}
+
+ResultCache::ResultCache(const QString& directory, qint64 max_bytes)
+    : directory_(directory)
+    , max_bytes_(max_bytes)
+{
+}
+
+bool ResultCache::enabled() const
+{
+    return !directory_.isEmpty();
+}
+
+QByteArray ResultCache::key(const SpectrogramEngine& engine,
+        const float* signal, size_t samples, int samplerate, int channel)
+{
+    // the width of the image follows the size the transforms pad the
+    // decimated signal to, which measured FFT costs can change
+    const int factor = decimation_factor(samplerate, engine.maxfreq);
+    const size_t decimated = factor > 1 ?
+        (samples+factor-1)/factor : samples;
+    QString header;
+    QTextStream(&header) << SpectrogramEngine::version << '\n'
+        << QString::fromStdString(engine.serialize()) << '\n'
+        << (int)engine.correction << '\n'
+        << samplerate << '\n'
+        << channel << '\n'
+        << samples << '\n'
+        << (qulonglong)padded_length(decimated);
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(header.toUtf8());
+    const std::vector<rgb_t>& colors = engine.palette.colors();
+    hash.addData((const char*)&colors[0], colors.size()*sizeof(rgb_t));
+    const size_t chunk = 1 << 22; // addData() takes an int length
+    for (size_t i = 0; i < samples; i += chunk)
+        hash.addData((const char*)(signal+i),
+                std::min(chunk, samples-i)*sizeof(float));
+    return hash.result().toHex();
+}
+
+QString ResultCache::path(const QByteArray& key) const
+{
+    return QDir(directory_).filePath(key + ".png");
+}
+
+QString ResultCache::lookup(const QByteArray& key) const
+{
+    const QString file = path(key);
+    if (!QFileInfo(file).isFile())
+        return QString();
+    // the modification time tells eviction which images are in use
+    utime(QFile::encodeName(file).constData(), 0);
+    return file;
+}
+
+bool ResultCache::store(const QByteArray& key, const QImage& image) const
+{
+    if (!QDir().mkpath(directory_))
+        return false;
+
+    // write to a temporary file first, so readers never see a partial image
+    QTemporaryFile tmp(QDir(directory_).filePath("png-XXXXXX.tmp"));
+    if (!tmp.open() || !image.save(&tmp, "PNG") || !tmp.flush())
+        return false;
+
+    const QString target = path(key);
+    tmp.setAutoRemove(false);
+    QFile::remove(target);
+    if (!tmp.rename(target))
+    {
+        tmp.remove();
+        return false;
+    }
+    evict();
+    return true;
+}
+
+void ResultCache::evict() const
+{
+    // newest first
+    const QFileInfoList files = QDir(directory_).entryInfoList(
+            QStringList("*.png"), QDir::Files, QDir::Time);
+    qint64 bytes = 0;
+    for (int i = 0; i < files.size(); ++i)
+    {
+        bytes += files[i].size();
+        if (bytes > max_bytes_ && i > 0)
+            QFile::remove(files[i].filePath());
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef RESULTCACHE_HPP
+#define RESULTCACHE_HPP
+
+/** \file resultcache.hpp
+ *  \brief On-disk cache of rendered spectrogram images.
+ */
+
+#include <QString>
+#include <QByteArray>
+#include <QImage>
+#include "engine.hpp"
+
+/// Keeps rendered spectrograms on disk, addressed by what they depend on.
+/** The key is a hash of the analyzed samples, the channel, the parameters,
+ * the palette colors and SpectrogramEngine::version, so the same spectrogram
+ * is found no matter which file or program it came from.  Images are written
+ * atomically and the least recently used ones are removed when the
+ * directory grows over its size limit. */
+class ResultCache
+{
+    public:
+        /// Uses the directory from $SPECTROGRAM_RESULT_CACHE, if it is set.
+        ResultCache();
+        ResultCache(const QString& directory, qint64 max_bytes = 1024 << 20);
+        /// Returns true if the cache has a directory to work with.
+        bool enabled() const;
+        /// Computes the key of the spectrogram of a signal.
+        static QByteArray key(const SpectrogramEngine& engine,
+                const float* signal, size_t samples, int samplerate,
+                int channel);
+        /// Returns the file holding the cached image, or a null string.
+        QString lookup(const QByteArray& key) const;
+        /// Stores an image, returns false if it couldn't be written.
+        bool store(const QByteArray& key, const QImage& image) const;
+    private:
+        QString path(const QByteArray& key) const;
+        /// Removes the least recently used images over the size limit.
+        void evict() const;
+        QString directory_;
+        qint64 max_bytes_;
+};
+
+#endif
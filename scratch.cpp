@@ -0,0 +1,115 @@
+#include "scratch.hpp"
+#include "instrument.hpp"
+#include "memory.hpp"
+#include "fftbackend.hpp"
+
+#include <cassert>
+#include <algorithm>
+#include <new>
+
+ScratchArena& ScratchArena::local()
+{
+    thread_local ScratchArena arena;
+    return arena;
+}
+
+ScratchArena::ScratchArena()
+    : used_(0)
+    , demand_(0)
+    , peak_(0)
+    , frames_(0)
+{
+    block_.data = 0;
+    block_.bytes = 0;
+    block_.stage = 0;
+    overflows_.reserve(16);
+}
+
+ScratchArena::~ScratchArena()
+{
+    assert(!frames_);
+    free(block_);
+}
+
+void ScratchArena::reserve(size_t bytes)
+{
+    if (used_ || bytes <= block_.bytes)
+        return;
+    free(block_);
+    block_ = allocate(bytes);
+}
+
+size_t ScratchArena::capacity() const
+{
+    return block_.bytes;
+}
+
+void* ScratchArena::take(size_t bytes)
+{
+    demand_ += bytes;
+    peak_ = std::max(peak_, demand_);
+    if (used_ + bytes <= block_.bytes)
+    {
+        void* result = block_.data + used_;
+        used_ += bytes;
+        return result;
+    }
+    Profiler::count("scratch.overflows");
+    overflows_.push_back(allocate(bytes));
+    return overflows_.back().data;
+}
+
+void ScratchArena::rewind(size_t used, size_t overflows, size_t demand)
+{
+    while (overflows_.size() > overflows)
+    {
+        free(overflows_.back());
+        overflows_.pop_back();
+    }
+    used_ = used;
+    demand_ = demand;
+    assert(frames_ > 0);
+    if (--frames_ == 0 && std::max(peak_, block_.bytes) > max_retained)
+    {
+        free(block_);
+        block_.data = 0;
+        block_.bytes = 0;
+        peak_ = 0;
+    }
+    else if (!used_ && peak_ > block_.bytes)
+        reserve(peak_);
+}
+
+ScratchArena::Block ScratchArena::allocate(size_t bytes)
+{
+    Profiler::allocated(bytes);
+    Block block;
+    block.data = static_cast<char*>(fft_malloc(bytes));
+    if (!block.data)
+        throw std::bad_alloc();
+    block.bytes = bytes;
+    block.stage = MemoryTracker::add(bytes);
+    return block;
+}
+
+void ScratchArena::free(const Block& block)
+{
+    if (!block.data)
+        return;
+    MemoryTracker::remove(block.bytes, block.stage);
+    fft_free(block.data);
+}
+
+ScratchArena::Frame::Frame(ScratchArena& arena)
+    : arena_(arena)
+    , used_(arena.used_)
+    , overflows_(arena.overflows_.size())
+    , demand_(arena.demand_)
+{
+    ++arena_.frames_;
+}
+
+ScratchArena::Frame::~Frame()
+{
+    arena_.rewind(used_, overflows_, demand_);
+}
@@ -0,0 +1,100 @@
+#ifndef SCRATCH_HPP
+#define SCRATCH_HPP
+
+/** \file scratch.hpp
+ *  \brief Reusable memory for the temporaries of band processing.
+ *
+ *  Every band of a spectrogram needs a few buffers of about the same size:
+ *  a copy of the band, the phase shifted copy, two inverse transforms and
+ *  so on.  Instead of allocating them for each band, the kernels take them
+ *  from the ScratchArena of their thread, which keeps its memory from band
+ *  to band.  The engine reserves what the widest band needs before the
+ *  first one, after that the bands don't touch the heap.
+ */
+
+#include <cstddef>
+#include <vector>
+
+/// Per-thread stack of SIMD-aligned buffers.
+/** Buffers are taken inside a Frame and returned when the frame ends.
+ * When a frame needs more than the arena holds, the rest is allocated
+ * separately; the arena grows to the largest demand once none of its
+ * buffers are in use, so this happens only for the first band of a size.
+ *
+ * When the outermost frame of a thread ends, an arena larger than
+ * max_retained is freed, so a long running process doesn't keep the
+ * temporaries of its longest job. */
+class ScratchArena
+{
+    public:
+        /// Alignment of every buffer, enough for the FFT backends and AVX-512.
+        static const size_t alignment = 64;
+        /// Bytes kept between the jobs of a thread.
+        static const size_t max_retained = 16 << 20;
+
+        /// Returns the arena of the calling thread.
+        static ScratchArena& local();
+        /// Returns the bytes a buffer of n elements takes from an arena.
+        template <class T>
+        static size_t bytes(size_t n)
+        {
+            return (n*sizeof(T) + alignment-1) & ~(alignment-1);
+        }
+
+        ScratchArena();
+        ~ScratchArena();
+        /// Makes room for bytes without further allocations.
+        /** Only has an effect while none of the buffers are taken. */
+        void reserve(size_t bytes);
+        /// Bytes the arena holds.
+        size_t capacity() const;
+
+        /// Scope of buffers taken from an arena.
+        /** Frames nest, each one gives back what was taken since it began. */
+        class Frame
+        {
+            public:
+                explicit Frame(ScratchArena& arena = ScratchArena::local());
+                ~Frame();
+                /// Returns an uninitialized buffer of n elements.
+                template <class T>
+                T* take(size_t n)
+                {
+                    return static_cast<T*>(arena_.take(bytes<T>(n)));
+                }
+            private:
+                Frame(const Frame&);
+                Frame& operator=(const Frame&);
+                ScratchArena& arena_;
+                size_t used_;
+                size_t overflows_;
+                size_t demand_;
+        };
+
+    private:
+        ScratchArena(const ScratchArena&);
+        ScratchArena& operator=(const ScratchArena&);
+
+        /// A buffer allocated beyond the capacity.
+        struct Block
+        {
+            char* data;
+            size_t bytes;
+            size_t stage;
+        };
+
+        void* take(size_t bytes);
+        void rewind(size_t used, size_t overflows, size_t demand);
+        static Block allocate(size_t bytes);
+        static void free(const Block& block);
+
+        Block block_;
+        size_t used_;
+        std::vector<Block> overflows_;
+        /// Bytes taken including the overflows, and their maximum.
+        size_t demand_;
+        size_t peak_;
+        int frames_;
+};
+
+#endif
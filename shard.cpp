@@ -0,0 +1,190 @@
+#include "shard.hpp"
+#include "dsp.hpp"
+#include "fft.hpp"
+#include "filterbank.hpp"
+#include "instrument.hpp"
+#include "simd.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+namespace
+{
+    /// Impulse responses of the narrowest band in a guard.
+    const double guard_responses = 8;
+    /// Columns the resampling of the envelopes reaches over.
+    const double resample_reach = 16;
+    /// How much longer than needed a segment may be to fit the columns.
+    const double max_growth = 1.25;
+
+    /// Decimated samples the columns of SpectrogramEngine::analyze() span.
+    size_t span(size_t samples, int factor)
+    {
+        const size_t decimated = factor > 1 ?
+            (samples+factor-1)/factor : samples;
+        return (padded_length(decimated)/2)*2;
+    }
+}
+
+ShardPlan::ShardPlan(const SpectrogramEngine& engine, size_t samples,
+        int samplerate, int shards)
+    : engine_(engine)
+    , samples_(samples)
+    , samplerate_(samplerate)
+    , shards_(shards)
+{
+    assert(shards > 0);
+    const int factor = decimation_factor(samplerate, engine.maxfreq);
+    const double rate = (double)samplerate/factor;
+    // the columns of SpectrogramEngine::analyze()
+    const size_t padded = span(samples, factor);
+    columns_ = padded*engine.pixpersec/rate;
+    hop_ = columns_ ? (double)padded*factor/columns_ : 0;
+
+    // the lowest band is the narrowest one, with the longest response
+    const double scale = 1000; // indices per Hz
+    std::unique_ptr<Filterbank> filterbank = Filterbank::get_filterbank(
+            engine.frequency_axis, scale, engine.basefreq, engine.bandwidth,
+            engine.overlap);
+    const intpair lowest = filterbank->get_band(0);
+    const double hzbandwidth =
+        std::max(lowest.second-lowest.first, 1)/scale;
+    guard_ = std::ceil((guard_responses/hzbandwidth +
+                resample_reach/engine.pixpersec)*samplerate);
+    if (factor > 1)
+        guard_ += decimation_reach(factor, engine.maxfreq, samplerate);
+
+    // The segments are transform sizes, so the analysis doesn't pad them,
+    // whose columns are closest to a whole number.  Their columns are then
+    // as far apart as those of the whole signal, and starting a segment on
+    // a column of the whole signal puts all of its columns on them.
+    const double column = columns_ ? hop_ : samplerate/engine.pixpersec;
+    const size_t widest = (columns_+shards-1)/shards;
+    const size_t guard_columns = std::ceil(guard_/column);
+    const size_t shortest = std::ceil((widest + 2*guard_columns + 2)*
+            column/factor);
+    size_t best = 0;
+    double best_fraction = 1;
+    for (size_t size = padded_length(shortest);
+            size <= shortest*max_growth; size = padded_length(size+1))
+    {
+        const double columns = size*engine.pixpersec/rate;
+        const double fraction = columns - std::floor(columns);
+        if (size%2 == 0 && (!best || fraction < best_fraction))
+        {
+            best = size;
+            best_fraction = fraction;
+        }
+    }
+    if (!best)
+        best = padded_length(shortest + shortest%2);
+    segment_ = best*factor;
+    const size_t segment_columns = best*engine.pixpersec/rate;
+    segment_hop_ = (double)best*factor/segment_columns;
+    lead_ = std::ceil(guard_/segment_hop_);
+}
+
+int ShardPlan::shards() const
+{
+    return shards_;
+}
+
+size_t ShardPlan::columns() const
+{
+    return columns_;
+}
+
+size_t ShardPlan::first_column(int shard) const
+{
+    return columns_*shard/shards_;
+}
+
+size_t ShardPlan::guard() const
+{
+    return guard_;
+}
+
+size_t ShardPlan::segment_length() const
+{
+    return segment_;
+}
+
+long ShardPlan::segment_start(int shard) const
+{
+    // the guard of whole columns of the segment before the first column,
+    // and a multiple of the decimation factor, like the samples the whole
+    // signal is decimated to
+    const int factor = decimation_factor(samplerate_, engine_.maxfreq);
+    const double start = first_column(shard)*hop_ - lead_*segment_hop_;
+    return (long)std::floor(start/factor + 0.5)*factor;
+}
+
+intensity_matrix ShardPlan::analyze(const float* signal, int shard,
+        ProgressListener* listener, const CancelToken* cancel) const
+{
+    assert(shard >= 0 && shard < shards_);
+    const long start = segment_start(shard);
+    const long end = start + (long)segment_;
+    intensity_matrix raw;
+    if (start >= 0 && end <= (long)samples_)
+        raw = engine_.analyze_raw(signal + start, segment_, samplerate_,
+                listener, cancel);
+    else
+    {
+        // the ends of the signal, padded with zeros
+        real_vec segment(segment_);
+        const long from = std::max(start, 0L);
+        const long to = std::min(end, (long)samples_);
+        if (from < to)
+            std::copy(signal + from, signal + to,
+                    segment.begin() + (from-start));
+        raw = engine_.analyze_raw(segment.data(), segment_, samplerate_,
+                listener, cancel);
+    }
+    if (raw.empty())
+        return raw;
+
+    ScopedTimer timer("shard.crop");
+    const size_t first = first_column(shard);
+    const size_t count = first_column(shard+1) - first;
+    const size_t last = raw[0].size()-1;
+    assert(last > 0);
+    // the columns of the whole signal fall between those of the segment
+    std::vector<size_t> left(count);
+    real_vec fraction(count);
+    for (size_t j = 0; j < count; ++j)
+    {
+        const double x = ((first+j)*hop_ - start)/segment_hop_;
+        left[j] = std::min((size_t)x, last-1);
+        fraction[j] = std::min(x - left[j], 1.0);
+    }
+    intensity_matrix data(raw.size());
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        data[i].resize(count);
+        const float* row = raw[i].data();
+        for (size_t j = 0; j < count; ++j)
+            data[i][j] = row[left[j]] +
+                fraction[j]*(row[left[j]+1] - row[left[j]]);
+    }
+    return data;
+}
+
+float shard_peak(const intensity_matrix& data)
+{
+    float peak = 0;
+    for (size_t i = 0; i < data.size(); ++i)
+        if (!data[i].empty())
+            peak = std::max(simd::max(&data[i][0], data[i].size()), peak);
+    return peak;
+}
+
+void normalize_shard(intensity_matrix& data, float peak)
+{
+    if (peak == 0)
+        return;
+    for (size_t i = 0; i < data.size(); ++i)
+        if (!data[i].empty())
+            simd::abs_divide(&data[i][0], data[i].size(), peak);
+}
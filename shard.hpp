@@ -0,0 +1,79 @@
+#ifndef SHARD_HPP
+#define SHARD_HPP
+
+/** \file shard.hpp
+ *  \brief Analysis of a long signal in parts, by separate processes.
+ *
+ *  A recording of several days takes hours to analyze at once, and all of
+ *  it has to fit in the memory of one machine.  ShardPlan divides the
+ *  columns of its spectrogram into shards instead, which independent
+ *  processes analyze, on other machines too.
+ *
+ *  A shard analyzes a segment of the signal: the samples of its columns and
+ *  a guard on each side.  The guard is several times the impulse response
+ *  of the narrowest, lowest band of the filterbank, which is the longest,
+ *  plus the reach of the decimation and of the column resampling, so the
+ *  columns between the guards hardly notice where the segment was cut.
+ *  The guards are cropped.  The length of the segments is chosen so that
+ *  their columns are as far apart as those of the whole spectrogram, and
+ *  the remaining offset is interpolated.
+ *
+ *  All segments are equally long, so the shards have the same rows and the
+ *  same scale of intensities.  They are left unnormalized: the loudest
+ *  intensity of the whole signal is known only when the shards are stitched
+ *  together, and all of them are normalized by it.
+ */
+
+#include "engine.hpp"
+
+/// Division of the analysis of a signal into shards.
+class ShardPlan
+{
+    public:
+        /// Plans the analysis of samples at samplerate in shards.
+        ShardPlan(const SpectrogramEngine& engine, size_t samples,
+                int samplerate, int shards);
+        int shards() const;
+        /// Number of columns of the whole spectrogram.
+        /** It is the width SpectrogramEngine::analyze() gives the signal. */
+        size_t columns() const;
+        /// The first column of a shard, first_column(shards()) is columns().
+        size_t first_column(int shard) const;
+        /// Samples of the guard on each side of the columns of a shard.
+        size_t guard() const;
+        /// Samples of the segments, the same for all shards.
+        size_t segment_length() const;
+        /// Index of the first sample of the segment of a shard.
+        /** It is negative for the first shard, the samples outside of the
+         * signal count as zeros. */
+        long segment_start(int shard) const;
+        /// Computes the intensities of the columns of a shard.
+        /** \param signal The whole signal, only the segment is read.
+         * \return rows of the columns from first_column(shard) on, not
+         * normalized, or empty data if the token was cancelled. */
+        intensity_matrix analyze(const float* signal, int shard,
+                ProgressListener* listener = 0,
+                const CancelToken* cancel = 0) const;
+
+    private:
+        SpectrogramEngine engine_;
+        size_t samples_;
+        int samplerate_;
+        int shards_;
+        size_t columns_;
+        /// Samples between the columns of the whole signal.
+        double hop_;
+        /// Samples between the columns of a segment.
+        double segment_hop_;
+        size_t guard_;
+        size_t segment_;
+        /// Columns of a segment before those of its shard.
+        size_t lead_;
+};
+
+/// Returns the loudest intensity of unnormalized columns.
+float shard_peak(const intensity_matrix& data);
+/// Normalizes the columns of a shard by the loudest of all the shards.
+void normalize_shard(intensity_matrix& data, float peak);
+
+#endif
@@ -0,0 +1,240 @@
+#include "simd.hpp"
+
+// the same rounding as the vector kernels, even with -march=native
+#ifdef __clang__
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef SIMD_X86
+namespace simd
+{
+    // simd_x86.cpp
+    extern const Kernels sse2_kernels;
+    extern const Kernels avx2_kernels;
+    extern const Kernels avx512_kernels;
+}
+#endif
+
+namespace
+{
+    using simd::Kernels;
+    using simd::Level;
+
+    void magnitude(const float* re, const float* im, float* out, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+            out[i] = std::sqrt(re[i]*re[i] + im[i]*im[i]);
+    }
+
+    void scale_complex(float* complex, const float* coefs, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            complex[2*i] *= coefs[i];
+            complex[2*i+1] *= coefs[i];
+        }
+    }
+
+    float max(const float* x, size_t n)
+    {
+        float result = x[0];
+        for (size_t i = 1; i < n; ++i)
+            result = std::max(result, x[i]);
+        return result;
+    }
+
+    float max_abs(const float* x, size_t n)
+    {
+        float result = 0;
+        for (size_t i = 0; i < n; ++i)
+            result = std::max(result, std::abs(x[i]));
+        return result;
+    }
+
+    void abs_divide(float* x, size_t n, float divisor)
+    {
+        for (size_t i = 0; i < n; ++i)
+            x[i] = std::abs(x[i])/divisor;
+    }
+
+    void divide(float* x, size_t n, float divisor)
+    {
+        for (size_t i = 0; i < n; ++i)
+            x[i] /= divisor;
+    }
+
+    void multiply_add(float* out, const float* a, const float* b, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+            out[i] += a[i]*b[i];
+    }
+
+    void carrier(const float* envelope, size_t n, const float* sines,
+            float* out)
+    {
+        for (size_t i = 0; i < 2*n; ++i)
+            out[i] = envelope[i/2]*sines[i%4];
+    }
+
+    float dot(const float* a, const float* b, size_t n)
+    {
+        float sum = 0;
+        for (size_t i = 0; i < n; ++i)
+            sum += a[i]*b[i];
+        return sum;
+    }
+
+    const Kernels scalar_kernels = {magnitude, scale_complex, max, max_abs,
+        abs_divide, divide, multiply_add, carrier, dot};
+
+    const char* const names[simd::level_count] = {"scalar", "sse2", "avx2",
+        "avx512"};
+
+    bool cpu_supports(Level level)
+    {
+#ifdef SIMD_X86
+        switch (level)
+        {
+            case simd::LEVEL_SCALAR:
+                return true;
+            case simd::LEVEL_SSE2:
+                return __builtin_cpu_supports("sse2");
+            case simd::LEVEL_AVX2:
+                return __builtin_cpu_supports("avx2") &&
+                    __builtin_cpu_supports("fma");
+            case simd::LEVEL_AVX512:
+                return __builtin_cpu_supports("avx512f");
+        }
+        return false;
+#else
+        return level == simd::LEVEL_SCALAR;
+#endif
+    }
+
+    const Kernels* table(Level level)
+    {
+#ifdef SIMD_X86
+        switch (level)
+        {
+            case simd::LEVEL_SSE2:
+                return &simd::sse2_kernels;
+            case simd::LEVEL_AVX2:
+                return &simd::avx2_kernels;
+            case simd::LEVEL_AVX512:
+                return &simd::avx512_kernels;
+            default:
+                break;
+        }
+#endif
+        return &scalar_kernels;
+    }
+
+    /// The best supported level, or the one asked for in $SPECTROGRAM_SIMD.
+    Level initial_level()
+    {
+        int best = simd::LEVEL_SCALAR;
+        while (best+1 < simd::level_count && cpu_supports((Level)(best+1)))
+            ++best;
+        const char* wanted = std::getenv("SPECTROGRAM_SIMD");
+        for (int i = 0; wanted && i < best; ++i)
+            if (std::strcmp(wanted, names[i]) == 0)
+                return (Level)i;
+        return (Level)best;
+    }
+
+    std::atomic<int> current(-1);
+
+    const Kernels& active()
+    {
+        int level = current.load(std::memory_order_relaxed);
+        if (level < 0)
+        {
+            level = initial_level();
+            current.store(level, std::memory_order_relaxed);
+        }
+        return *table((Level)level);
+    }
+}
+
+const char* simd::level_name(Level level)
+{
+    return names[level];
+}
+
+bool simd::supported(Level level)
+{
+    return cpu_supports(level);
+}
+
+simd::Level simd::level()
+{
+    active();
+    return (Level)current.load(std::memory_order_relaxed);
+}
+
+bool simd::set_level(Level level)
+{
+    if (!supported(level))
+        return false;
+    current.store(level, std::memory_order_relaxed);
+    return true;
+}
+
+const simd::Kernels& simd::kernels(Level level)
+{
+    return *table(level);
+}
+
+void simd::magnitude(const float* re, const float* im, float* out, size_t n)
+{
+    active().magnitude(re, im, out, n);
+}
+
+void simd::scale_complex(float* complex, const float* coefs, size_t n)
+{
+    active().scale_complex(complex, coefs, n);
+}
+
+float simd::max(const float* x, size_t n)
+{
+    return active().max(x, n);
+}
+
+float simd::max_abs(const float* x, size_t n)
+{
+    return active().max_abs(x, n);
+}
+
+void simd::abs_divide(float* x, size_t n, float divisor)
+{
+    active().abs_divide(x, n, divisor);
+}
+
+void simd::divide(float* x, size_t n, float divisor)
+{
+    active().divide(x, n, divisor);
+}
+
+void simd::multiply_add(float* out, const float* a, const float* b, size_t n)
+{
+    active().multiply_add(out, a, b, n);
+}
+
+void simd::carrier(const float* envelope, size_t n, const float* sines,
+        float* out)
+{
+    active().carrier(envelope, n, sines, out);
+}
+
+float simd::dot(const float* a, const float* b, size_t n)
+{
+    return active().dot(a, b, n);
+}
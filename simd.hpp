@@ -0,0 +1,88 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+/** \file simd.hpp
+ *  \brief Vectorized float kernels of the DSP inner loops.
+ *
+ *  Every kernel has a scalar reference implementation and, on x86, SSE2,
+ *  AVX2 and AVX-512 variants.  The best variant the CPU supports is chosen
+ *  when a kernel is first called, the \c SPECTROGRAM_SIMD environment
+ *  variable (scalar, sse2, avx2 or avx512) can ask for a lower one.
+ *
+ *  The element-wise kernels give the same results at every level.  dot(),
+ *  which adds the products in a different order, may differ in the last
+ *  bits.
+ */
+
+#include <cstddef>
+
+/// Defined where the x86 kernels are built (simd_x86.cpp).
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86
+#endif
+
+namespace simd
+{
+    /// Instruction sets with their own kernels, from the slowest.
+    enum Level
+    {
+        LEVEL_SCALAR,
+        LEVEL_SSE2,
+        LEVEL_AVX2,
+        LEVEL_AVX512
+    };
+    const int level_count = 4;
+
+    /// The implementations of the kernels for one level.
+    struct Kernels
+    {
+        void (*magnitude)(const float* re, const float* im, float* out,
+                size_t n);
+        void (*scale_complex)(float* complex, const float* coefs, size_t n);
+        float (*max)(const float* x, size_t n);
+        float (*max_abs)(const float* x, size_t n);
+        void (*abs_divide)(float* x, size_t n, float divisor);
+        void (*divide)(float* x, size_t n, float divisor);
+        void (*multiply_add)(float* out, const float* a, const float* b,
+                size_t n);
+        void (*carrier)(const float* envelope, size_t n, const float* sines,
+                float* out);
+        float (*dot)(const float* a, const float* b, size_t n);
+    };
+
+    /// Returns the name of a level, as used by SPECTROGRAM_SIMD.
+    const char* level_name(Level level);
+    /// Returns true if the CPU and the build support the level.
+    bool supported(Level level);
+    /// Returns the level of the kernels in use.
+    Level level();
+    /// Switches to the kernels of another level, e.g. for benchmarks.
+    /** \return false if the level isn't supported, nothing changes then. */
+    bool set_level(Level level);
+    /// Returns the kernels of a supported level.
+    const Kernels& kernels(Level level);
+
+    /// out[i] = sqrt(re[i]^2 + im[i]^2)
+    void magnitude(const float* re, const float* im, float* out, size_t n);
+    /// Multiplies n interleaved complex values by real coefficients.
+    void scale_complex(float* complex, const float* coefs, size_t n);
+    /// Returns the largest value, n > 0.
+    float max(const float* x, size_t n);
+    /// Returns the largest absolute value, 0 for n == 0.
+    float max_abs(const float* x, size_t n);
+    /// x[i] = |x[i]| / divisor
+    void abs_divide(float* x, size_t n, float divisor);
+    /// x[i] = x[i] / divisor
+    void divide(float* x, size_t n, float divisor);
+    /// out[i] += a[i] * b[i]
+    void multiply_add(float* out, const float* a, const float* b, size_t n);
+    /// out[4k+j] = envelope[2k+j/2] * sines[j], for 2n output samples.
+    /** This is the modulation of a sine at a quarter of the samplerate,
+     * whose samples repeat with a period of 4. */
+    void carrier(const float* envelope, size_t n, const float* sines,
+            float* out);
+    /// Returns the sum of a[i] * b[i].
+    float dot(const float* a, const float* b, size_t n);
+}
+
+#endif
@@ -0,0 +1,532 @@
+/** \file simd_x86.cpp
+ * \brief SSE2, AVX2 and AVX-512 variants of the kernels in simd.hpp.
+ *
+ * The functions are compiled for their instruction set with the target
+ * attribute, so the rest of the program keeps the default flags and runs
+ * on any x86 CPU.  Only the kernels the CPU supports are ever called.
+ * Element-wise kernels do the same operations as the scalar ones, without
+ * fused multiply-adds, so their results are identical.
+ */
+
+#include "simd.hpp"
+
+#ifdef SIMD_X86
+
+// a*b+c must not become a fused multiply-add, which rounds differently
+#ifdef __clang__
+#pragma STDC FP_CONTRACT OFF
+#else
+#pragma GCC optimize("fp-contract=off")
+// false positives in the AVX-512 headers of GCC 12
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+#include <immintrin.h>
+#include <algorithm>
+#include <cmath>
+
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+
+namespace
+{
+    // scalar remainders of the vector loops
+
+    inline void magnitude_tail(const float* re, const float* im, float* out,
+            size_t i, size_t n)
+    {
+        for (; i < n; ++i)
+            out[i] = std::sqrt(re[i]*re[i] + im[i]*im[i]);
+    }
+
+    inline void scale_complex_tail(float* complex, const float* coefs,
+            size_t i, size_t n)
+    {
+        for (; i < n; ++i)
+        {
+            complex[2*i] *= coefs[i];
+            complex[2*i+1] *= coefs[i];
+        }
+    }
+
+    inline float max_tail(const float* x, size_t i, size_t n, float result)
+    {
+        for (; i < n; ++i)
+            result = std::max(result, x[i]);
+        return result;
+    }
+
+    inline float max_abs_tail(const float* x, size_t i, size_t n,
+            float result)
+    {
+        for (; i < n; ++i)
+            result = std::max(result, std::abs(x[i]));
+        return result;
+    }
+
+    inline void abs_divide_tail(float* x, size_t i, size_t n, float divisor)
+    {
+        for (; i < n; ++i)
+            x[i] = std::abs(x[i])/divisor;
+    }
+
+    inline void divide_tail(float* x, size_t i, size_t n, float divisor)
+    {
+        for (; i < n; ++i)
+            x[i] /= divisor;
+    }
+
+    inline void multiply_add_tail(float* out, const float* a, const float* b,
+            size_t i, size_t n)
+    {
+        for (; i < n; ++i)
+            out[i] += a[i]*b[i];
+    }
+
+    /// \param i Index of the first envelope sample, a multiple of 2.
+    inline void carrier_tail(const float* envelope, const float* sines,
+            float* out, size_t i, size_t n)
+    {
+        for (size_t j = 2*i; j < 2*n; ++j)
+            out[j] = envelope[j/2]*sines[j%4];
+    }
+
+    inline float dot_tail(const float* a, const float* b, size_t i, size_t n,
+            float sum)
+    {
+        for (; i < n; ++i)
+            sum += a[i]*b[i];
+        return sum;
+    }
+
+    // SSE2
+
+    TARGET_SSE2 inline float sse2_hmax(__m128 v)
+    {
+        float lanes[4];
+        _mm_storeu_ps(lanes, v);
+        return std::max(std::max(lanes[0], lanes[1]),
+                std::max(lanes[2], lanes[3]));
+    }
+
+    TARGET_SSE2 inline float sse2_hsum(__m128 v)
+    {
+        float lanes[4];
+        _mm_storeu_ps(lanes, v);
+        return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    }
+
+    TARGET_SSE2 void sse2_magnitude(const float* re, const float* im,
+            float* out, size_t n)
+    {
+        size_t i = 0;
+        for (; i+4 <= n; i += 4)
+        {
+            const __m128 r = _mm_loadu_ps(re+i);
+            const __m128 m = _mm_loadu_ps(im+i);
+            _mm_storeu_ps(out+i, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(r, r),
+                            _mm_mul_ps(m, m))));
+        }
+        magnitude_tail(re, im, out, i, n);
+    }
+
+    TARGET_SSE2 void sse2_scale_complex(float* complex, const float* coefs,
+            size_t n)
+    {
+        size_t i = 0;
+        for (; i+4 <= n; i += 4)
+        {
+            const __m128 c = _mm_loadu_ps(coefs+i);
+            float* x = complex + 2*i;
+            _mm_storeu_ps(x, _mm_mul_ps(_mm_loadu_ps(x),
+                        _mm_unpacklo_ps(c, c)));
+            _mm_storeu_ps(x+4, _mm_mul_ps(_mm_loadu_ps(x+4),
+                        _mm_unpackhi_ps(c, c)));
+        }
+        scale_complex_tail(complex, coefs, i, n);
+    }
+
+    TARGET_SSE2 float sse2_max(const float* x, size_t n)
+    {
+        __m128 result = _mm_set1_ps(x[0]);
+        size_t i = 0;
+        for (; i+4 <= n; i += 4)
+            result = _mm_max_ps(result, _mm_loadu_ps(x+i));
+        return max_tail(x, i, n, sse2_hmax(result));
+    }
+
+    TARGET_SSE2 float sse2_max_abs(const float* x, size_t n)
+    {
+        const __m128 sign = _mm_set1_ps(-0.0f);
+        __m128 result = _mm_setzero_ps();
+        size_t i = 0;
+        for (; i+4 <= n; i += 4)
+            result = _mm_max_ps(result,
+                    _mm_andnot_ps(sign, _mm_loadu_ps(x+i)));
+        return max_abs_tail(x, i, n, sse2_hmax(result));
+    }
+
+    TARGET_SSE2 void sse2_abs_divide(float* x, size_t n, float divisor)
+    {
+        const __m128 sign = _mm_set1_ps(-0.0f);
+        const __m128 d = _mm_set1_ps(divisor);
+        size_t i = 0;
+        for (; i+4 <= n; i += 4)
+            _mm_storeu_ps(x+i, _mm_div_ps(
+                        _mm_andnot_ps(sign, _mm_loadu_ps(x+i)), d));
+        abs_divide_tail(x, i, n, divisor);
+    }
+
+    TARGET_SSE2 void sse2_divide(float* x, size_t n, float divisor)
+    {
+        const __m128 d = _mm_set1_ps(divisor);
+        size_t i = 0;
+        for (; i+4 <= n; i += 4)
+            _mm_storeu_ps(x+i, _mm_div_ps(_mm_loadu_ps(x+i), d));
+        divide_tail(x, i, n, divisor);
+    }
+
+    TARGET_SSE2 void sse2_multiply_add(float* out, const float* a,
+            const float* b, size_t n)
+    {
+        size_t i = 0;
+        for (; i+4 <= n; i += 4)
+            _mm_storeu_ps(out+i, _mm_add_ps(_mm_loadu_ps(out+i),
+                        _mm_mul_ps(_mm_loadu_ps(a+i), _mm_loadu_ps(b+i))));
+        multiply_add_tail(out, a, b, i, n);
+    }
+
+    TARGET_SSE2 void sse2_carrier(const float* envelope, size_t n,
+            const float* sines, float* out)
+    {
+        const __m128 s = _mm_loadu_ps(sines);
+        size_t i = 0;
+        for (; i+4 <= n; i += 4)
+        {
+            const __m128 e = _mm_loadu_ps(envelope+i);
+            _mm_storeu_ps(out+2*i, _mm_mul_ps(_mm_unpacklo_ps(e, e), s));
+            _mm_storeu_ps(out+2*i+4, _mm_mul_ps(_mm_unpackhi_ps(e, e), s));
+        }
+        carrier_tail(envelope, sines, out, i, n);
+    }
+
+    TARGET_SSE2 float sse2_dot(const float* a, const float* b, size_t n)
+    {
+        __m128 sum = _mm_setzero_ps();
+        size_t i = 0;
+        for (; i+4 <= n; i += 4)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(a+i),
+                        _mm_loadu_ps(b+i)));
+        return dot_tail(a, b, i, n, sse2_hsum(sum));
+    }
+
+    // AVX2
+
+    TARGET_AVX2 inline float avx2_hmax(__m256 v)
+    {
+        float lanes[8];
+        _mm256_storeu_ps(lanes, v);
+        return *std::max_element(lanes, lanes+8);
+    }
+
+    TARGET_AVX2 inline float avx2_hsum(__m256 v)
+    {
+        const __m128 half = _mm_add_ps(_mm256_castps256_ps128(v),
+                _mm256_extractf128_ps(v, 1));
+        float lanes[4];
+        _mm_storeu_ps(lanes, half);
+        return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    }
+
+    TARGET_AVX2 void avx2_magnitude(const float* re, const float* im,
+            float* out, size_t n)
+    {
+        size_t i = 0;
+        for (; i+8 <= n; i += 8)
+        {
+            const __m256 r = _mm256_loadu_ps(re+i);
+            const __m256 m = _mm256_loadu_ps(im+i);
+            _mm256_storeu_ps(out+i, _mm256_sqrt_ps(_mm256_add_ps(
+                            _mm256_mul_ps(r, r), _mm256_mul_ps(m, m))));
+        }
+        magnitude_tail(re, im, out, i, n);
+    }
+
+    TARGET_AVX2 void avx2_scale_complex(float* complex, const float* coefs,
+            size_t n)
+    {
+        const __m256i low = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+        const __m256i high = _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7);
+        size_t i = 0;
+        for (; i+8 <= n; i += 8)
+        {
+            const __m256 c = _mm256_loadu_ps(coefs+i);
+            float* x = complex + 2*i;
+            _mm256_storeu_ps(x, _mm256_mul_ps(_mm256_loadu_ps(x),
+                        _mm256_permutevar8x32_ps(c, low)));
+            _mm256_storeu_ps(x+8, _mm256_mul_ps(_mm256_loadu_ps(x+8),
+                        _mm256_permutevar8x32_ps(c, high)));
+        }
+        scale_complex_tail(complex, coefs, i, n);
+    }
+
+    TARGET_AVX2 float avx2_max(const float* x, size_t n)
+    {
+        __m256 result = _mm256_set1_ps(x[0]);
+        size_t i = 0;
+        for (; i+8 <= n; i += 8)
+            result = _mm256_max_ps(result, _mm256_loadu_ps(x+i));
+        return max_tail(x, i, n, avx2_hmax(result));
+    }
+
+    TARGET_AVX2 float avx2_max_abs(const float* x, size_t n)
+    {
+        const __m256 sign = _mm256_set1_ps(-0.0f);
+        __m256 result = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i+8 <= n; i += 8)
+            result = _mm256_max_ps(result,
+                    _mm256_andnot_ps(sign, _mm256_loadu_ps(x+i)));
+        return max_abs_tail(x, i, n, avx2_hmax(result));
+    }
+
+    TARGET_AVX2 void avx2_abs_divide(float* x, size_t n, float divisor)
+    {
+        const __m256 sign = _mm256_set1_ps(-0.0f);
+        const __m256 d = _mm256_set1_ps(divisor);
+        size_t i = 0;
+        for (; i+8 <= n; i += 8)
+            _mm256_storeu_ps(x+i, _mm256_div_ps(
+                        _mm256_andnot_ps(sign, _mm256_loadu_ps(x+i)), d));
+        abs_divide_tail(x, i, n, divisor);
+    }
+
+    TARGET_AVX2 void avx2_divide(float* x, size_t n, float divisor)
+    {
+        const __m256 d = _mm256_set1_ps(divisor);
+        size_t i = 0;
+        for (; i+8 <= n; i += 8)
+            _mm256_storeu_ps(x+i, _mm256_div_ps(_mm256_loadu_ps(x+i), d));
+        divide_tail(x, i, n, divisor);
+    }
+
+    TARGET_AVX2 void avx2_multiply_add(float* out, const float* a,
+            const float* b, size_t n)
+    {
+        size_t i = 0;
+        for (; i+8 <= n; i += 8)
+            _mm256_storeu_ps(out+i, _mm256_add_ps(_mm256_loadu_ps(out+i),
+                        _mm256_mul_ps(_mm256_loadu_ps(a+i),
+                            _mm256_loadu_ps(b+i))));
+        multiply_add_tail(out, a, b, i, n);
+    }
+
+    TARGET_AVX2 void avx2_carrier(const float* envelope, size_t n,
+            const float* sines, float* out)
+    {
+        const __m256i low = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+        const __m256i high = _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7);
+        const __m128 s4 = _mm_loadu_ps(sines);
+        const __m256 s = _mm256_insertf128_ps(_mm256_castps128_ps256(s4),
+                s4, 1);
+        size_t i = 0;
+        for (; i+8 <= n; i += 8)
+        {
+            const __m256 e = _mm256_loadu_ps(envelope+i);
+            _mm256_storeu_ps(out+2*i, _mm256_mul_ps(
+                        _mm256_permutevar8x32_ps(e, low), s));
+            _mm256_storeu_ps(out+2*i+8, _mm256_mul_ps(
+                        _mm256_permutevar8x32_ps(e, high), s));
+        }
+        carrier_tail(envelope, sines, out, i, n);
+    }
+
+    TARGET_AVX2 float avx2_dot(const float* a, const float* b, size_t n)
+    {
+        __m256 sum0 = _mm256_setzero_ps();
+        __m256 sum1 = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i+16 <= n; i += 16)
+        {
+            sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a+i),
+                    _mm256_loadu_ps(b+i), sum0);
+            sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(a+i+8),
+                    _mm256_loadu_ps(b+i+8), sum1);
+        }
+        if (i+8 <= n)
+        {
+            sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a+i),
+                    _mm256_loadu_ps(b+i), sum0);
+            i += 8;
+        }
+        return dot_tail(a, b, i, n, avx2_hsum(_mm256_add_ps(sum0, sum1)));
+    }
+
+    // AVX-512
+
+    TARGET_AVX512 inline float avx512_hmax(__m512 v)
+    {
+        float lanes[16];
+        _mm512_storeu_ps(lanes, v);
+        return *std::max_element(lanes, lanes+16);
+    }
+
+    TARGET_AVX512 inline float avx512_hsum(__m512 v)
+    {
+        float lanes[16];
+        _mm512_storeu_ps(lanes, v);
+        float sum = 0;
+        for (int i = 0; i < 16; ++i)
+            sum += lanes[i];
+        return sum;
+    }
+
+    TARGET_AVX512 inline __m512 avx512_abs(__m512 v)
+    {
+        return _mm512_castsi512_ps(_mm512_and_epi32(_mm512_castps_si512(v),
+                    _mm512_set1_epi32(0x7fffffff)));
+    }
+
+    TARGET_AVX512 void avx512_magnitude(const float* re, const float* im,
+            float* out, size_t n)
+    {
+        size_t i = 0;
+        for (; i+16 <= n; i += 16)
+        {
+            const __m512 r = _mm512_loadu_ps(re+i);
+            const __m512 m = _mm512_loadu_ps(im+i);
+            _mm512_storeu_ps(out+i, _mm512_sqrt_ps(_mm512_add_ps(
+                            _mm512_mul_ps(r, r), _mm512_mul_ps(m, m))));
+        }
+        magnitude_tail(re, im, out, i, n);
+    }
+
+    TARGET_AVX512 void avx512_scale_complex(float* complex,
+            const float* coefs, size_t n)
+    {
+        const __m512i low = _mm512_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3,
+                4, 4, 5, 5, 6, 6, 7, 7);
+        const __m512i high = _mm512_setr_epi32(8, 8, 9, 9, 10, 10, 11, 11,
+                12, 12, 13, 13, 14, 14, 15, 15);
+        size_t i = 0;
+        for (; i+16 <= n; i += 16)
+        {
+            const __m512 c = _mm512_loadu_ps(coefs+i);
+            float* x = complex + 2*i;
+            _mm512_storeu_ps(x, _mm512_mul_ps(_mm512_loadu_ps(x),
+                        _mm512_permutexvar_ps(low, c)));
+            _mm512_storeu_ps(x+16, _mm512_mul_ps(_mm512_loadu_ps(x+16),
+                        _mm512_permutexvar_ps(high, c)));
+        }
+        scale_complex_tail(complex, coefs, i, n);
+    }
+
+    TARGET_AVX512 float avx512_max(const float* x, size_t n)
+    {
+        __m512 result = _mm512_set1_ps(x[0]);
+        size_t i = 0;
+        for (; i+16 <= n; i += 16)
+            result = _mm512_max_ps(result, _mm512_loadu_ps(x+i));
+        return max_tail(x, i, n, avx512_hmax(result));
+    }
+
+    TARGET_AVX512 float avx512_max_abs(const float* x, size_t n)
+    {
+        __m512 result = _mm512_setzero_ps();
+        size_t i = 0;
+        for (; i+16 <= n; i += 16)
+            result = _mm512_max_ps(result, avx512_abs(_mm512_loadu_ps(x+i)));
+        return max_abs_tail(x, i, n, avx512_hmax(result));
+    }
+
+    TARGET_AVX512 void avx512_abs_divide(float* x, size_t n, float divisor)
+    {
+        const __m512 d = _mm512_set1_ps(divisor);
+        size_t i = 0;
+        for (; i+16 <= n; i += 16)
+            _mm512_storeu_ps(x+i, _mm512_div_ps(
+                        avx512_abs(_mm512_loadu_ps(x+i)), d));
+        abs_divide_tail(x, i, n, divisor);
+    }
+
+    TARGET_AVX512 void avx512_divide(float* x, size_t n, float divisor)
+    {
+        const __m512 d = _mm512_set1_ps(divisor);
+        size_t i = 0;
+        for (; i+16 <= n; i += 16)
+            _mm512_storeu_ps(x+i, _mm512_div_ps(_mm512_loadu_ps(x+i), d));
+        divide_tail(x, i, n, divisor);
+    }
+
+    TARGET_AVX512 void avx512_multiply_add(float* out, const float* a,
+            const float* b, size_t n)
+    {
+        size_t i = 0;
+        for (; i+16 <= n; i += 16)
+            _mm512_storeu_ps(out+i, _mm512_add_ps(_mm512_loadu_ps(out+i),
+                        _mm512_mul_ps(_mm512_loadu_ps(a+i),
+                            _mm512_loadu_ps(b+i))));
+        multiply_add_tail(out, a, b, i, n);
+    }
+
+    TARGET_AVX512 void avx512_carrier(const float* envelope, size_t n,
+            const float* sines, float* out)
+    {
+        const __m512i low = _mm512_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3,
+                4, 4, 5, 5, 6, 6, 7, 7);
+        const __m512i high = _mm512_setr_epi32(8, 8, 9, 9, 10, 10, 11, 11,
+                12, 12, 13, 13, 14, 14, 15, 15);
+        const __m512 s = _mm512_setr_ps(sines[0], sines[1], sines[2],
+                sines[3], sines[0], sines[1], sines[2], sines[3], sines[0],
+                sines[1], sines[2], sines[3], sines[0], sines[1], sines[2],
+                sines[3]);
+        size_t i = 0;
+        for (; i+16 <= n; i += 16)
+        {
+            const __m512 e = _mm512_loadu_ps(envelope+i);
+            _mm512_storeu_ps(out+2*i, _mm512_mul_ps(
+                        _mm512_permutexvar_ps(low, e), s));
+            _mm512_storeu_ps(out+2*i+16, _mm512_mul_ps(
+                        _mm512_permutexvar_ps(high, e), s));
+        }
+        carrier_tail(envelope, sines, out, i, n);
+    }
+
+    TARGET_AVX512 float avx512_dot(const float* a, const float* b, size_t n)
+    {
+        __m512 sum0 = _mm512_setzero_ps();
+        __m512 sum1 = _mm512_setzero_ps();
+        size_t i = 0;
+        for (; i+32 <= n; i += 32)
+        {
+            sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(a+i),
+                    _mm512_loadu_ps(b+i), sum0);
+            sum1 = _mm512_fmadd_ps(_mm512_loadu_ps(a+i+16),
+                    _mm512_loadu_ps(b+i+16), sum1);
+        }
+        if (i+16 <= n)
+        {
+            sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(a+i),
+                    _mm512_loadu_ps(b+i), sum0);
+            i += 16;
+        }
+        return dot_tail(a, b, i, n,
+                avx512_hsum(_mm512_add_ps(sum0, sum1)));
+    }
+}
+
+namespace simd
+{
+    extern const Kernels sse2_kernels = {sse2_magnitude, sse2_scale_complex,
+        sse2_max, sse2_max_abs, sse2_abs_divide, sse2_divide,
+        sse2_multiply_add, sse2_carrier, sse2_dot};
+    extern const Kernels avx2_kernels = {avx2_magnitude, avx2_scale_complex,
+        avx2_max, avx2_max_abs, avx2_abs_divide, avx2_divide,
+        avx2_multiply_add, avx2_carrier, avx2_dot};
+    extern const Kernels avx512_kernels = {avx512_magnitude,
+        avx512_scale_complex, avx512_max, avx512_max_abs, avx512_abs_divide,
+        avx512_divide, avx512_multiply_add, avx512_carrier, avx512_dot};
+}
+
+#endif
@@ -1,10 +1,87 @@
 #include <cassert>
 #include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QTemporaryFile>
+#include <QTextStream>
+#include <QtEndian>
+#include <algorithm>
 #include "soundfile.hpp"
+#include "instrument.hpp"
 
 namespace 
 {
     const size_t MAX_FIXED_T_VAL=std::pow(2.0,(int)(8*sizeof(mad_fixed_t)-1)-1);
+
+    // libsndfile virtual I/O over a MemoryStream
+
+    sf_count_t memory_get_filelen(void* user_data)
+    {
+        return ((MemoryStream*)user_data)->data.size();
+    }
+
+    sf_count_t memory_seek(sf_count_t offset, int whence, void* user_data)
+    {
+        MemoryStream* memory = (MemoryStream*)user_data;
+        sf_count_t position = offset;
+        if (whence == SEEK_CUR)
+            position += memory->position;
+        else if (whence == SEEK_END)
+            position += memory->data.size();
+        if (position < 0 || position > memory->data.size())
+            return -1;
+        memory->position = position;
+        return position;
+    }
+
+    sf_count_t memory_read(void* ptr, sf_count_t count, void* user_data)
+    {
+        MemoryStream* memory = (MemoryStream*)user_data;
+        count = std::min(count, memory->data.size()-memory->position);
+        std::memcpy(ptr, memory->data.constData()+memory->position, count);
+        memory->position += count;
+        return count;
+    }
+
+    sf_count_t memory_write(const void*, sf_count_t, void*)
+    {
+        return 0; // read only
+    }
+
+    sf_count_t memory_tell(void* user_data)
+    {
+        return ((MemoryStream*)user_data)->position;
+    }
+
+    SF_VIRTUAL_IO memory_io = {memory_get_filelen, memory_seek, memory_read,
+        memory_write, memory_tell};
+
+    /// Whether the buffer starts like an MP3 file.
+    /** That is an ID3v2 tag or the sync word of a frame header. */
+    bool looks_like_mp3(const QByteArray& buffer)
+    {
+        if (buffer.startsWith("ID3"))
+            return true;
+        return buffer.size() >= 2 && (unsigned char)buffer[0] == 0xFF &&
+            ((unsigned char)buffer[1] & 0xE0) == 0xE0;
+    }
+
+    /// Header of the PCM cache files, the samples follow right after it.
+    struct PcmCacheHeader
+    {
+        char magic[4];
+        quint32 version; // also detects a different byte order
+        quint32 samplerate;
+        quint32 channel;
+        quint64 samples;
+        quint64 reserved; // pads the header to keep the samples aligned
+    };
+    const char PCM_CACHE_MAGIC[4] = {'S', 'P', 'C', 'M'};
+    const quint32 PCM_CACHE_VERSION = 1;
 }
 
 QString Soundfile::writeSound(const QString& fname, const real_vec& data,
@@ -45,7 +122,6 @@ int Soundfile::guessFormat(const QString& filename)
 }
 
 Soundfile::Soundfile()
-    : data_(NULL)
 {
 }
 
@@ -59,9 +135,55 @@ real_vec Soundfile::read_channel(int channel)
     return data_->read_channel(channel);
 }
 
+real_vec Soundfile::read_channel(int channel, size_t first)
+{
+    assert(!data_.isNull());
+    ScopedTimer timer("decode");
+    if (!data_->mapped())
+        return data_->read_channel_from(channel, first);
+    // only the pages of the new part are read
+    const pcm_buffer mapped = data_->map_channel(channel);
+    if (!mapped || first >= mapped->size())
+        return real_vec();
+    return real_vec(mapped->data() + first, mapped->data() + mapped->size());
+}
+
+pcm_buffer Soundfile::map_channel(int channel)
+{
+    assert(!data_.isNull());
+    if (data_->mapped())
+        return data_->map_channel(channel);
+    if (cache_.enabled() && !filename_.isNull())
+    {
+        pcm_buffer cached = cache_.lookup(filename_, *data_, channel);
+        Profiler::count(cached ? "pcm_cache.hits" : "pcm_cache.misses");
+        if (cached)
+            return cached;
+    }
+
+    real_vec samples;
+    {
+        ScopedTimer timer("decode");
+        samples = data_->read_channel(channel);
+    }
+    if (samples.empty())
+        return pcm_buffer();
+    Profiler::allocated(samples.size()*sizeof(float));
+    pcm_buffer out(new PcmBuffer(samples));
+    if (cache_.enabled() && !filename_.isNull() &&
+            !cache_.store(filename_, *data_, channel, *out))
+        std::cerr << "Couldn't write to the PCM cache.\n";
+    return out;
+}
+
+void Soundfile::set_cache(const PcmCache& cache)
+{
+    cache_ = cache;
+}
+
 bool Soundfile::valid() const
 {
-    return data_ != NULL;
+    return !data_.isNull();
 }
 
 const QString& Soundfile::error() const
@@ -71,28 +193,71 @@ const QString& Soundfile::error() const
 
 void Soundfile::load(const QString& filename)
 {
+    if (filename == "-")
+    {
+        load_stream(stdin);
+        return;
+    }
+
+    filename_ = filename;
+    error_ = QString();
+    data_.clear();
     if (filename.endsWith(".mp3"))
-        data_ = new MP3Data(filename);
-    else
-        data_ = new SndfileData(filename);
+        data_ = QSharedPointer<SoundfileData>(new MP3Data(filename));
+    else if (filename.endsWith(".wav", Qt::CaseInsensitive))
+    {
+        data_ = QSharedPointer<SoundfileData>(new MappedWavData(filename));
+        if (!data_->valid()) // not float mono, decode it instead
+            data_.clear();
+    }
+    if (data_.isNull())
+        data_ = QSharedPointer<SoundfileData>(new SndfileData(filename));
 
     if (!data_->valid())
     {
         error_ = data_->error();
-        delete data_;
-        data_ = NULL;
+        data_.clear();
     }
 }
 
+void Soundfile::load(const QByteArray& buffer)
+{
+    filename_ = QString();
+    error_ = QString();
+    // the format isn't known, try libsndfile first, then mp3 if it looks
+    // like one, so other garbage gets the error of libsndfile
+    data_ = QSharedPointer<SoundfileData>(new SndfileData(buffer));
+    if (!data_->valid() && looks_like_mp3(buffer))
+        data_ = QSharedPointer<SoundfileData>(new MP3Data(buffer));
+    if (!data_->valid())
+    {
+        error_ = data_->error();
+        data_.clear();
+    }
+}
+
+void Soundfile::load_stream(FILE* stream)
+{
+    // Pipes can't seek, which libsndfile needs for most formats and libmad
+    // needs the whole buffer anyway, so the stream is read into memory.
+    QFile in;
+    if (!in.open(stream, QIODevice::ReadOnly))
+    {
+        error_ = in.errorString();
+        data_.clear();
+        return;
+    }
+    load(in.readAll());
+}
+
 void Soundfile::reset()
 {
-    delete data_;
-    data_ = NULL;
+    data_.clear();
 }
 
 const SoundfileData& Soundfile::data() const
 {
-    assert(data_ != NULL);
+    assert(!data_.isNull());
     return *data_;
 }
 
@@ -103,6 +268,13 @@ SndfileData::SndfileData(const QString& filename)
     file_ = SndfileHandle(filename.toLocal8Bit());
 }
 
+SndfileData::SndfileData(const QByteArray& buffer)
+{
+    memory_.data = buffer;
+    memory_.position = 0;
+    file_ = SndfileHandle(memory_io, &memory_);
+}
+
 bool SndfileData::valid() const
 {
     return (file_ && !file_.error());
@@ -134,25 +306,182 @@ int SndfileData::samplerate() const
 }
 
 real_vec SndfileData::read_channel(int channel)
+{
+    return read_channel_from(channel, 0);
+}
+
+real_vec SndfileData::read_channel_from(int channel, size_t first)
 {
     assert(channel < channels());
-    real_vec buffer(frames()*channels());
-    file_.readf(&buffer[0], frames());
-    //size_t frames_read = file_.readf(&buffer[0], frames());
-    //assert(frames_read == frames());
+    if (first >= frames())
+        return real_vec();
+    if (first && file_.seek(first, SEEK_SET) != (sf_count_t)first)
+    {
+        // decode it all then
+        file_.seek(0, SEEK_SET);
+        return SoundfileData::read_channel_from(channel, first);
+    }
+    const size_t count = frames() - first;
+    real_vec out(count);
+    if (channels() == 1)
+        out.resize(std::max(file_.readf(&out[0], count), (sf_count_t)0));
+    else
+    {
+        // convert and pick the channel block by block, the interleaved data
+        // of the whole file is never held in memory
+        const size_t block = 65536;
+        real_vec buffer(block*channels());
+        size_t done = 0;
+        while (done < count)
+        {
+            const sf_count_t got =
+                file_.readf(&buffer[0], std::min(block, count-done));
+            if (got <= 0)
+                break;
+            for (sf_count_t i = 0; i < got; ++i)
+                out[done+i] = buffer[i*channels()+channel];
+            done += got;
+        }
+        out.resize(done);
+    }
     file_.seek(0, SEEK_SET);
+    return out;
+}
+
+SndfileData::~SndfileData()
+{
+}
+
+QString SndfileData::decoder() const
+{
+    return QString("libsndfile ") + sf_version_string();
+}
+
+// ---
+
+MappedWavData::MappedWavData(const QString& fname)
+    : filename_(fname)
+    , data_offset_(0)
+    , frames_(0)
+    , samplerate_(0)
+{
+    parse_header();
+}
+
+/// Finds the format and the position of the samples in the RIFF chunks.
+void MappedWavData::parse_header()
+{
+    QFile file(filename_);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        error_ = "Error opening file.";
+        return;
+    }
+    const qint64 size = file.size();
+    const uchar* buf = file.map(0, size);
+    if (!buf || size < 12 || std::memcmp(buf, "RIFF", 4) ||
+            std::memcmp(buf+8, "WAVE", 4))
+    {
+        error_ = "Not a WAV file.";
+        return;
+    }
+
+    int format = 0;
+    int channels = 0;
+    int bits = 0;
+    qint64 pos = 12;
+    while (pos+8 <= size)
+    {
+        const uchar* chunk = buf+pos;
+        const qint64 chunksize = qFromLittleEndian<quint32>(chunk+4);
+        if (!std::memcmp(chunk, "fmt ", 4) && chunksize >= 16 &&
+                pos+8+chunksize <= size)
+        {
+            format = qFromLittleEndian<quint16>(chunk+8);
+            channels = qFromLittleEndian<quint16>(chunk+10);
+            samplerate_ = qFromLittleEndian<quint32>(chunk+12);
+            bits = qFromLittleEndian<quint16>(chunk+22);
+            if (format == 0xFFFE && chunksize >= 40) // WAVE_FORMAT_EXTENSIBLE
+                format = qFromLittleEndian<quint16>(chunk+32);
+        }
+        else if (!std::memcmp(chunk, "data", 4))
+        {
+            data_offset_ = pos+8;
+            // streamed files can have a bogus data size
+            const qint64 bytes = std::min(chunksize, size-data_offset_);
+            frames_ = bytes/sizeof(float);
+            break;
+        }
+        pos += 8 + chunksize + (chunksize&1);
+    }
+
+    // 3 = WAVE_FORMAT_IEEE_FLOAT
+    if (format != 3 || bits != 32 || channels != 1 || !data_offset_ ||
+            data_offset_%sizeof(float) || Q_BYTE_ORDER != Q_LITTLE_ENDIAN)
+        error_ = "Not a mono float WAV file.";
+}
+
+QString MappedWavData::error() const
+{
+    return error_;
+}
+
+real_vec MappedWavData::read_channel(int channel)
+{
+    pcm_buffer samples = map_channel(channel);
+    if (!samples)
+        return real_vec();
+    return real_vec(samples->data(), samples->data()+samples->size());
+}
 
-    if (channels() > 1)
+pcm_buffer MappedWavData::map_channel(int channel)
+{
+    assert(channel == 0);
+    QFile* file = new QFile(filename_);
+    const uchar* map = NULL;
+    if (file->open(QIODevice::ReadOnly))
+        map = file->map(data_offset_, frames_*sizeof(float));
+    if (!map)
     {
-        for (size_t i = channel, j = 0; j < frames(); i += channels(), ++j)
-            buffer[j] = buffer[i];
-        buffer.resize(frames());
+        delete file;
+        return pcm_buffer();
     }
-    return buffer;
+    return pcm_buffer(new PcmBuffer(file, (const float*)map, frames_));
 }
 
-SndfileData::~SndfileData()
+bool MappedWavData::mapped() const
+{
+    return true;
+}
+
+size_t MappedWavData::frames() const
+{
+    return frames_;
+}
+
+double MappedWavData::length() const
+{
+    return (double)frames_/samplerate_;
+}
+
+int MappedWavData::samplerate() const
+{
+    return samplerate_;
+}
+
+int MappedWavData::channels() const
+{
+    return 1;
+}
+
+bool MappedWavData::valid() const
+{
+    return error_.isEmpty();
+}
+
+QString MappedWavData::decoder() const
 {
+    return "mapped float wav";
 }
 
 // ---
@@ -167,6 +496,33 @@ MP3Data::MP3Data(const QString& fname)
     get_mp3_stats();
 }
 
+MP3Data::MP3Data(const QByteArray& buffer)
+    : frames_(0)
+    , length_(0)
+    , samplerate_(0)
+    , channels_(0)
+    , buffer_(buffer)
+{
+    get_mp3_stats();
+}
+
+/// Gives the encoded data, either from the memory buffer or mapped from the file.
+bool MP3Data::map_data(QFile& file, const uchar*& buf, qint64& size) const
+{
+    if (filename_.isNull())
+    {
+        buf = (const uchar*)buffer_.constData();
+        size = buffer_.size();
+        return size > 0;
+    }
+    file.setFileName(filename_);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    size = file.size();
+    buf = file.map(0, size);
+    return buf != NULL;
+}
+
 void MP3Data::get_mp3_stats()
 {
     mad_stream stream;
@@ -174,15 +530,16 @@ void MP3Data::get_mp3_stats()
     mad_stream_init(&stream);
     mad_header_init(&header);
 
-    QFile file(filename_);
-    if (!file.open(QIODevice::ReadOnly))
+    QFile file;
+    const uchar* buf;
+    qint64 size;
+    if (!map_data(file, buf, size))
     {
         error_ = "Error opening file.";
         goto cleanup;
     }
     {
-    uchar* buf = file.map(0, file.size());
-    mad_stream_buffer(&stream, buf, file.size());
+    mad_stream_buffer(&stream, buf, size);
 
     while (true)
     {
@@ -234,12 +591,13 @@ real_vec MP3Data::read_channel(int channel)
 
     real_vec result;
 
-    QFile file(filename_);
-    if (!file.open(QIODevice::ReadOnly))
+    QFile file;
+    const uchar* buf;
+    qint64 size;
+    if (!map_data(file, buf, size))
         goto cleanup;
     {
-    uchar* buf = file.map(0, file.size());
-    mad_stream_buffer(&stream, buf, file.size());
+    mad_stream_buffer(&stream, buf, size);
 
     while (true)
     {
@@ -293,3 +651,287 @@ bool MP3Data::valid() const
 {
     return error_.isEmpty();
 }
+
+QString MP3Data::decoder() const
+{
+    return QString("libmad ") + mad_version;
+}
+
+// ---
+
+pcm_buffer SoundfileData::map_channel(int channel)
+{
+    real_vec samples = read_channel(channel);
+    if (samples.empty())
+        return pcm_buffer();
+    return pcm_buffer(new PcmBuffer(samples));
+}
+
+real_vec SoundfileData::read_channel_from(int channel, size_t first)
+{
+    real_vec samples = read_channel(channel);
+    samples.erase(samples.begin(),
+            samples.begin() + std::min(first, samples.size()));
+    return samples;
+}
+
+bool SoundfileData::mapped() const
+{
+    return false;
+}
+
+PcmBuffer::PcmBuffer(real_vec& samples)
+    : file_(NULL)
+{
+    owned_.swap(samples);
+    data_ = owned_.empty() ? NULL : &owned_[0];
+    size_ = owned_.size();
+}
+
+PcmBuffer::PcmBuffer(QFile* file, const float* samples, size_t size)
+    : file_(file)
+    , data_(samples)
+    , size_(size)
+{
+}
+
+PcmBuffer::~PcmBuffer()
+{
+    delete file_; // also unmaps the samples
+}
+
+const float* PcmBuffer::data() const
+{
+    return data_;
+}
+
+size_t PcmBuffer::size() const
+{
+    return size_;
+}
+
+bool PcmBuffer::empty() const
+{
+    return size_ == 0;
+}
+
+// ---
+
+PcmStream::PcmStream(FILE* stream, int samplerate, int channels,
+        Format format)
+    : stream_(stream)
+    , samplerate_(samplerate)
+    , channels_(channels)
+    , format_(format)
+{
+}
+
+bool PcmStream::open()
+{
+    char head[12];
+    const size_t got = std::fread(head, 1, sizeof(head), stream_);
+    if (got < sizeof(head) || std::memcmp(head, "RIFF", 4) ||
+            std::memcmp(head+8, "WAVE", 4))
+    {
+        // raw PCM
+        pending_ = QByteArray(head, got);
+        return true;
+    }
+
+    int format = 0;
+    int bits = 0;
+    uchar chunk[8];
+    while (std::fread(chunk, 1, sizeof(chunk), stream_) == sizeof(chunk))
+    {
+        // the data chunk comes last, its size is bogus in streamed files
+        if (!std::memcmp(chunk, "data", 4))
+        {
+            // 1 = WAVE_FORMAT_PCM, 3 = WAVE_FORMAT_IEEE_FLOAT
+            if (format == 1 && bits == 16)
+                format_ = PCM_S16;
+            else if (format == 3 && bits == 32)
+                format_ = PCM_F32;
+            else
+            {
+                error_ = "Only 16-bit integer and 32-bit float WAV streams "
+                    "are supported.";
+                return false;
+            }
+            if (channels_ < 1 || samplerate_ < 1)
+            {
+                error_ = "Invalid WAV header.";
+                return false;
+            }
+            return true;
+        }
+        const size_t size = qFromLittleEndian<quint32>(chunk+4);
+        uchar fmt[40];
+        const size_t body = !std::memcmp(chunk, "fmt ", 4) && size >= 16 ?
+            std::min(size, sizeof(fmt)) : 0;
+        if (std::fread(fmt, 1, body, stream_) != body ||
+                !skip(size - body + (size&1)))
+            break;
+        if (body)
+        {
+            format = qFromLittleEndian<quint16>(fmt);
+            channels_ = qFromLittleEndian<quint16>(fmt+2);
+            samplerate_ = qFromLittleEndian<quint32>(fmt+4);
+            bits = qFromLittleEndian<quint16>(fmt+14);
+            if (format == 0xFFFE && body >= 26) // WAVE_FORMAT_EXTENSIBLE
+                format = qFromLittleEndian<quint16>(fmt+24);
+        }
+    }
+    error_ = "Truncated WAV header.";
+    return false;
+}
+
+bool PcmStream::skip(size_t bytes)
+{
+    // pipes can't seek
+    char buf[4096];
+    while (bytes)
+    {
+        const size_t n = std::min(bytes, sizeof(buf));
+        if (std::fread(buf, 1, n, stream_) != n)
+            return false;
+        bytes -= n;
+    }
+    return true;
+}
+
+int PcmStream::samplerate() const
+{
+    return samplerate_;
+}
+
+int PcmStream::channels() const
+{
+    return channels_;
+}
+
+const QString& PcmStream::error() const
+{
+    return error_;
+}
+
+size_t PcmStream::read(int channel, size_t frames, real_vec& samples)
+{
+    assert(channel >= 0 && channel < channels_);
+    const size_t width = format_ == PCM_S16 ? 2 : 4;
+    const size_t frame = width*channels_;
+    buffer_.resize(frames*frame);
+    size_t bytes = std::min((size_t)pending_.size(), buffer_.size());
+    std::copy(pending_.constData(), pending_.constData() + bytes,
+            buffer_.begin());
+    pending_.remove(0, bytes);
+    if (bytes < buffer_.size())
+        bytes += std::fread(&buffer_[bytes], 1, buffer_.size()-bytes,
+                stream_);
+
+    // a partial frame at the end is dropped
+    const size_t count = bytes/frame;
+    samples.resize(count);
+    const uchar* in = (const uchar*)buffer_.data() + channel*width;
+    for (size_t i = 0; i < count; ++i, in += frame)
+        if (format_ == PCM_S16)
+            samples[i] = (qint16)qFromLittleEndian<quint16>(in)/32768.0f;
+        else
+        {
+            const quint32 bits = qFromLittleEndian<quint32>(in);
+            std::memcpy(&samples[i], &bits, sizeof(float));
+        }
+    return count;
+}
+
+// ---
+
+PcmCache::PcmCache()
+    : directory_(QString::fromLocal8Bit(std::getenv("SPECTROGRAM_PCM_CACHE")))
+{
+}
+
+PcmCache::PcmCache(const QString& directory)
+    : directory_(directory)
+{
+}
+
+bool PcmCache::enabled() const
+{
+    return !directory_.isEmpty();
+}
+
+QString PcmCache::path(const QString& filename, const SoundfileData& data,
+        int channel) const
+{
+    const QFileInfo info(filename);
+    QString key;
+    QTextStream(&key) << info.canonicalFilePath() << '\n'
+        << info.lastModified().toTime_t() << '\n'
+        << info.size() << '\n'
+        << data.decoder() << '\n'
+        << channel;
+    const QByteArray hash =
+        QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1);
+    return QDir(directory_).filePath(hash.toHex() + ".pcm");
+}
+
+pcm_buffer PcmCache::lookup(const QString& filename, const SoundfileData& data,
+        int channel) const
+{
+    QFile* file = new QFile(path(filename, data, channel));
+    if (!file->open(QIODevice::ReadOnly) ||
+            file->size() < (qint64)sizeof(PcmCacheHeader))
+    {
+        delete file;
+        return pcm_buffer();
+    }
+    const uchar* map = file->map(0, file->size());
+    const PcmCacheHeader* header = (const PcmCacheHeader*)map;
+    if (!map || std::memcmp(header->magic, PCM_CACHE_MAGIC, 4) ||
+            header->version != PCM_CACHE_VERSION ||
+            header->samplerate != (quint32)data.samplerate() ||
+            header->channel != (quint32)channel ||
+            file->size() != (qint64)(sizeof(PcmCacheHeader) +
+                header->samples*sizeof(float)))
+    {
+        delete file;
+        return pcm_buffer();
+    }
+    const float* samples = (const float*)(map + sizeof(PcmCacheHeader));
+    return pcm_buffer(new PcmBuffer(file, samples, header->samples));
+}
+
+bool PcmCache::store(const QString& filename, const SoundfileData& data,
+        int channel, const PcmBuffer& samples) const
+{
+    if (!QDir().mkpath(directory_))
+        return false;
+
+    PcmCacheHeader header;
+    std::memcpy(header.magic, PCM_CACHE_MAGIC, 4);
+    header.version = PCM_CACHE_VERSION;
+    header.samplerate = data.samplerate();
+    header.channel = channel;
+    header.samples = samples.size();
+    header.reserved = 0;
+
+    // write to a temporary file first, so readers never see a partial file
+    QTemporaryFile tmp(QDir(directory_).filePath("pcm-XXXXXX.tmp"));
+    if (!tmp.open())
+        return false;
+    const qint64 bytes = samples.size()*sizeof(float);
+    if (tmp.write((const char*)&header, sizeof(header)) != sizeof(header) ||
+            tmp.write((const char*)samples.data(), bytes) != bytes ||
+            !tmp.flush())
+        return false;
+
+    const QString target = path(filename, data, channel);
+    tmp.setAutoRemove(false);
+    QFile::remove(target);
+    if (!tmp.rename(target))
+    {
+        tmp.remove();
+        return false;
+    }
+    return true;
+}
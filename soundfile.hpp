@@ -6,11 +6,43 @@
 
 #include <QString>
 #include <QFile>
+#include <QSharedPointer>
+#include <QByteArray>
+#include <cstdio>
 #include <vector>
 #include <sndfile.hh>
 #include "types.hpp"
 #include "mad.h"
 
+/// Read-only PCM data of a single audio channel.
+/** The samples are either owned by the buffer or memory-mapped from a file.
+ * Users only see a contiguous array of floats, so the data can be handed over
+ * to the analysis without copying. */
+class PcmBuffer
+{
+    public:
+        /// Takes over the samples from the vector, which is left empty.
+        PcmBuffer(real_vec& samples);
+        /// Uses samples memory-mapped from the file, takes ownership of it.
+        PcmBuffer(QFile* file, const float* samples, size_t size);
+        ~PcmBuffer();
+        /// Returns a pointer to the first sample.
+        const float* data() const;
+        /// Returns the number of samples.
+        size_t size() const;
+        bool empty() const;
+    private:
+        PcmBuffer(const PcmBuffer&);
+        PcmBuffer& operator=(const PcmBuffer&);
+        real_vec owned_;
+        QFile* file_;
+        const float* data_;
+        size_t size_;
+};
+
+/// Shared handle to immutable channel data.
+typedef QSharedPointer<const PcmBuffer> pcm_buffer;
+
 /// An abstract interface for decoding sound files.
 /** It provides abstraction for all low-level functions used on sound files, implementation can be different for each format. */
 class SoundfileData
@@ -21,6 +53,16 @@ class SoundfileData
         virtual QString error() const = 0;
         /// Loads a specified channel into a real-valued vector.
         virtual real_vec read_channel(int channel) = 0;
+        /// Loads a channel from the given frame on.
+        /** The default implementation decodes the whole channel, formats
+         * that can seek skip the frames before first. */
+        virtual real_vec read_channel_from(int channel, size_t first);
+        /// Gives access to a channel without copying, if the format allows it.
+        /** The default implementation hands over the result of read_channel().
+         * \return A null pointer if the channel couldn't be read. */
+        virtual pcm_buffer map_channel(int channel);
+        /// Returns true if map_channel() refers to the file without decoding.
+        virtual bool mapped() const;
         /// Returns the number of audio frames in each channel.
         virtual size_t frames() const = 0;
         /// Returns the length of the audio track in seconds.
@@ -31,6 +73,16 @@ class SoundfileData
         virtual int channels() const = 0;
         /// Checks if the audio file is loaded correctly and ready for use.
         virtual bool valid() const = 0;
+        /// Identifies the decoder and its version.
+        /** Decoded data cached by PcmCache is invalidated when this changes. */
+        virtual QString decoder() const = 0;
+};
+
+/// A byte buffer with a read position, used for reading audio from memory.
+struct MemoryStream
+{
+    QByteArray data;
+    sf_count_t position;
 };
 
 /// Implements the SoundfileData interface using libsndfile.
@@ -39,16 +91,48 @@ class SndfileData : public SoundfileData
 {
     public:
         SndfileData(const QString& fname);
+        /// Reads an audio file from memory (via libsndfile virtual I/O).
+        SndfileData(const QByteArray& buffer);
         ~SndfileData();
         QString error() const;
         real_vec read_channel(int channel);
+        real_vec read_channel_from(int channel, size_t first);
         size_t frames() const;
         double length() const; //in seconds
         int samplerate() const;
         int channels() const;
         bool valid() const;
+        QString decoder() const;
     private:
         SndfileHandle file_;
+        MemoryStream memory_;
+};
+
+/// Implements the SoundfileData interface by memory-mapping float WAV files.
+/** Mono WAV files with 32-bit float samples in the machine byte order are
+ * mapped and used in place, so reading a channel costs no more than the page
+ * cache.  Other files aren't valid() and are left to SndfileData. */
+class MappedWavData : public SoundfileData
+{
+    public:
+        MappedWavData(const QString& fname);
+        QString error() const;
+        real_vec read_channel(int channel);
+        pcm_buffer map_channel(int channel);
+        bool mapped() const;
+        size_t frames() const;
+        double length() const; //in seconds
+        int samplerate() const;
+        int channels() const;
+        bool valid() const;
+        QString decoder() const;
+    private:
+        void parse_header();
+        QString filename_;
+        QString error_;
+        qint64 data_offset_;
+        size_t frames_;
+        int samplerate_;
 };
 
 /// Implements the SoundfileData interface using libmad.
@@ -57,6 +141,8 @@ class MP3Data : public SoundfileData
 {
     public:
         MP3Data(const QString& fname);
+        /// Decodes an mp3 file held in memory.
+        MP3Data(const QByteArray& buffer);
         QString error() const;
         real_vec read_channel(int channel);
         size_t frames() const;
@@ -64,18 +150,90 @@ class MP3Data : public SoundfileData
         int samplerate() const;
         int channels() const;
         bool valid() const;
+        QString decoder() const;
     private:
         void get_mp3_stats();
+        bool map_data(QFile& file, const uchar*& buf, qint64& size) const;
         size_t frames_;
         size_t length_;
         int samplerate_;
         int channels_;
         QString filename_;
+        QByteArray buffer_;
         QString error_;
 };
 
+/// Reads the samples of a stream while it is being written.
+/** Soundfile::load_stream() waits for the end of the stream, this reads it
+ * piece by piece, so a pipe or a FIFO can be analyzed live.  The stream is a
+ * WAV file, whose data size is ignored, or raw little-endian PCM. */
+class PcmStream
+{
+    public:
+        /// Sample formats of raw PCM.
+        enum Format
+        {
+            PCM_S16,
+            PCM_F32
+        };
+        /// The format of raw PCM, a WAV header overrides it.
+        PcmStream(FILE* stream, int samplerate, int channels, Format format);
+        /// Reads the WAV header, if the stream starts with one.
+        /** \return false if it isn't supported, see error(). */
+        bool open();
+        int samplerate() const;
+        int channels() const;
+        /// Reads the next frames and returns the samples of a channel.
+        /** Blocks until all the frames arrived.
+         * \return The number of frames, fewer only at the end of the
+         * stream. */
+        size_t read(int channel, size_t frames, real_vec& samples);
+        const QString& error() const;
+    private:
+        /// Skips bytes of the stream, returns false if it ended.
+        bool skip(size_t bytes);
+        FILE* stream_;
+        int samplerate_;
+        int channels_;
+        Format format_;
+        /// Bytes read while looking for a header, the first samples.
+        QByteArray pending_;
+        std::vector<char> buffer_;
+        QString error_;
+};
+
+/// On-disk cache of decoded PCM data.
+/** Every decoded channel is stored in its own file, named by a hash of the
+ * source file path, its modification time and size, the decoder version and
+ * the channel number.  The file holds a short header followed by raw floats in
+ * native byte order, so on later runs it is simply memory-mapped instead of
+ * decoding the source again.
+ *
+ * The cache is disabled unless a directory is given, by default it is taken
+ * from the \c SPECTROGRAM_PCM_CACHE environment variable.
+ */
+class PcmCache
+{
+    public:
+        PcmCache();
+        PcmCache(const QString& directory);
+        /// Returns true if the cache has a directory to work with.
+        bool enabled() const;
+        /// Returns the cached channel, or a null pointer if it isn't cached.
+        pcm_buffer lookup(const QString& filename, const SoundfileData& data,
+                int channel) const;
+        /// Stores a decoded channel, returns false if it couldn't be written.
+        bool store(const QString& filename, const SoundfileData& data,
+                int channel, const PcmBuffer& samples) const;
+    private:
+        QString path(const QString& filename, const SoundfileData& data,
+                int channel) const;
+        QString directory_;
+};
+
 /// A format-independent class that provides functionality for sound manipulation, reading and writing.
-/** It aggregates all implementations of SndfileData. */
+/** It aggregates all implementations of SndfileData.  Copies share the
+ * loaded file, so a copy can be handed over to a worker thread cheaply. */
 class Soundfile
 {
     public:
@@ -90,8 +248,12 @@ class Soundfile
         Soundfile(const QString& fname);
         /// Forget the loaded file.
         void reset();
-        /// Loads the specified file.
+        /// Loads the specified file, "-" stands for the standard input.
         void load(const QString& fname);
+        /// Loads a sound file held in memory, the format is detected.
+        void load(const QByteArray& buffer);
+        /// Reads a sound file from a stream, which doesn't need to be seekable.
+        void load_stream(FILE* stream);
         /// If the loaded file isn't valid, this function gives the reason.
         const QString& error() const;
         /// Used to determine if a file was loaded successfully.
@@ -99,11 +261,23 @@ class Soundfile
         /// Read the audio data of the given channel from the loaded file.
         /** \return PCM data of the specified audio channel */
         real_vec read_channel(int channel);
+        /// Reads a channel from the given frame on.
+        /** Only the new part of a growing file is decoded, if the format
+         * can seek.  The PCM cache isn't used. */
+        real_vec read_channel(int channel, size_t first);
+        /// Like read_channel(), but the data can come from the PCM cache.
+        /** Decoded channels are stored in the cache, if it is enabled.
+         * \return A null pointer if the channel couldn't be read. */
+        pcm_buffer map_channel(int channel);
+        /// Sets the cache used by map_channel().
+        void set_cache(const PcmCache& cache);
         /// Allows access to low-level information about the file (eg. samplerate).
         const SoundfileData& data() const;
     private:
-        SoundfileData* data_;
+        QSharedPointer<SoundfileData> data_;
         QString error_;
+        QString filename_;
+        PcmCache cache_;
 };
 
 #endif
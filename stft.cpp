@@ -0,0 +1,221 @@
+#include "stft.hpp"
+#include "dsp.hpp"
+#include "fft.hpp"
+#include "filterbank.hpp"
+#include "instrument.hpp"
+#include "scratch.hpp"
+#include "simd.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+    /// Half width of the main lobe of a window, in bins.
+    double lobe_bins(Window window)
+    {
+        switch (window)
+        {
+            case WINDOW_RECTANGULAR:
+                return 1;
+            case WINDOW_BLACKMAN:
+                return 3;
+            default:
+                return 2;
+        }
+    }
+
+    /// Length of the signal whose bands a stream has.
+    const size_t stream_reference = 1 << 22;
+}
+
+const size_t StftAnalysis::batch;
+
+StftAnalysis::StftAnalysis(const SpectrogramEngine& engine, size_t samples,
+        double rate)
+{
+    // the columns and rows of the filterbank analysis of the padded signal
+    const size_t padded = padded_length(samples);
+    const size_t spectrum_size = padded/2+1;
+    columns_ = (spectrum_size-1)*2*engine.pixpersec/rate;
+    hop_ = columns_ ? (double)(spectrum_size-1)*2/columns_ : 0;
+    plan(engine, padded, rate);
+}
+
+StftAnalysis::StftAnalysis(const SpectrogramEngine& engine, double rate)
+    : columns_(std::numeric_limits<size_t>::max())
+    , hop_(rate/engine.pixpersec)
+{
+    plan(engine, stream_reference, rate);
+}
+
+void StftAnalysis::plan(const SpectrogramEngine& engine, size_t padded,
+        double rate)
+{
+    const size_t spectrum_size = padded/2+1;
+    // the main lobe of the window as wide as a band
+    double hzbandwidth = engine.bandwidth;
+    if (engine.frequency_axis == SCALE_LOGARITHMIC)
+    {
+        const double middle = cent2freq((freq2cent(engine.basefreq) +
+                    freq2cent(engine.maxfreq))/2);
+        hzbandwidth = middle*(cent2freq(engine.bandwidth/2) -
+                cent2freq(-engine.bandwidth/2));
+    }
+    const size_t min_frame = 16;
+    size_t frame = 2*lobe_bins(engine.window)*rate/hzbandwidth;
+    frame = std::max(min_frame, std::min(frame, padded));
+    transform_ = padded_length(frame);
+    window_.resize(frame);
+    double sum = 0;
+    double squares = 0;
+    for (size_t i = 0; i < frame; ++i)
+    {
+        window_[i] = window_coef((i+0.5)/frame, engine.window);
+        sum += window_[i];
+        squares += window_[i]*window_[i];
+    }
+    // the power of a sinusoid summed over its bins, relative to its peak
+    const double noise_bandwidth = transform_*squares/(sum*sum);
+
+    const double filterscale = ((double)spectrum_size*2)/rate;
+    std::unique_ptr<Filterbank> filterbank = Filterbank::get_filterbank(
+            engine.frequency_axis, filterscale, engine.basefreq,
+            engine.bandwidth, engine.overlap);
+    const int top_index = engine.maxfreq*filterscale;
+    const double bins_per_index = (double)transform_/(2*spectrum_size);
+    const size_t last_bin = transform_/2;
+    for (int bandidx = 0;; ++bandidx)
+    {
+        const intpair range = filterbank->get_band(bandidx);
+        if (range.first > top_index)
+            break;
+        // the filterbank cuts the bands at maxfreq
+        const int high = std::min(range.second, top_index);
+        const size_t low_bin = std::ceil(range.first*bins_per_index);
+        const size_t high_bin = std::min((size_t)std::ceil(
+                    high*bins_per_index), last_bin+1);
+        real_vec weights;
+        if (high_bin >= low_bin+2)
+        {
+            first_bins_.push_back(low_bin);
+            for (size_t k = low_bin; k < high_bin; ++k)
+            {
+                const double coef = window_coef_at(k/bins_per_index,
+                        range.first, range.second, filterscale, engine.window,
+                        engine.frequency_axis);
+                weights.push_back(coef*coef);
+            }
+        }
+        else
+        {
+            // narrower than the bins, the power at its center
+            const double center =
+                filterbank->get_center(bandidx)*bins_per_index;
+            const size_t bin = std::min((size_t)center, last_bin-1);
+            const double fraction = std::min(center-bin, 1.0);
+            first_bins_.push_back(bin);
+            weights.push_back((1-fraction)*noise_bandwidth);
+            weights.push_back(fraction*noise_bandwidth);
+        }
+        weights_.push_back(weights);
+    }
+}
+
+int StftAnalysis::rows() const
+{
+    return weights_.size();
+}
+
+size_t StftAnalysis::columns() const
+{
+    return columns_;
+}
+
+double StftAnalysis::hop() const
+{
+    return hop_;
+}
+
+size_t StftAnalysis::frame_length() const
+{
+    return window_.size();
+}
+
+long StftAnalysis::frame_start(size_t column) const
+{
+    return (long)std::floor(column*hop_ + 0.5) - (long)window_.size()/2;
+}
+
+size_t StftAnalysis::bytes() const
+{
+    size_t total = sizeof(*this) + window_.size()*sizeof(float) +
+        first_bins_.size()*sizeof(size_t);
+    for (size_t i = 0; i < weights_.size(); ++i)
+        total += sizeof(real_vec) + weights_[i].size()*sizeof(float);
+    const size_t bins = transform_/2+1;
+    return total + ScratchArena::bytes<float>(batch*transform_) +
+        ScratchArena::bytes<Complex>(batch*bins) +
+        ScratchArena::bytes<float>(bins);
+}
+
+bool StftAnalysis::analyze(const float* signal, size_t samples, size_t first,
+        size_t count, intensity_matrix& data, const CancelToken* cancel) const
+{
+    return analyze(signal, samples, 0, first, count, data, first, cancel);
+}
+
+bool StftAnalysis::analyze(const float* signal, size_t samples, size_t offset,
+        size_t first, size_t count, intensity_matrix& data, size_t column,
+        const CancelToken* cancel) const
+{
+    assert(data.size() == weights_.size());
+    assert(first+count <= columns_);
+    const long frame = window_.size();
+    const size_t n = transform_;
+    const size_t bins = n/2+1;
+    const size_t howmany = std::min(count, batch);
+    ScratchArena::Frame scope;
+    float* frames = scope.take<float>(howmany*n);
+    Complex* spectra = scope.take<Complex>(howmany*bins);
+    float* power = scope.take<float>(bins);
+    for (size_t done = 0; done < count; done += howmany)
+    {
+        if (cancelled(cancel))
+            return false;
+        const size_t block = std::min(howmany, count-done);
+        {
+            ScopedTimer timer("stft.frames");
+            std::fill(frames, frames+block*n, 0.0f);
+            for (size_t f = 0; f < block; ++f)
+            {
+                const long start = frame_start(first+done+f) - (long)offset;
+                const long low = std::max(0L, -start);
+                const long high = std::min(frame, (long)samples - start);
+                if (low < high)
+                    simd::multiply_add(frames + f*n + low,
+                            signal + start + low, &window_[low], high-low);
+            }
+        }
+        {
+            ScopedTimer timer("stft.fft");
+            for (size_t f = 0; f < block; ++f)
+                Profiler::fft(frame, n);
+            const fft_plan_ptr plan = fft_plan(FFT_R2C, n, block, true);
+            plan->r2c(frames, spectra);
+        }
+        ScopedTimer timer("stft.rows");
+        for (size_t f = 0; f < block; ++f)
+        {
+            const Complex* spectrum = spectra + f*bins;
+            for (size_t k = 0; k < bins; ++k)
+                power[k] = std::norm(spectrum[k]);
+            for (size_t row = 0; row < weights_.size(); ++row)
+                data[row][column+done+f] = std::sqrt(simd::dot(&weights_[row][0],
+                            power + first_bins_[row], weights_[row].size()));
+        }
+    }
+    return true;
+}
@@ -0,0 +1,82 @@
+#ifndef STFT_HPP
+#define STFT_HPP
+
+/** \file stft.hpp
+ *  \brief Short-time Fourier transform analysis, the fast alternative to
+ *  the filterbank.
+ *
+ *  SpectrogramEngine::analyze() normally transforms the whole signal at
+ *  once and takes the envelope of every band with inverse transforms.  That
+ *  is exact, but it costs O(N log N) plus a pass over the signal per band.
+ *  With ANALYSIS_STFT it uses StftAnalysis instead: one windowed frame per
+ *  column, 1/pixpersec apart, whose bins are summed onto the rows of the
+ *  same Filterbank.  That is O(N log W) for frames of W samples, and a
+ *  column only needs the samples around it.
+ *
+ *  The frame length follows from the bandwidth, the main lobe of the window
+ *  is as wide as a band.  On a logarithmic frequency axis that is the band
+ *  halfway (in cents) between basefreq and maxfreq.  Lower rows narrower
+ *  than a bin are interpolated between the bins, so the low end is only a
+ *  quick look.
+ */
+
+#include <vector>
+#include "engine.hpp"
+
+/// Frames and row weights of an STFT analysis of a signal.
+class StftAnalysis
+{
+    public:
+        /// Frames transformed at once by analyze().
+        static const size_t batch = 32;
+
+        /// Plans the analysis of samples at rate, after the decimation.
+        StftAnalysis(const SpectrogramEngine& engine, size_t samples,
+                double rate);
+        /// Plans the analysis of a signal of unknown length, see AnalysisStream.
+        /** The columns are exactly rate/pixpersec samples apart and there
+         * is no last one.  The rows are the bands of a signal of 2^22
+         * samples, so they don't depend on the length either. */
+        StftAnalysis(const SpectrogramEngine& engine, double rate);
+        /// Number of rows, the bands of the filterbank analysis.
+        int rows() const;
+        /// Number of columns, the width of the filterbank analysis.
+        size_t columns() const;
+        /// Samples between the centers of consecutive columns.
+        double hop() const;
+        /// Samples of a frame.
+        size_t frame_length() const;
+        /// Index of the first sample of the frame of a column, may be negative.
+        long frame_start(size_t column) const;
+        /// Computes the intensities of the columns <first,first+count).
+        /** Column c is centered on sample c*hop(), samples outside of the
+         * signal count as zeros.  The intensities aren't normalized.
+         * \param data rows() rows of columns() values.
+         * \return false if the token was cancelled. */
+        bool analyze(const float* signal, size_t samples, size_t first,
+                size_t count, intensity_matrix& data,
+                const CancelToken* cancel = 0) const;
+        /// Computes columns from a part of the signal.
+        /** \param offset Index of signal[0] in the whole signal, the frames
+         * may only reach samples before it if they are zeros.
+         * \param column The column of data where the first one goes. */
+        bool analyze(const float* signal, size_t samples, size_t offset,
+                size_t first, size_t count, intensity_matrix& data,
+                size_t column, const CancelToken* cancel = 0) const;
+        /// Returns the memory of the plan and of analyze() in bytes.
+        size_t bytes() const;
+
+    private:
+        /// Computes the frame and the rows of a signal of padded samples.
+        void plan(const SpectrogramEngine& engine, size_t padded, double rate);
+
+        size_t columns_;
+        double hop_;
+        size_t transform_;
+        real_vec window_;
+        /// First bin and power weights of each row.
+        std::vector<size_t> first_bins_;
+        std::vector<real_vec> weights_;
+};
+
+#endif
@@ -0,0 +1,178 @@
+#include "stream.hpp"
+#include "dsp.hpp"
+#include "instrument.hpp"
+#include "scratch.hpp"
+
+#include <algorithm>
+
+AnalysisStream::AnalysisStream(const SpectrogramEngine& engine,
+        int samplerate)
+    : input_start_(0)
+    , signal_start_(0)
+    , columns_(0)
+    , reference_(0)
+{
+    start(engine, samplerate);
+}
+
+AnalysisStream::AnalysisStream(const SpectrogramEngine& engine,
+        int samplerate, size_t columns, float reference)
+    : columns_(columns)
+    , reference_(reference)
+{
+    start(engine, samplerate);
+    // the frame of the next column, and the samples its filter reads
+    signal_start_ = std::max(0L, stft_->frame_start(columns_));
+    const long first = (long)signal_start_*factor_ - reach_;
+    input_start_ = first > 0 ? first/factor_*factor_ : 0;
+}
+
+void AnalysisStream::start(const SpectrogramEngine& engine, int samplerate)
+{
+    samplerate_ = samplerate;
+    maxfreq_ = engine.maxfreq;
+    factor_ = decimation_factor(samplerate, engine.maxfreq);
+    reach_ = factor_ > 1 ?
+        decimation_reach(factor_, engine.maxfreq, samplerate) : 0;
+    stft_.reset(new StftAnalysis(engine, (double)samplerate/factor_));
+}
+
+int AnalysisStream::rows() const
+{
+    return stft_->rows();
+}
+
+size_t AnalysisStream::columns() const
+{
+    return columns_;
+}
+
+size_t AnalysisStream::position() const
+{
+    if (factor_ > 1)
+        return input_start_ + input_.size();
+    return signal_start_ + signal_.size();
+}
+
+float AnalysisStream::reference() const
+{
+    return reference_;
+}
+
+double AnalysisStream::latency() const
+{
+    // the second half of the frame centered on the sample, and what the
+    // decimation filter reads after the last sample of the frame
+    const long frame = stft_->frame_length();
+    return ((double)(frame - frame/2)*factor_ + reach_)/samplerate_;
+}
+
+intensity_matrix AnalysisStream::append(const float* samples, size_t count,
+        const CancelToken* cancel)
+{
+    if (factor_ == 1)
+        signal_.insert(signal_.end(), samples, samples+count);
+    else
+    {
+        input_.insert(input_.end(), samples, samples+count);
+        if (!decimate_input(false, cancel))
+            return intensity_matrix();
+    }
+    return analyze(false, cancel);
+}
+
+intensity_matrix AnalysisStream::finish(const CancelToken* cancel)
+{
+    if (factor_ > 1 && !decimate_input(true, cancel))
+        return intensity_matrix();
+    return analyze(true, cancel);
+}
+
+bool AnalysisStream::decimate_input(bool end, const CancelToken* cancel)
+{
+    const size_t received = input_start_ + input_.size();
+    const size_t produced = signal_start_ + signal_.size();
+    size_t available;
+    if (end)
+        available = (received+factor_-1)/factor_;
+    else
+        available = received > (size_t)reach_ ?
+            (received-1-reach_)/factor_+1 : 0;
+    if (available <= produced)
+        return true;
+
+    ScopedTimer timer("stream.decimate");
+    // input_start_ is a multiple of the factor, the decimated samples
+    // before produced only come out again
+    const real_vec decimated = decimate(&input_[0], input_.size(), factor_,
+            maxfreq_, samplerate_, cancel);
+    if (cancelled(cancel))
+        return false;
+    const size_t first = input_start_/factor_;
+    signal_.insert(signal_.end(), decimated.begin() + (produced-first),
+            decimated.begin() + (available-first));
+
+    // keep what the filter reads for the next decimated samples
+    const long keep = (long)available*factor_ - reach_;
+    if (keep > (long)input_start_)
+    {
+        const size_t start = std::min((size_t)keep/factor_*factor_,
+                received);
+        input_.erase(input_.begin(), input_.begin() + (start-input_start_));
+        input_start_ = start;
+    }
+    return true;
+}
+
+intensity_matrix AnalysisStream::analyze(bool end, const CancelToken* cancel)
+{
+    const long produced = signal_start_ + signal_.size();
+    const long frame = stft_->frame_length();
+    // whole frames, or at the end the ones centered before it
+    size_t last = columns_;
+    while (stft_->frame_start(last) + (end ? frame/2+1 : frame) <= produced)
+        ++last;
+
+    intensity_matrix data(stft_->rows());
+    const size_t count = last - columns_;
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i].resize(count);
+    if (!count)
+        return data;
+
+    {
+        ScratchArena& scratch = ScratchArena::local();
+        ScratchArena::Frame job(scratch);
+        scratch.reserve(stft_->bytes());
+        if (!stft_->analyze(signal_.data(), signal_.size(), signal_start_,
+                    columns_, count, data, 0, cancel))
+            return intensity_matrix();
+    }
+    columns_ = last;
+
+    ScopedTimer timer("normalize");
+    // every column by the loudest value up to it, which doesn't depend on
+    // how the signal was split into appends
+    real_vec peaks(count);
+    for (size_t i = 0; i < data.size(); ++i)
+        for (size_t j = 0; j < count; ++j)
+            peaks[j] = std::max(data[i][j], peaks[j]);
+    for (size_t j = 0; j < count; ++j)
+        peaks[j] = reference_ = std::max(peaks[j], reference_);
+    for (size_t i = 0; i < data.size(); ++i)
+        for (size_t j = 0; j < count; ++j)
+            if (peaks[j] > 0)
+                data[i][j] /= peaks[j];
+
+    // the samples of the next frame on, those after produced don't exist
+    // yet
+    const long next = std::min(std::max(0L, stft_->frame_start(columns_)),
+            produced);
+    if (next > (long)signal_start_)
+    {
+        signal_.erase(signal_.begin(), signal_.begin() +
+                (next-signal_start_));
+        signal_start_ = next;
+    }
+    return data;
+}
@@ -0,0 +1,89 @@
+#ifndef STREAM_HPP
+#define STREAM_HPP
+
+/** \file stream.hpp
+ *  \brief Analysis of a signal that arrives piece by piece.
+ *
+ *  SpectrogramEngine::analyze() needs the whole signal: the filterbank
+ *  transforms all of it at once, and the image is normalized by its
+ *  loudest value.  A recording that keeps growing would have to be
+ *  analyzed again from the start for every refresh.
+ *
+ *  AnalysisStream keeps what the next columns need between calls instead:
+ *  the end of the signal the decimation filter and the frames still
+ *  overlap, the normalization reference and the StftAnalysis plan.  Given
+ *  only the new samples, append() returns only the new columns, so the
+ *  cost of a refresh follows the new audio.  The analysis is always the
+ *  STFT, whatever the method of the engine.
+ *
+ *  The state that can't be recomputed is small: the number of columns and
+ *  the reference.  A stream can be resumed from them in another process,
+ *  as long as the signal is fed again from position().
+ */
+
+#include "engine.hpp"
+#include "stft.hpp"
+
+/// Incremental STFT analysis of a growing signal.
+class AnalysisStream
+{
+    public:
+        /// Starts the analysis of a signal at samplerate.
+        AnalysisStream(const SpectrogramEngine& engine, int samplerate);
+        /// Resumes an analysis which has produced columns already.
+        /** \param reference The reference() of the analysis. */
+        AnalysisStream(const SpectrogramEngine& engine, int samplerate,
+                size_t columns, float reference);
+        /// Number of rows of the columns.
+        int rows() const;
+        /// Number of columns produced so far.
+        size_t columns() const;
+        /// Index of the sample the next append() starts with.
+        /** A resumed stream starts a little before the columns it has
+         * produced, the overlap with them. */
+        size_t position() const;
+        /// The loudest value so far, 0 until a column wasn't silent.
+        /** Every column is normalized by the reference after it, so a
+         * column only depends on the signal up to its frame, not on the
+         * sizes of the appends.  Columns before a louder part come out
+         * brighter than in SpectrogramEngine::analyze(), nothing is
+         * clipped. */
+        float reference() const;
+        /// Seconds from a sample to the column centered on it.
+        /** The rest of the frame and the lookahead of the decimation have
+         * to arrive first, whatever the sizes of the appends. */
+        double latency() const;
+        /// Analyzes the next samples of the signal.
+        /** \return rows() rows with the columns the new samples completed,
+         * possibly none, or an empty matrix if the token was cancelled. */
+        intensity_matrix append(const float* samples, size_t count,
+                const CancelToken* cancel = 0);
+        /// Analyzes the remaining columns, as if silence followed.
+        /** Nothing can be appended afterwards. */
+        intensity_matrix finish(const CancelToken* cancel = 0);
+
+    private:
+        void start(const SpectrogramEngine& engine, int samplerate);
+        /// Decimates the received samples the filter reaches over.
+        /** \param end Decimates all of them if true. */
+        bool decimate_input(bool end, const CancelToken* cancel);
+        /// Analyzes the columns whose frames end before the samples do.
+        intensity_matrix analyze(bool end, const CancelToken* cancel);
+
+        std::unique_ptr<StftAnalysis> stft_;
+        int samplerate_;
+        double maxfreq_;
+        int factor_;
+        /// Samples decimate() reads around an output sample.
+        int reach_;
+        /// Received samples not decimated yet and the overlap, from input_start_.
+        real_vec input_;
+        size_t input_start_;
+        /// Decimated samples the frames still need, from signal_start_.
+        real_vec signal_;
+        size_t signal_start_;
+        size_t columns_;
+        float reference_;
+};
+
+#endif
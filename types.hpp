@@ -7,11 +7,39 @@
 
 #include <complex>
 #include <vector>
+#include <utility>
+#include "memory.hpp"
 
 #define PI 3.1415926535897932384626433832795
 
 typedef std::complex<float> Complex;
-typedef std::vector<float> real_vec;
-typedef std::vector<Complex> complex_vec;
+typedef std::vector<float, TrackedAllocator<float> > real_vec;
+typedef std::vector<Complex, TrackedAllocator<Complex> > complex_vec;
+typedef std::pair<int,int> intpair;
+
+/// RGB color in the 0xAARRGGBB format (the same as QRgb).
+typedef unsigned int rgb_t;
+
+/// Represents the window function used for spectrogram generation.
+enum Window 
+{
+    WINDOW_HANN, /**< See http://en.wikipedia.org/wiki/Hann_window */
+    WINDOW_BLACKMAN, /**< See http://en.wikipedia.org/wiki/Window_function#Blackman_windows */
+    WINDOW_RECTANGULAR, /**< Doesn't do anything. */
+    WINDOW_TRIANGULAR /**< http://en.wikipedia.org/wiki/Triangular_window#Triangular_window_.28non-zero_end-points.29 */
+};
+/// Represents the linear or logarithmic mode for frequency and intensity axes.
+enum AxisScale {SCALE_LINEAR, SCALE_LOGARITHMIC};
+/// Represents spectrogram synthesis mode.
+enum SynthesisType {SYNTHESIS_SINE, SYNTHESIS_NOISE};
+/// Represents the analysis method, see stft.hpp and cqt.hpp.
+enum AnalysisMethod
+{
+    ANALYSIS_FILTERBANK, /**< Envelopes of frequency-domain bands of the whole signal, exact. */
+    ANALYSIS_STFT, /**< Short-time Fourier transform, faster. */
+    ANALYSIS_CQT /**< Constant-Q transform by octaves, fast on a logarithmic axis. */
+};
+/// Represents the brightness correction used in spectrogram generation.
+enum BrightCorrection {BRIGHT_NONE, BRIGHT_SQRT};
 
 #endif